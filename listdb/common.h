@@ -8,9 +8,10 @@
 #include <atomic>
 #include <cassert>
 #include <cstdio>
+#include <vector>
 
 //#define GROUP_LOGGING
-//#define L1_COW
+//#define L1_COW  // copy-on-write L0 compaction by default
 #define L0_CACHE_T_SIMPLE 1
 #define L0_CACHE_T_STATIC 2
 #define L0_CACHE_T_DOUBLE_HASHING 3
@@ -48,6 +49,22 @@ constexpr int kMaxNumMemTables = 4;
 //constexpr size_t kMemTableCapacity = 256 * (1ull << 20);
 constexpr size_t kMemTableCapacity = 1 * (1ull << 30) / kMaxNumMemTables;
 
+// Write slowdown (per shard)
+constexpr int kSlowdownImmutableMemTables = kMaxNumMemTables - 2;
+constexpr int kSlowdownL0Tables = 4;
+constexpr int64_t kDelayedWriteRate = 1024 * (1ll << 20) / kNumShards;  // bytes/sec
+constexpr int64_t kMinDelayedWriteRate = kDelayedWriteRate / 64;
+constexpr int64_t kDelayedWriteRefillUsec = 1000;
+
+// Background I/O budget, tuned by foreground write latency
+constexpr int64_t kBgIoMaxRate = 8 * (1ll << 30);  // bytes/sec
+constexpr int64_t kBgIoMinRate = 256 * (1ll << 20);
+constexpr int64_t kBgIoRefillUsec = 1000;
+constexpr int64_t kBgIoRequestBytes = 64 * (1ll << 10);
+constexpr int kBgIoAdjustPct = 10;
+constexpr int kBgIoLatencyTolerancePct = 20;
+constexpr int kWriteLatencySampleInterval = 64;
+
 constexpr int kMaxHeight = 15;
 
 #ifdef LISTDB_L1_LRU
@@ -72,8 +89,49 @@ constexpr int kNumLevels = kNumDramLevels + kNumPmemLevels;
 
 constexpr int kNumWorkers = 80;
 
+// MemTable flush
+constexpr int kFlushCacheBatch = 16;  // L0 cache insertions prefetched ahead
+// The oldest memtable of a shard skips L0 if L1 is at most this many times
+// its size, or if it lies past the last key of L1
+constexpr size_t kFlushToL1MaxRatio = 4;
+
+// Intra-shard zipper compaction
+constexpr int kNumZipperPartitions = 4;
+constexpr int kZipperPivotMinHeight = 6;
+constexpr size_t kZipperArenaBlockSize = 1ull << 20;
+constexpr size_t kZipperCursorInterval = 1024;  // merged nodes per persisted cursor update
+
+// L0 tables queued beyond the trigger are combined into the oldest one
+// before it goes to L1
+constexpr int kL0CombineTrigger = 3;
+constexpr int kMaxL0CombineTables = 8;
+
+// Layout of the root pool. Bumped on every change of the manifests in
+// core/pmem_db.h; Open() refuses pools of another layout.
+constexpr char kDbPoolLayout[] = "listdb_db_v2";
+
+// Layout of the log pools. Bumped on every change of pmem_log or
+// pmem_log_block; Open() refuses pools of another layout.
+constexpr char kLogPoolLayout[] = "listdb_log_v2";
+
 constexpr size_t kPmemLogBlockSize = 4 * (1ull<<20) / kNumShards;
 constexpr size_t kPmemBlobBlockSize = kPmemLogBlockSize;
+// Log blocks allocated (and faulted in) ahead of the append frontier
+constexpr int kNumSpareLogBlocks = 4;
+
+// Log block reclamation
+// The L1 caches keep raw pointers to L1 nodes, which relocation would break.
+#if !defined(LISTDB_WAL) && !defined(LISTDB_L1_LRU) && !defined(LISTDB_SKIPLIST_CACHE) && !defined(LISTDB_NO_LOG_RECLAMATION)
+#define LISTDB_LOG_RECLAMATION
+#endif
+constexpr double kLogReclaimThreshold = 0.5;  // obsolete fraction of a block
+constexpr int kLogReclaimIntervalMsec = 1000;  // per shard
+
+// Range-partitioned L1
+// The L1 caches are per shard and do not know the partition boundaries.
+#if !defined(LISTDB_WAL) && !defined(LISTDB_L1_LRU) && !defined(LISTDB_SKIPLIST_CACHE) && !defined(LISTDB_NO_L1_PARTITION)
+#define LISTDB_L1_PARTITION
+#endif
 
 //constexpr uint64_t kHTMask = 0x0fffffff;
 #ifndef LISTDB_SKIPLIST_CACHE
@@ -101,7 +159,10 @@ enum class TableType {
 
 enum class TaskType {
   kMemTableFlush,
-  kL0Compaction
+  kL0Compaction,
+  kL0Combine,
+  kLogReclamation,
+  kParallelJob
 };
 
 inline void SetAffinity(int coreid) {
@@ -117,6 +178,20 @@ inline void SetAffinity(int coreid) {
 #endif
 }
 
+inline void SetAffinity(const std::vector<int>& coreids) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (auto& coreid : coreids) {
+    CPU_SET(coreid, &mask);
+  }
+#ifndef NDEBUG
+  int rc = sched_setaffinity(syscall(__NR_gettid), sizeof(mask), &mask);
+  assert(rc == 0);
+#else
+  sched_setaffinity(syscall(__NR_gettid), sizeof(mask), &mask);
+#endif
+}
+
 inline int GetChip() {
   unsigned long a,d,c;
   asm volatile("rdtscp" : "=a" (a), "=d" (d), "=c" (c));
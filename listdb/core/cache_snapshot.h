@@ -0,0 +1,149 @@
+#ifndef LISTDB_CORE_CACHE_SNAPSHOT_H_
+#define LISTDB_CORE_CACHE_SNAPSHOT_H_
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "listdb/common.h"
+
+// A file image of the DRAM caches, written on Close() and mapped on the next
+// Open(). Nodes are stored as PmemPtr dumps. Every shard has a section
+// tagged with a fingerprint of its manifests; a section is used only if the
+// manifests are unchanged.
+//
+// Layout: Header | SectionInfo[kNumShards] | sections. A section holds the
+// L0 cache entries followed by the L1 cache entries of the shard.
+class CacheSnapshot {
+ public:
+  static constexpr uint64_t kMagic = 0x4c44424353484f54;  // "LDBCSHOT"
+
+  struct Entry {
+    uint64_t slot;  // bucket of an L0 cache, region (and height) of an L1 cache
+    uint64_t paddr;
+  };
+
+  struct Header {
+    uint64_t magic;
+    uint64_t config;  // must match the build and cache setup of the reader
+  };
+
+  struct SectionInfo {
+    uint64_t fingerprint;
+    uint64_t offset;
+    uint64_t num_l0_entries;
+    uint64_t num_l1_entries;
+  };
+
+  // Writes to a temporary file renamed over the path by Finish()
+  static bool Write(const std::string& path, uint64_t config,
+                    const std::vector<SectionInfo>& infos,
+                    const std::vector<std::vector<Entry>>& entries);
+
+  CacheSnapshot() = default;
+
+  ~CacheSnapshot();
+
+  // Maps the file and unlinks it, so a crash after Open() never sees it
+  // again. Returns false if there is no usable snapshot.
+  bool Open(const std::string& path, uint64_t config);
+
+  // Returns false if the section was written for other manifests
+  bool GetSection(int shard, uint64_t fingerprint,
+                  const Entry** l0_entries, size_t* num_l0_entries,
+                  const Entry** l1_entries, size_t* num_l1_entries);
+
+ private:
+  char* base_ = nullptr;
+  size_t size_ = 0;
+};
+
+bool CacheSnapshot::Write(const std::string& path, uint64_t config,
+                          const std::vector<SectionInfo>& infos,
+                          const std::vector<std::vector<Entry>>& entries) {
+  std::string tmp_path = path + ".tmp";
+  FILE* fp = fopen(tmp_path.c_str(), "wb");
+  if (fp == nullptr) {
+    fprintf(stderr, "cannot open cache snapshot %s\n", tmp_path.c_str());
+    return false;
+  }
+  Header header{kMagic, config};
+  std::vector<SectionInfo> index(infos);
+  uint64_t offset = sizeof(Header) + kNumShards * sizeof(SectionInfo);
+  for (int i = 0; i < kNumShards; i++) {
+    index[i].offset = offset;
+    offset += entries[i].size() * sizeof(Entry);
+  }
+  bool ok = (fwrite(&header, sizeof(Header), 1, fp) == 1);
+  ok = ok && (fwrite(index.data(), sizeof(SectionInfo), kNumShards, fp) == kNumShards);
+  for (int i = 0; ok && i < kNumShards; i++) {
+    ok = (fwrite(entries[i].data(), sizeof(Entry), entries[i].size(), fp) == entries[i].size());
+  }
+  ok = ok && (fflush(fp) == 0) && (fsync(fileno(fp)) == 0);
+  fclose(fp);
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    fprintf(stderr, "cannot write cache snapshot %s\n", path.c_str());
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+CacheSnapshot::~CacheSnapshot() {
+  if (base_) {
+    munmap(base_, size_);
+  }
+}
+
+bool CacheSnapshot::Open(const std::string& path, uint64_t config) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(Header) + kNumShards * sizeof(SectionInfo)) {
+    close(fd);
+    unlink(path.c_str());
+    return false;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+  close(fd);
+  unlink(path.c_str());
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  base_ = (char*) addr;
+  size_ = st.st_size;
+  Header* header = (Header*) base_;
+  if (header->magic != kMagic || header->config != config) {
+    munmap(base_, size_);
+    base_ = nullptr;
+    return false;
+  }
+  return true;
+}
+
+bool CacheSnapshot::GetSection(int shard, uint64_t fingerprint,
+                               const Entry** l0_entries, size_t* num_l0_entries,
+                               const Entry** l1_entries, size_t* num_l1_entries) {
+  if (base_ == nullptr) {
+    return false;
+  }
+  SectionInfo* info = (SectionInfo*) (base_ + sizeof(Header)) + shard;
+  size_t num_entries = info->num_l0_entries + info->num_l1_entries;
+  if (info->fingerprint != fingerprint || info->offset + num_entries * sizeof(Entry) > size_) {
+    return false;
+  }
+  *l0_entries = (Entry*) (base_ + info->offset);
+  *num_l0_entries = info->num_l0_entries;
+  *l1_entries = *l0_entries + info->num_l0_entries;
+  *num_l1_entries = info->num_l1_entries;
+  return true;
+}
+
+#endif  // LISTDB_CORE_CACHE_SNAPSHOT_H_
@@ -0,0 +1,68 @@
+#include <cstdio>
+#include <vector>
+
+#include "listdb/core/cache_snapshot.h"
+
+int main() {
+  std::string path = "/tmp/listdb_cache_snapshot_test";
+  constexpr uint64_t kConfig = 42;
+
+  std::vector<CacheSnapshot::SectionInfo> infos(kNumShards);
+  std::vector<std::vector<CacheSnapshot::Entry>> entries(kNumShards);
+  for (int i = 0; i < kNumShards; i++) {
+    infos[i].fingerprint = 1000 + i;
+    for (int k = 0; k < i % 5; k++) {
+      entries[i].push_back(CacheSnapshot::Entry{(uint64_t) k, (uint64_t) (i << 16 | k)});
+    }
+    infos[i].num_l0_entries = entries[i].size() / 2;
+    infos[i].num_l1_entries = entries[i].size() - infos[i].num_l0_entries;
+  }
+  if (!CacheSnapshot::Write(path, kConfig, infos, entries)) {
+    fprintf(stdout, "FAILED: write\n");
+    return 1;
+  }
+
+  {
+    CacheSnapshot snapshot;
+    if (snapshot.Open(path, kConfig + 1)) {
+      fprintf(stdout, "FAILED: config mismatch accepted\n");
+      return 1;
+    }
+  }
+  CacheSnapshot::Write(path, kConfig, infos, entries);
+
+  CacheSnapshot snapshot;
+  if (!snapshot.Open(path, kConfig)) {
+    fprintf(stdout, "FAILED: open\n");
+    return 1;
+  }
+  CacheSnapshot reopened;
+  if (reopened.Open(path, kConfig)) {
+    fprintf(stdout, "FAILED: snapshot used twice\n");
+    return 1;
+  }
+  for (int i = 0; i < kNumShards; i++) {
+    const CacheSnapshot::Entry* l0;
+    const CacheSnapshot::Entry* l1;
+    size_t num_l0;
+    size_t num_l1;
+    if (snapshot.GetSection(i, 0, &l0, &num_l0, &l1, &num_l1)) {
+      fprintf(stdout, "FAILED: stale section %d accepted\n", i);
+      return 1;
+    }
+    if (!snapshot.GetSection(i, 1000 + i, &l0, &num_l0, &l1, &num_l1) ||
+        num_l0 + num_l1 != entries[i].size()) {
+      fprintf(stdout, "FAILED: section %d\n", i);
+      return 1;
+    }
+    for (size_t k = 0; k < num_l0 + num_l1; k++) {
+      auto& e = (k < num_l0) ? l0[k] : l1[k - num_l0];
+      if (e.slot != entries[i][k].slot || e.paddr != entries[i][k].paddr) {
+        fprintf(stdout, "FAILED: entry %d/%zu\n", i, k);
+        return 1;
+      }
+    }
+  }
+  fprintf(stdout, "PASSED\n");
+  return 0;
+}
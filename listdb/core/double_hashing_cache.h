@@ -31,12 +31,24 @@ class DoubleHashingCache {
 
   void Insert(const Key& key, PmemNode* const p);
 
+  // Brings the home bucket of the key into the cache ahead of Insert()
+  void Prefetch(const Key& key);
+
   PmemNode* Lookup(const Key& key);
 
+  void Replace(const Key& key, PmemNode* const old_p, PmemNode* const new_p);
+
+  // Stores p only into the bucket an Insert() of the key would overwrite
+  // last, and only if it is empty, so that a concurrent Insert() of a newer
+  // version of the key is never shadowed
+  void Fill(const Key& key, PmemNode* const p);
+
   uint32_t Hash1(const Key& key);
 
   uint32_t Hash2(const Key& key);
 
+  size_t size() const { return size_; }
+
  private:
   const static int probing_distance_ = LISTDB_L0_CACHE_PROBING_DISTANCE;
 
@@ -88,6 +100,10 @@ void DoubleHashingCache::Insert(const Key& key, PmemNode* const p) {
 #endif
 }
 
+inline void DoubleHashingCache::Prefetch(const Key& key) {
+  __builtin_prefetch(&buckets_[Hash1(key) % size_], 1);
+}
+
 DoubleHashingCache::PmemNode* DoubleHashingCache::Lookup(const Key& key) {
 #if LISTDB_DOUBLE_HASHING == DOUBLE_HASHING_T_A
   uint32_t h = Hash1(key);
@@ -130,6 +146,45 @@ DoubleHashingCache::PmemNode* DoubleHashingCache::Lookup(const Key& key) {
 #endif
 }
 
+// Swaps a bucket pointing to old_p for new_p (nullptr to erase)
+void DoubleHashingCache::Replace(const Key& key, PmemNode* const old_p, PmemNode* const new_p) {
+  uint32_t h = Hash1(key);
+  PmemNode* expected = old_p;
+  if (buckets_[h % size_].value.compare_exchange_strong(expected, new_p)) {
+    return;
+  }
+#if LISTDB_DOUBLE_HASHING == DOUBLE_HASHING_T_A
+  expected = old_p;
+  buckets_[(h + Hash2(key)) % size_].value.compare_exchange_strong(expected, new_p);
+#elif LISTDB_DOUBLE_HASHING == DOUBLE_HASHING_T_B
+  uint32_t h2 = Hash2(key);
+  for (unsigned int cnt = 1; cnt <= probing_distance_; cnt++) {
+    expected = old_p;
+    if (buckets_[(h + cnt * h2) % size_].value.compare_exchange_strong(expected, new_p)) {
+      return;
+    }
+  }
+#else
+  fprintf(stderr, "DEFINE LISTDB_DOUBLE_HASHING <type>\n");
+  abort();
+#endif
+}
+
+void DoubleHashingCache::Fill(const Key& key, PmemNode* const p) {
+  uint32_t h = Hash1(key);
+#if LISTDB_DOUBLE_HASHING == DOUBLE_HASHING_T_A
+  uint32_t pos = h % size_;
+#elif LISTDB_DOUBLE_HASHING == DOUBLE_HASHING_T_B
+  unsigned int cnt = (probing_distance_ > 1) ? probing_distance_ : 1;
+  uint32_t pos = (h + cnt * Hash2(key)) % size_;
+#else
+  fprintf(stderr, "DEFINE LISTDB_DOUBLE_HASHING <type>\n");
+  abort();
+#endif
+  PmemNode* expected = nullptr;
+  buckets_[pos].value.compare_exchange_strong(expected, p);
+}
+
 inline uint32_t DoubleHashingCache::Hash1(const Key& key) {
 	uint32_t h;
 	//static const uint32_t seed = 0xcafeb0ba;
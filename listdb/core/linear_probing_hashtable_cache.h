@@ -25,10 +25,22 @@ class LinearProbingHashTableCache {
 
   void Insert(const Key& key, PmemNode* const p);
 
+  // Brings the home bucket of the key into the cache ahead of Insert()
+  void Prefetch(const Key& key);
+
   PmemNode* Lookup(const Key& key);
 
+  void Replace(const Key& key, PmemNode* const old_p, PmemNode* const new_p);
+
+  // Stores p only into the bucket an Insert() of the key would overwrite
+  // last, and only if it is empty, so that a concurrent Insert() of a newer
+  // version of the key is never shadowed
+  void Fill(const Key& key, PmemNode* const p);
+
   uint32_t Hash1(const Key& key);
 
+  size_t size() const { return size_; }
+
  private:
   const static int probing_distance_ = LISTDB_L0_CACHE_PROBING_DISTANCE;
 
@@ -66,6 +78,10 @@ void LinearProbingHashTableCache::Insert(const Key& key, PmemNode* const p) {
 #endif
 }
 
+inline void LinearProbingHashTableCache::Prefetch(const Key& key) {
+  __builtin_prefetch(&buckets_[Hash1(key) % size_], 1);
+}
+
 LinearProbingHashTableCache::PmemNode* LinearProbingHashTableCache::Lookup(const Key& key) {
 #if LISTDB_LINEAR_PROBING_HASHTABLE_CACHE == LP_HASH_T_A
   uint32_t h = Hash1(key);
@@ -88,6 +104,22 @@ LinearProbingHashTableCache::PmemNode* LinearProbingHashTableCache::Lookup(const
 #endif
 }
 
+// Swaps a bucket pointing to old_p for new_p (nullptr to erase)
+void LinearProbingHashTableCache::Replace(const Key& key, PmemNode* const old_p, PmemNode* const new_p) {
+  uint32_t h = Hash1(key);
+  for (unsigned int cnt = 0; cnt <= probing_distance_; cnt++) {
+    PmemNode* expected = old_p;
+    if (buckets_[(h + cnt) % size_].value.compare_exchange_strong(expected, new_p)) {
+      return;
+    }
+  }
+}
+
+void LinearProbingHashTableCache::Fill(const Key& key, PmemNode* const p) {
+  PmemNode* expected = nullptr;
+  buckets_[(Hash1(key) + probing_distance_) % size_].value.compare_exchange_strong(expected, p);
+}
+
 inline uint32_t LinearProbingHashTableCache::Hash1(const Key& key) {
 	uint32_t h;
 	//static const uint32_t seed = 0xcafeb0ba;
@@ -42,6 +42,10 @@ class LruSkipList {
 
   void Insert(const Key& key, const uint64_t value, const int height);
 
+  // Calls f(key, value, height) on every cached node in key order
+  template <typename F>
+  void ForEach(F&& f);
+
  private:
   void FindPosition(Node* node, Node* preds[], Node* succs[]);
 
@@ -148,6 +152,15 @@ void LruSkipList::Insert(const Key& key, const uint64_t value, const int height)
   }
 }
 
+template <typename F>
+void LruSkipList::ForEach(F&& f) {
+  Node* node = head_->next[0].load(std::memory_order_acquire);
+  while (node) {
+    f(node->key, node->value, node->height());
+    node = node->next[0].load(std::memory_order_acquire);
+  }
+}
+
 void LruSkipList::FindPosition(Node* node, Node* preds[], Node* succs[]) {
   Node* pred = head_;
   Node* curr = nullptr;
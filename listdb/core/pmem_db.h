@@ -16,6 +16,14 @@ enum class Level0Status {
   kPersisted,
   kMergeInitiated,
   kMergeDone,
+  kCombineInitiated,  // being merged into the next older L0 table
+  kL1FlushInitiated,  // memtable being flushed straight into L1
+};
+
+// How an L0 table is merged into L1
+enum class CompactionMode {
+  kZipper,       // links the L0 nodes into L1 in place
+  kCopyOnWrite,  // copies the L0 nodes into the L1 arena in key order
 };
 
 struct pmem_db {
@@ -30,19 +38,32 @@ struct pmem_db_shard {
   //pmem_l0_info l0_info[100];  // TODO(wkim): Manage this as like a circular-array
   pmem::obj::persistent_ptr<pmem_l0_info> l0_list_head;
   pmem::obj::persistent_ptr<pmem_l1_info> l1_info;
+  CompactionMode compaction_mode;
 };
 
 struct pmem_l0_info {
   uint64_t id;
+  uint64_t id_end;  // last L0 id combined into this table
   //LogRange log_range[kNumRegions];
   Level0Status status;
+  CompactionMode merge_mode;  // valid from kMergeInitiated
   pmem::obj::persistent_ptr<pmem_l0_info> next;
   pmem::obj::persistent_ptr<char[]> head[kNumRegions];
+  // Zipper merge progress while kMergeInitiated or kCombineInitiated: the
+  // first node of every partition followed by the last merged node of every
+  // partition
+  pmem::obj::persistent_ptr<uint64_t[]> zipper_progress;
+  uint64_t num_zipper_parts;
 };
 
+// An L1 key-range partition. Partitions are linked in key order from
+// pmem_db_shard::l1_info.
 struct pmem_l1_info {
   uint64_t id;
   pmem::obj::persistent_ptr<char[]> head[kNumRegions];
+  char begin_key[sizeof(Key)];  // inclusive
+  uint64_t size;  // kv bytes, drives the splits
+  pmem::obj::persistent_ptr<pmem_l1_info> next;
 };
 
 #endif  // LISTDB_CORE_PMEM_DB_H_
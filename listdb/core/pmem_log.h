@@ -1,8 +1,16 @@
 #ifndef LISTDB_CORE_PMEM_LOG_H_
 #define LISTDB_CORE_PMEM_LOG_H_
 
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <deque>
 #include <functional>
+#include <limits>
+#include <map>
 #include <mutex>
+#include <set>
+#include <vector>
 
 #include <libpmemobj++/make_persistent_atomic.hpp>
 #include <libpmemobj++/p.hpp>
@@ -10,9 +18,10 @@
 #include <libpmemobj++/pool.hpp>
 
 #include "listdb/common.h"
+#include "listdb/lib/epoch.h"
+#include "listdb/pmem/persist.h"
 #include "listdb/pmem/pmem.h"
 #include "listdb/pmem/pmem_ptr.h"
-#include "listdb/lib/memory.h"
 
 template <typename T>
 using Pool = pmem::obj::pool<T>;
@@ -37,15 +46,22 @@ struct pmem_log_root {
 struct pmem_log {
   uint32_t block_cnt;
   pmem::obj::persistent_ptr<pmem_log_block> head;
+  pmem::obj::persistent_ptr<pmem_log_block> reloc_head;  // relocated L1 nodes
+  // Block whose L1 nodes are being relocated; finished after a crash
+  pmem::obj::persistent_ptr<pmem_log_block> reloc_block;
+  // Allocated ahead and not linked yet. A slot that equals head was linked
+  // right before a crash.
+  pmem::obj::persistent_ptr<pmem_log_block> spare[kNumSpareLogBlocks];
 };
 
 struct pmem_log_block {
   uint32_t id;
   size_t p;
+  size_t obsolete_bytes;  // as of the last clean shutdown
   char data[kPmemLogBlockSize];
   pmem::obj::persistent_ptr<pmem_log_block> next;
 
-  pmem_log_block(pmem::obj::persistent_ptr<pmem_log_block> next_ = nullptr) : p(0), data(), next(next_) { }
+  pmem_log_block(pmem::obj::persistent_ptr<pmem_log_block> next_ = nullptr) : p(0), obsolete_bytes(0), data(), next(next_) { }
 };
 
 // PmemLog
@@ -60,26 +76,112 @@ class PmemLog {
     explicit Block(pmem::obj::persistent_ptr<pmem_log_block> p_block_);
     void* Allocate(const size_t size);
   };
-  
+
+  struct BlockStat {
+    pmem_log_block* block;
+    size_t obsolete_bytes;
+    // l0_cnt observed after the block stopped taking appends. Every entry of
+    // the block belongs to an L0 table whose id is less than this.
+    uint64_t sealed_l0_cnt;
+  };
+
   PmemLog(const int pool_id, const int shard_id);
 
   ~PmemLog();
 
   PmemPtr Allocate(const size_t size);
 
+  // Records a log entry that is no longer reachable from any index
+  void RetireEntry(PmemPtr paddr, const size_t size);
+
+  size_t obsolete_bytes() { return obsolete_bytes_.load(MO_RELAXED); }
+
+  // Log block reclamation. Called by a single reclaimer at a time.
+  void GetReclaimCandidates(const uint64_t l0_cnt, const uint64_t min_unmerged_l0_id,
+                            std::vector<pmem_log_block*>* blocks);
+
+  // Persists the cursor of the relocation chain. The fence that orders a
+  // copied node before its links orders the cursor as well.
+  PmemPtr AllocateRelocation(const size_t size);
+
+  // Records the block whose nodes are relocated next, until EndRelocation()
+  void BeginRelocation(pmem_log_block* block);
+
+  void EndRelocation();
+
+  // Block of a relocation interrupted by a crash, or nullptr
+  pmem_log_block* relocating_block() { return p_log_->reloc_block.get(); }
+
+  // Called when a spare block is taken, from the append path
+  void BindSpareBlockRequest(std::function<void()> request_fn) { spare_request_fn_ = request_fn; }
+
+  bool NeedsSpareBlock();
+
+  // Allocates a spare block off the append path. Zeroing it faults its
+  // pages in.
+  void PrepareSpareBlock();
+
+  // Faults in the pages of the blocks in use
+  void Prefault();
+
+  // Unlinked blocks are freed through it
+  void BindEpochManager(EpochManager* epoch) { epoch_ = epoch; }
+
+  void UnlinkBlocks(const std::vector<pmem_log_block*>& blocks);
+
+  void FreeRetiredBlocks();
+
+  bool HasRetiredBlocks() { return num_retired_blocks_.load(MO_RELAXED) > 0; }
+
+  // Number of blocks ever allocated; read without the lock
+  uint32_t block_cnt() { return p_log_->block_cnt; }
+
   int pool_id() { return pool_id_; }
 
   pmem::obj::pool<pmem_log_root> pool() { return pool_; }
 
  private:
+  enum SpareState { kSpareEmpty, kSpareBusy, kSpareReady };
+
   Block* GetCurrentBlock();
 
+  Block* NewBlock();
+
+  int TakeSpareBlock();
+
+  void AddBlockStat(pmem_log_block* block);
+
+  void LoadBlockStats();
+
+  void PersistBlockStats();
+
+  void PersistRelocationCursor();
+
   const int pool_id_;
   pmem::obj::pool<pmem_log_root> pool_;  // for memory allocation
   pmem::obj::persistent_ptr<pmem_log> p_log_;
   std::atomic<Block*> front_;
   std::atomic<size_t> hmm;
   std::mutex block_init_mu_;
+
+  // Keyed by the address of pmem_log_block::data
+  static constexpr uint64_t kNotSealed = std::numeric_limits<uint64_t>::max();
+  std::map<uintptr_t, BlockStat> block_stats_;
+  std::atomic<bool> block_stats_loaded_{false};
+  std::atomic<size_t> obsolete_bytes_{0};
+  std::mutex stat_mu_;
+  std::mutex stat_load_mu_;
+
+  Block* reloc_front_ = nullptr;
+  // Unlinked blocks are freed once the readers that may have loaded a
+  // pointer to an old node are done with it
+  std::deque<std::pair<uint64_t, pmem::obj::persistent_ptr<pmem_log_block>>> retired_blocks_;
+  EpochManager* epoch_ = nullptr;
+  std::atomic<size_t> num_retired_blocks_{0};
+
+  std::mutex spare_mu_;
+  SpareState spare_state_[kNumSpareLogBlocks] = {};
+  std::function<void()> spare_request_fn_;
 };
 
 PmemLog::Block::Block(pmem::obj::persistent_ptr<pmem_log_block> p_block_) {
@@ -124,6 +226,18 @@ PmemLog::PmemLog(const int pool_id, const int shard_id) : pool_id_(pool_id) {
     auto head_block = new Block(p_log_->head);
 #endif
     front_.store(head_block);
+    if (p_log_->reloc_head) {
+      reloc_front_ = new Block(p_log_->reloc_head);
+    }
+    for (int i = 0; i < kNumSpareLogBlocks; i++) {
+      if (p_log_->spare[i] == p_log_->head) {
+        p_log_->spare[i] = nullptr;
+        clwb(&(p_log_->spare[i]), sizeof(p_log_->spare[i]));
+        sfence();
+      } else if (p_log_->spare[i]) {
+        spare_state_[i] = kSpareReady;
+      }
+    }
   }
 }
 
@@ -131,6 +245,12 @@ PmemLog::~PmemLog() {
   auto block = GetCurrentBlock();
   block->p_block->p = block->p;
   clwb(&(block->p_block->p), sizeof(size_t));
+  PersistRelocationCursor();
+  PersistBlockStats();
+  // No reader is left
+  for (auto& rb : retired_blocks_) {
+    pmem::obj::delete_persistent_atomic<pmem_log_block>(rb.second);
+  }
 }
 
 PmemLog::Block* PmemLog::GetCurrentBlock() {
@@ -139,16 +259,7 @@ PmemLog::Block* PmemLog::GetCurrentBlock() {
     std::lock_guard<std::mutex> lk(block_init_mu_);
     ret = front_.load(MO_RELAXED);
     if (ret == nullptr) {
-      pmem::obj::persistent_ptr<pmem_log_block> p_new_block;
-      pmem::obj::make_persistent_atomic<pmem_log_block>(pool_, p_new_block, p_log_->head);
-
-      p_new_block->id = p_log_->block_cnt;
-      p_log_->block_cnt++;
-
-      p_log_->head = p_new_block;
-      auto new_block = new Block(p_new_block);
-      front_.store(new_block, MO_RELAXED);
-      ret = new_block;
+      ret = NewBlock();
     }
   }
   return ret;
@@ -162,20 +273,302 @@ PmemPtr PmemLog::Allocate(const size_t size) {
     block = front_.load(MO_RELAXED);
     if ((buf = block->Allocate(size)) == nullptr) {
       // TODO: write Block contents to pmem_log_block
-      pmem::obj::persistent_ptr<pmem_log_block> p_new_block;
-      pmem::obj::make_persistent_atomic<pmem_log_block>(pool_, p_new_block, p_log_->head);
+      buf = NewBlock()->Allocate(size);
+    }
+  }
+  PmemPtr ret(pool_id_, (uint64_t) ((uintptr_t) buf - (uintptr_t) pool_.handle()));
+  return ret;
+}
+
+// Requires block_init_mu_
+PmemLog::Block* PmemLog::NewBlock() {
+  pmem::obj::persistent_ptr<pmem_log_block> p_new_block;
+  int slot = TakeSpareBlock();
+  if (slot >= 0) {
+    p_new_block = p_log_->spare[slot];
+    p_new_block->next = p_log_->head;
+  } else {
+    pmem::obj::make_persistent_atomic<pmem_log_block>(pool_, p_new_block, p_log_->head);
+  }
 
-      p_new_block->id = p_log_->block_cnt;
-      p_log_->block_cnt++;
+  p_new_block->id = p_log_->block_cnt;
+  p_log_->block_cnt++;
 
-      p_log_->head = p_new_block;
-      auto new_block = new Block(p_new_block);
-      front_.store(new_block, MO_RELAXED);
-      buf = new_block->Allocate(size);
+  if (slot >= 0) {
+    // Linked before the slot is cleared; the open path clears a slot that
+    // equals head
+    clwb(&(p_new_block->id), sizeof(p_new_block->id));
+    clwb(&(p_new_block->next), sizeof(p_new_block->next));
+    sfence();
+    p_log_->head = p_new_block;
+    clwb(&(p_log_->head), sizeof(p_log_->head));
+    sfence();
+    p_log_->spare[slot] = nullptr;
+    clwb(&(p_log_->spare[slot]), sizeof(p_log_->spare[slot]));
+    sfence();
+    std::lock_guard<std::mutex> lk(spare_mu_);
+    spare_state_[slot] = kSpareEmpty;
+  } else {
+    p_log_->head = p_new_block;
+  }
+  if (spare_request_fn_) {
+    spare_request_fn_();
+  }
+  AddBlockStat(p_new_block.get());
+  auto new_block = new Block(p_new_block);
+  front_.store(new_block, MO_RELAXED);
+  return new_block;
+}
+
+// Returns the slot of a ready spare block, or -1
+int PmemLog::TakeSpareBlock() {
+  std::lock_guard<std::mutex> lk(spare_mu_);
+  for (int i = 0; i < kNumSpareLogBlocks; i++) {
+    if (spare_state_[i] == kSpareReady) {
+      spare_state_[i] = kSpareBusy;
+      return i;
+    }
+  }
+  return -1;
+}
+
+bool PmemLog::NeedsSpareBlock() {
+  std::lock_guard<std::mutex> lk(spare_mu_);
+  for (int i = 0; i < kNumSpareLogBlocks; i++) {
+    if (spare_state_[i] == kSpareEmpty) {
+      return true;
     }
   }
+  return false;
+}
+
+void PmemLog::PrepareSpareBlock() {
+  int slot = -1;
+  {
+    std::lock_guard<std::mutex> lk(spare_mu_);
+    for (int i = 0; i < kNumSpareLogBlocks && slot < 0; i++) {
+      if (spare_state_[i] == kSpareEmpty) {
+        spare_state_[i] = kSpareBusy;
+        slot = i;
+      }
+    }
+  }
+  if (slot < 0) {
+    return;
+  }
+  // Allocated straight into the slot, so a crash does not leak it
+  pmem::obj::make_persistent_atomic<pmem_log_block>(pool_, p_log_->spare[slot]);
+  std::lock_guard<std::mutex> lk(spare_mu_);
+  spare_state_[slot] = kSpareReady;
+}
+
+void PmemLog::Prefault() {
+  for (auto p_block = p_log_->head; p_block; p_block = p_block->next) {
+    Pmem::Prefault(p_block.get(), sizeof(pmem_log_block));
+  }
+  for (auto p_block = p_log_->reloc_head; p_block; p_block = p_block->next) {
+    Pmem::Prefault(p_block.get(), sizeof(pmem_log_block));
+  }
+  for (int i = 0; i < kNumSpareLogBlocks; i++) {
+    if (p_log_->spare[i]) {
+      Pmem::Prefault(p_log_->spare[i].get(), sizeof(pmem_log_block));
+    }
+  }
+}
+
+void PmemLog::AddBlockStat(pmem_log_block* block) {
+  std::lock_guard<std::mutex> lk(stat_mu_);
+  block_stats_.emplace((uintptr_t) block->data, BlockStat{block, 0, kNotSealed});
+}
+
+// Blocks written before the restart are indexed on the first use. The chain
+// is walked without stat_mu_, so the append path is not held up by it.
+// Blocks prepended meanwhile are already in block_stats_ and are merged in.
+void PmemLog::LoadBlockStats() {
+  if (block_stats_loaded_.load(std::memory_order_acquire)) {
+    return;
+  }
+  std::lock_guard<std::mutex> load_lk(stat_load_mu_);
+  if (block_stats_loaded_.load(std::memory_order_relaxed)) {
+    return;
+  }
+  pmem::obj::persistent_ptr<pmem_log_block> p_block;
+  {
+    std::lock_guard<std::mutex> lk(block_init_mu_);
+    p_block = p_log_->head;
+  }
+  std::map<uintptr_t, BlockStat> stats;
+  size_t obsolete_bytes = 0;
+  while (p_block) {
+    stats.emplace((uintptr_t) p_block->data, BlockStat{p_block.get(), p_block->obsolete_bytes, kNotSealed});
+    obsolete_bytes += p_block->obsolete_bytes;
+    p_block = p_block->next;
+  }
+  std::lock_guard<std::mutex> lk(stat_mu_);
+  obsolete_bytes_.fetch_add(obsolete_bytes, MO_RELAXED);
+  stats.insert(block_stats_.begin(), block_stats_.end());
+  block_stats_.swap(stats);
+  block_stats_loaded_.store(true, std::memory_order_release);
+}
+
+// A count persisted earlier is never above the actual one, so a crash only
+// delays the reclamation of a block
+void PmemLog::PersistBlockStats() {
+  if (!block_stats_loaded_.load()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lk(stat_mu_);
+  for (auto& it : block_stats_) {
+    auto block = it.second.block;
+    block->obsolete_bytes = it.second.obsolete_bytes;
+    clwb(&block->obsolete_bytes, sizeof(size_t));
+  }
+  sfence();
+}
+
+void PmemLog::RetireEntry(PmemPtr paddr, const size_t size) {
+  uintptr_t addr = (uintptr_t) paddr.get();
+  LoadBlockStats();
+  std::lock_guard<std::mutex> lk(stat_mu_);
+  auto it = block_stats_.upper_bound(addr);
+  if (it == block_stats_.begin()) {
+    return;
+  }
+  --it;
+  if (addr >= it->first + kPmemLogBlockSize) {
+    return;
+  }
+  it->second.obsolete_bytes += size;
+  obsolete_bytes_.fetch_add(size, MO_RELAXED);
+}
+
+void PmemLog::GetReclaimCandidates(const uint64_t l0_cnt, const uint64_t min_unmerged_l0_id,
+                                   std::vector<pmem_log_block*>* blocks) {
+  LoadBlockStats();
+  Block* front = front_.load(MO_RELAXED);
+  bool seal_front = false;
+  {
+    std::lock_guard<std::mutex> lk(stat_mu_);
+    for (auto& it : block_stats_) {
+      auto& stat = it.second;
+      bool reclaimable = (stat.obsolete_bytes >= kLogReclaimThreshold * kPmemLogBlockSize);
+      if (front && stat.block == front->p_block.get()) {
+        seal_front = reclaimable;
+        continue;
+      }
+      if (stat.sealed_l0_cnt == kNotSealed) {
+        stat.sealed_l0_cnt = l0_cnt;
+      }
+      if (stat.sealed_l0_cnt <= min_unmerged_l0_id && reclaimable) {
+        blocks->push_back(stat.block);
+      }
+    }
+  }
+  // The active block is mostly obsolete, e.g. on an idle shard. It is
+  // sealed here and becomes a candidate like any other block.
+  if (seal_front) {
+    std::lock_guard<std::mutex> lk(block_init_mu_);
+    if (front_.load(MO_RELAXED) == front) {
+      NewBlock();
+    }
+  }
+}
+
+// Relocated nodes go to a separate chain so that the recovery, which scans
+// the log chain in l0_id order, never sees them.
+PmemPtr PmemLog::AllocateRelocation(const size_t size) {
+  void* buf = (reloc_front_) ? reloc_front_->Allocate(size) : nullptr;
+  if (buf == nullptr) {
+    PersistRelocationCursor();
+    pmem::obj::persistent_ptr<pmem_log_block> p_new_block;
+    pmem::obj::make_persistent_atomic<pmem_log_block>(pool_, p_new_block, p_log_->reloc_head);
+    p_log_->reloc_head = p_new_block;
+    clwb(&(p_log_->reloc_head), sizeof(p_log_->reloc_head));
+    sfence();
+    delete reloc_front_;
+    reloc_front_ = new Block(p_new_block);
+    buf = reloc_front_->Allocate(size);
+  }
+  // A copy linked in L1 must never be handed out again after a restart
+  reloc_front_->p_block->p = reloc_front_->p.load(MO_RELAXED);
+  clwb(&(reloc_front_->p_block->p), sizeof(size_t));
   PmemPtr ret(pool_id_, (uint64_t) ((uintptr_t) buf - (uintptr_t) pool_.handle()));
   return ret;
 }
 
+void PmemLog::PersistRelocationCursor() {
+  if (reloc_front_ == nullptr) {
+    return;
+  }
+  reloc_front_->p_block->p = std::min(reloc_front_->p.load(), kPmemLogBlockSize);
+  clwb(&(reloc_front_->p_block->p), sizeof(size_t));
+  sfence();
+}
+
+void PmemLog::BeginRelocation(pmem_log_block* block) {
+  p_log_->reloc_block = pmem::obj::persistent_ptr<pmem_log_block>(block);
+  clwb(&(p_log_->reloc_block), sizeof(p_log_->reloc_block));
+  sfence();
+}
+
+void PmemLog::EndRelocation() {
+  if (p_log_->reloc_block == nullptr) {
+    return;
+  }
+  p_log_->reloc_block = nullptr;
+  clwb(&(p_log_->reloc_block), sizeof(p_log_->reloc_block));
+  sfence();
+}
+
+void PmemLog::UnlinkBlocks(const std::vector<pmem_log_block*>& blocks) {
+  if (blocks.empty()) {
+    return;
+  }
+  // Relocated nodes must survive a crash before their origins are dropped
+  PersistRelocationCursor();
+
+  std::set<pmem_log_block*> targets(blocks.begin(), blocks.end());
+  pmem::obj::persistent_ptr<pmem_log_block> pred;
+  {
+    std::lock_guard<std::mutex> lk(block_init_mu_);
+    pred = p_log_->head;
+  }
+  // Only the reclaimer modifies the next pointer of a non-head block.
+  // The head block is never reclaimed.
+  while (pred && pred->next) {
+    auto curr = pred->next;
+    if (targets.erase(curr.get())) {
+      pred->next = curr->next;
+      clwb(&(pred->next), sizeof(pred->next));
+      sfence();
+      retired_blocks_.emplace_back(epoch_->current(), curr);
+      continue;
+    }
+    pred = curr;
+  }
+  // Unlinked right before a crash, so nothing points to it anymore
+  if (p_log_->reloc_block && targets.count(p_log_->reloc_block.get())) {
+    retired_blocks_.emplace_back(epoch_->current(), p_log_->reloc_block);
+  }
+  num_retired_blocks_.store(retired_blocks_.size(), MO_RELAXED);
+
+  std::lock_guard<std::mutex> lk(stat_mu_);
+  for (auto& block : blocks) {
+    auto it = block_stats_.find((uintptr_t) block->data);
+    if (it != block_stats_.end()) {
+      obsolete_bytes_.fetch_sub(it->second.obsolete_bytes, MO_RELAXED);
+      block_stats_.erase(it);
+    }
+  }
+}
+
+void PmemLog::FreeRetiredBlocks() {
+  uint64_t safe_epoch = epoch_->SafeEpoch();
+  while (!retired_blocks_.empty() && retired_blocks_.front().first < safe_epoch) {
+    pmem::obj::delete_persistent_atomic<pmem_log_block>(retired_blocks_.front().second);
+    retired_blocks_.pop_front();
+  }
+  num_retired_blocks_.store(retired_blocks_.size(), MO_RELAXED);
+}
+
 #endif  // LISTDB_CORE_PMEM_LOG_H_
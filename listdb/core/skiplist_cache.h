@@ -138,6 +138,10 @@ class SkipListCache {
 
   void GetDebugString(const std::string& name, std::string* buf);
 
+  // Calls f(PmemNode*) on every cached node. Not thread-safe with Insert().
+  template <typename F>
+  void ForEach(F&& f);
+
   size_t AcquireLoadSize() { return size_.load(std::memory_order_acquire); }
 
  private:
@@ -539,4 +543,19 @@ void SkipListCache<N>::GetDebugString(const std::string& name, std::string* buf)
   }
 }
 
+template <std::size_t N>
+template <typename F>
+void SkipListCache<N>::ForEach(F&& f) {
+  Node* node = head_->next[0].load(std::memory_order_acquire);
+  while (node) {
+    for (unsigned int i = 0; i < N; i++) {
+      if (node->fields[i].IsEmpty()) {
+        break;
+      }
+      f(DecodeFieldValue(node->fields[i]));
+    }
+    node = node->next[0].load(std::memory_order_acquire);
+  }
+}
+
 #endif  // LISTDB_CORE_SKIPLIST_CACHE_H_
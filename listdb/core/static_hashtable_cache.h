@@ -21,10 +21,22 @@ class StaticHashTableCache {
 
   void Insert(const Key& key, PmemNode* const p);
 
+  // Brings the home bucket of the key into the cache ahead of Insert()
+  void Prefetch(const Key& key);
+
   PmemNode* Lookup(const Key& key);
 
+  void Replace(const Key& key, PmemNode* const old_p, PmemNode* const new_p);
+
+  // Stores p only into the bucket an Insert() of the key would overwrite
+  // last, and only if it is empty, so that a concurrent Insert() of a newer
+  // version of the key is never shadowed
+  void Fill(const Key& key, PmemNode* const p);
+
   uint32_t Hash(const Key& key);
 
+  size_t size() const { return size_; }
+
  private:
   const size_t size_;
   const int shard_;
@@ -43,6 +55,10 @@ void StaticHashTableCache::Insert(const Key& key, PmemNode* const p) {
   buckets_[pos].value.store(p, std::memory_order_seq_cst);
 }
 
+inline void StaticHashTableCache::Prefetch(const Key& key) {
+  __builtin_prefetch(&buckets_[Hash(key)], 1);
+}
+
 StaticHashTableCache::PmemNode* StaticHashTableCache::Lookup(const Key& key) {
   uint32_t pos = Hash(key);
   PmemNode* value = buckets_[pos].value.load(std::memory_order_seq_cst);
@@ -52,6 +68,18 @@ StaticHashTableCache::PmemNode* StaticHashTableCache::Lookup(const Key& key) {
   return nullptr;
 }
 
+// Swaps a bucket pointing to old_p for new_p (nullptr to erase)
+void StaticHashTableCache::Replace(const Key& key, PmemNode* const old_p, PmemNode* const new_p) {
+  uint32_t pos = Hash(key);
+  PmemNode* expected = old_p;
+  buckets_[pos].value.compare_exchange_strong(expected, new_p);
+}
+
+void StaticHashTableCache::Fill(const Key& key, PmemNode* const p) {
+  PmemNode* expected = nullptr;
+  buckets_[Hash(key)].value.compare_exchange_strong(expected, p);
+}
+
 inline uint32_t StaticHashTableCache::Hash(const Key& key) {
 	uint32_t h;
 	//static const uint32_t seed = 0xcafeb0ba;
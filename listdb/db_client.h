@@ -7,11 +7,11 @@
 #include "listdb/common.h"
 #include "listdb/listdb.h"
 #include "listdb/util.h"
+#include "listdb/util/clock.h"
 #include "listdb/util/random.h"
 
 #define LEVEL_CHECK_PERIOD_FACTOR 1
 
-//#define LOG_NTSTORE
 class DBClient {
  public:
   using MemNode = ListDB::MemNode;
@@ -63,6 +63,7 @@ class DBClient {
   size_t pmem_get_cnt_ = 0;
   size_t search_visit_cnt_ = 0;
   size_t height_visit_cnt_[kMaxHeight] = {};
+  uint64_t put_cnt_ = 0;
 
 #ifdef GROUP_LOGGING
   struct LogItem {
@@ -101,34 +102,33 @@ void DBClient::SetRegion(int region) {
 }
 
 void DBClient::Put(const Key& key, const Value& value) {
+  uint64_t begin_nanos = 0;
+  if (++put_cnt_ % kWriteLatencySampleInterval == 0) {
+    begin_nanos = Clock::NowNanos();
+  }
 #ifndef GROUP_LOGGING
   int s = KeyShard(key);
+  db_->WaitForShardRecovery(s);
 
   uint64_t pmem_height = PmemRandomHeight();
   size_t iul_entry_size = sizeof(PmemNode) + (pmem_height - 1) * sizeof(uint64_t);
   size_t kv_size = key.size() + sizeof(Value);
 
   // Determine L0 id
+  EpochManager::Guard guard(db_->epoch());
   auto mem = db_->GetWritableMemTable(kv_size, s);
   uint64_t l0_id = mem->l0_id();
 
   // Write log
   auto log_paddr = log_[s]->Allocate(iul_entry_size);
   PmemNode* iul_entry = (PmemNode*) log_paddr.get();
-#ifdef LOG_NTSTORE
-  _mm_stream_pi((__m64*) &iul_entry->tag, (__m64) pmem_height);
-  _mm_stream_pi((__m64*) &iul_entry->value, (__m64) value);
-  //_mm_sfence();
-  _mm_stream_pi((__m64*) &iul_entry->key, (__m64) (uint64_t) key);
-#else
-  iul_entry->tag = (l0_id << 32) | pmem_height;
-  iul_entry->value = value;
-  clwb(&iul_entry->tag, 16);
-  _mm_sfence();
-  iul_entry->key = key;
-  clwb(iul_entry, 8);
+  Persist::Store(&iul_entry->tag, (l0_id << 32) | pmem_height);
+  Persist::Store(&iul_entry->value, value);
+  Persist::FlushStored(&iul_entry->tag, 16);
+  sfence();
+  Persist::Store(&iul_entry->key, key);
+  Persist::FlushStored(iul_entry, key.size());
   //clwb(iul_entry, sizeof(PmemNode) - sizeof(uint64_t));
-#endif
 
   // Create skiplist node
   uint64_t dram_height = DramRandomHeight();
@@ -140,9 +140,9 @@ void DBClient::Put(const Key& key, const Value& value) {
 
   auto skiplist = mem->skiplist();
   skiplist->Insert(node);
-  mem->w_UnRef();
 #else
   int s = KeyShard(key);
+  db_->WaitForShardRecovery(s);
 
   uint64_t height = RandomHeight();
 
@@ -157,6 +157,7 @@ void DBClient::Put(const Key& key, const Value& value) {
   node->value = 0;
   memset(&node->next[0], 0, height * sizeof(uint64_t));
 
+  EpochManager::Guard guard(db_->epoch());
   auto mem = db_->GetWritableMemTable(kv_size, s);
   auto skiplist = mem->skiplist();
 
@@ -193,8 +194,10 @@ void DBClient::Put(const Key& key, const Value& value) {
   }
 
   skiplist->Insert(node);
-  mem->w_UnRef();
 #endif
+  if (begin_nanos) {
+    db_->RecordWriteLatency(Clock::NowNanos() - begin_nanos);
+  }
 
   //size_t log_alloc_size = util::AlignedSize(8, LogWriter::Entry::ComputeAllocSize(key, height));
   //size_t node_alloc_size = util::AlignedSize(8, MemNode::ComputeAllocSize(key, height));
@@ -210,6 +213,8 @@ void DBClient::Put(const Key& key, const Value& value) {
 
 bool DBClient::Get(const Key& key, Value* value_out) {
   int s = KeyShard(key);
+  db_->WaitForShardRecovery(s);
+  EpochManager::Guard guard(db_->epoch());
   {
     MemTableList* tl = (MemTableList*) db_->GetTableList(0, s);
 
@@ -275,8 +280,8 @@ bool DBClient::Get(const Key& key, Value* value_out) {
   {
     // Level 1 Lookup
     auto tl = (PmemTableList*) db_->GetTableList(1, s);
-    auto table = tl->GetFront();
-    while (table) {
+    auto table = tl->FindPartition(key);
+    if (table) {
       auto pmem = (PmemTable*) table;
       auto skiplist = pmem->skiplist();
       //auto found_paddr = skiplist->Lookup(key, region_);
@@ -287,7 +292,6 @@ bool DBClient::Get(const Key& key, Value* value_out) {
         *value_out = found->value;
         return true;
       }
-      table = table->Next();
     }
   }
   return false;
@@ -300,6 +304,7 @@ void DBClient::PutStringKV(const std::string_view& key_sv, const std::string_vie
   //  fprintf(stdout, "key is not valid: %s, %zu, key_num=%zu\n", std::string(key_sv).c_str(), *((uint64_t*) key.data()), key.key_num());
   //}
   int s = KeyShard(key);
+  db_->WaitForShardRecovery(s);
 
   uint64_t pmem_height = PmemRandomHeight();
   size_t iul_entry_size = sizeof(PmemNode) + (pmem_height - 1) * sizeof(uint64_t);
@@ -312,21 +317,23 @@ void DBClient::PutStringKV(const std::string_view& key_sv, const std::string_vie
   *((size_t*) value_p) = value.size();
   value_p += sizeof(size_t);
   memcpy(value_p, value.data(), value.size());
+  clwb(value_paddr.get(), value_alloc_size);
 
   uint64_t dram_height = DramRandomHeight();
   size_t mem_node_size = sizeof(MemNode) + (dram_height - 1) * sizeof(uint64_t);
+  EpochManager::Guard guard(db_->epoch());
   auto mem = db_->GetWritableMemTable(mem_node_size, s);
   uint64_t l0_id = mem->l0_id();
 
   // Write log
   auto log_paddr = log_[s]->Allocate(iul_entry_size);
   PmemNode* iul_entry = (PmemNode*) log_paddr.get();
-  iul_entry->tag = (l0_id << 32) | pmem_height;
-  iul_entry->value = value_paddr.dump();
-  clwb(&iul_entry->tag, 16);
-  _mm_sfence();
-  iul_entry->key = key;
-  clwb(iul_entry, key.size());
+  Persist::Store(&iul_entry->tag, (l0_id << 32) | pmem_height);
+  Persist::Store(&iul_entry->value, value_paddr.dump());
+  Persist::FlushStored(&iul_entry->tag, 16);
+  sfence();
+  Persist::Store(&iul_entry->key, key);
+  Persist::FlushStored(iul_entry, key.size());
   //clwb(iul_entry, sizeof(PmemNode) - sizeof(uint64_t));
 
   // Create skiplist node
@@ -339,12 +346,13 @@ void DBClient::PutStringKV(const std::string_view& key_sv, const std::string_vie
 
   auto skiplist = mem->skiplist();
   skiplist->Insert(node);
-  mem->w_UnRef();
 }
 
 bool DBClient::GetStringKV(const std::string_view& key_sv, Value* value_out) {
   Key& key = *((Key*) key_sv.data());
   int s = KeyShard(key);
+  db_->WaitForShardRecovery(s);
+  EpochManager::Guard guard(db_->epoch());
   {
     MemTableList* tl = (MemTableList*) db_->GetTableList(0, s);
 
@@ -415,8 +423,8 @@ bool DBClient::GetStringKV(const std::string_view& key_sv, Value* value_out) {
   {
     // Level 1 Lookup
     auto tl = (PmemTableList*) db_->GetTableList(1, s);
-    auto table = tl->GetFront();
-    while (table) {
+    auto table = tl->FindPartition(key);
+    if (table) {
       auto pmem = (PmemTable*) table;
       auto skiplist = pmem->skiplist();
       //auto found_paddr = skiplist->Lookup(key, region_);
@@ -432,7 +440,6 @@ bool DBClient::GetStringKV(const std::string_view& key_sv, Value* value_out) {
         *value_out = (uint64_t) PmemPtr::Decode<char>(found->value);
         return true;
       }
-      table = table->Next();
     }
   }
   return false;
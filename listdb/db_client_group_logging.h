@@ -90,7 +90,7 @@ void DBClient::ProcessPutGroup(const int s) {
   db_->PutMany(group_kv_size_[s], nodes_);
 
   clwb(log_group_buf, group_state_[s].log_alloc_size);
-  _mm_sfence();  // For what? against other logs in next batches
+  sfence();  // For what? against other logs in next batches
 
   put_group_[s].clear();
   log_paddrs_[s].clear();
@@ -53,7 +53,7 @@ class BraidedPmemSkipList {
  private:
   const int primary_region_pool_id_;
   std::map<int, PmemLog*> arena_;
-  std::map<int, Node*> head_;
+  alignas(64) Node* head_[Pmem::kMaxNumPools] = {};  // by pool id, read on every search
   std::map<int, pmem::obj::persistent_ptr<char[]>> p_head_;
 };
 
@@ -65,7 +65,7 @@ void BraidedPmemSkipList::BindArena(const int pool_id, PmemLog* arena) {
 }
 
 void BraidedPmemSkipList::BindHead(const int pool_id, void* head_addr) {
-  head_.emplace(pool_id, (Node*) head_addr);
+  head_[pool_id] = (Node*) head_addr;
 }
 
 void BraidedPmemSkipList::Init() {
@@ -85,7 +85,7 @@ void BraidedPmemSkipList::Init() {
     head->key = 0; 
     head->tag = kMaxHeight;
     memset(&head->next[0], 0, kMaxHeight * sizeof(uint64_t));
-    head_.emplace(pool_id, head);
+    head_[pool_id] = head;
   }
 }
 
@@ -50,6 +50,8 @@ class lockfree_skiplist {
   };
 
   lockfree_skiplist();
+  // Frees every node. Nodes are allocated with malloc().
+  ~lockfree_skiplist();
   // Returns pred
   Node* Insert(Node* const node, Node* pred = NULL);
   // Returns (node->key == key) ? node : NULL
@@ -135,6 +137,16 @@ lockfree_skiplist::lockfree_skiplist() {
   std::atomic_thread_fence(std::memory_order_release);
 }
 
+lockfree_skiplist::~lockfree_skiplist() {
+  Node* node = head_->next[0].load(std::memory_order_relaxed);
+  while (node) {
+    Node* next = node->next[0].load(std::memory_order_relaxed);
+    free(node);
+    node = next;
+  }
+  free(head_);
+}
+
 //void lockfree_skiplist::insert(const Key& key, const Value& value, const int height) {
 //}
 
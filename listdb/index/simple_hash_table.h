@@ -18,6 +18,9 @@ class SimpleHashTable {
 
   void Add(const Key& key, const Value& value);
 
+  // Brings both buckets of the key into the cache ahead of Add()
+  void Prefetch(const Key& key);
+
   bool Get(const Key& key, Value* value_out);
 
  private:
@@ -31,8 +34,8 @@ SimpleHashTable::SimpleHashTable(size_t size) : size_(size) {
 
 void SimpleHashTable::Add(const Key& key, const Value& value) {
   // key: integer key
-  uint32_t idx = ht_murmur3(key);
-  uint32_t idx2 = ht_sha1(key);
+  uint32_t idx = ht_murmur3(key, size_);
+  uint32_t idx2 = ht_sha1(key, size_);
   auto& buckt = buckets_[idx];
   auto& buckt2 = buckets_[idx2];
   uint64_t prev_ver = std::atomic_load((std::atomic<uint64_t>*) &buckt.version);
@@ -58,13 +61,18 @@ void SimpleHashTable::Add(const Key& key, const Value& value) {
   }
 }
 
+inline void SimpleHashTable::Prefetch(const Key& key) {
+  __builtin_prefetch(&buckets_[ht_murmur3(key, size_)], 1);
+  __builtin_prefetch(&buckets_[ht_sha1(key, size_)], 1);
+}
+
 bool SimpleHashTable::Get(const Key& key, Value* value_out) {
   uint64_t k;
   uint64_t v;
   uint64_t k2;
   uint64_t v2;
-  uint32_t idx = ht_murmur3(key);
-  uint32_t idx2 = ht_sha1(key);
+  uint32_t idx = ht_murmur3(key, size_);
+  uint32_t idx2 = ht_sha1(key, size_);
   auto& buckt = buckets_[idx];
   auto& buckt2 = buckets_[idx2];
   uint64_t prev_ver;
@@ -1,6 +1,8 @@
 #ifndef ARENA_H_
 #define ARENA_H_
 
+#include <cstdlib>
+
 #include <atomic>
 #include <mutex>
 
@@ -17,7 +19,7 @@ class Arena {
     Block* b = head_;
     while (b) {
       auto nb = b->next.load();
-      delete b;
+      free(b);
       b = nb;
     }
   }
@@ -0,0 +1,216 @@
+#ifndef LISTDB_LIB_EPOCH_H_
+#define LISTDB_LIB_EPOCH_H_
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation. A thread pins the current epoch for the length of
+// an operation with a Guard. An object unlinked from the shared structures is
+// retired with the epoch current at that time and freed once every thread
+// pinned since then has pinned a later epoch.
+//
+// Every thread takes a slot on its first Guard. Guards nest.
+class EpochManager {
+ public:
+  static constexpr int kMaxSlots = 1024;
+
+  class Guard {
+   public:
+    explicit Guard(EpochManager* em) : em_(em) { em_->Enter(); }
+    ~Guard() { em_->Exit(); }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+
+   private:
+    EpochManager* em_;
+  };
+
+  EpochManager() = default;
+  ~EpochManager();
+
+  void Enter();
+
+  void Exit();
+
+  // Unpins a pinned thread about to block, so that it does not hold back
+  // the others. The thread must reload every shared pointer after Resume().
+  static void Suspend();
+
+  static void Resume();
+
+  // Must be called after the object is unlinked
+  void Retire(std::function<void()> deleter);
+
+  // Advances the epoch and returns the oldest epoch still pinned. An object
+  // retired before it is not reachable by anyone.
+  uint64_t SafeEpoch();
+
+  uint64_t current() { return global_.load(); }
+
+  // Runs the deleters of the objects nobody can reach. Returns their number.
+  size_t Reclaim();
+
+  // Blocks until every operation in flight at the call has finished
+  void Synchronize();
+
+  size_t num_retired() { return num_retired_.load(std::memory_order_relaxed); }
+
+ private:
+  struct alignas(64) Slot {
+    std::atomic<uint64_t> epoch{0};  // 0 if not pinned
+    std::atomic<bool> in_use{false};
+  };
+
+  struct ThreadState {
+    EpochManager* owner = nullptr;
+    Slot* slot = nullptr;
+    int depth = 0;
+    ~ThreadState() {
+      if (owner) {
+        slot->in_use.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  Slot* Register();
+
+  static thread_local ThreadState tls_;
+
+  std::atomic<uint64_t> global_{1};
+  Slot slots_[kMaxSlots];
+  std::atomic<int> num_slots_{0};  // high-water mark
+
+  std::mutex retired_mu_;
+  std::deque<std::pair<uint64_t, std::function<void()>>> retired_;
+  std::atomic<size_t> num_retired_{0};
+};
+
+inline thread_local EpochManager::ThreadState EpochManager::tls_;
+
+EpochManager::~EpochManager() {
+  Reclaim();
+  for (auto& it : retired_) {
+    it.second();
+  }
+  if (tls_.owner == this) {
+    tls_.owner = nullptr;
+    tls_.depth = 0;
+  }
+}
+
+EpochManager::Slot* EpochManager::Register() {
+  int n = num_slots_.load();
+  for (int i = 0; i < n; i++) {
+    bool expected = false;
+    if (slots_[i].in_use.compare_exchange_strong(expected, true)) {
+      return &slots_[i];
+    }
+  }
+  while (true) {
+    int i = num_slots_.load();
+    if (i >= kMaxSlots) {
+      fprintf(stderr, "EpochManager: more than %d threads.\n", kMaxSlots);
+      abort();
+    }
+    bool expected = false;
+    if (slots_[i].in_use.compare_exchange_strong(expected, true)) {
+      num_slots_.compare_exchange_strong(i, i + 1);
+      return &slots_[i];
+    }
+    num_slots_.compare_exchange_strong(i, i + 1);
+  }
+}
+
+inline void EpochManager::Enter() {
+  if (tls_.owner != this) {
+    if (tls_.owner) {
+      tls_.slot->in_use.store(false, std::memory_order_release);
+    }
+    tls_.owner = this;
+    tls_.slot = Register();
+    tls_.depth = 0;
+  }
+  if (tls_.depth++ == 0) {
+    // The store must be visible before any shared pointer is loaded
+    tls_.slot->epoch.exchange(global_.load());
+  }
+}
+
+inline void EpochManager::Exit() {
+  if (--tls_.depth == 0) {
+    tls_.slot->epoch.store(0, std::memory_order_release);
+  }
+}
+
+inline void EpochManager::Suspend() {
+  if (tls_.owner && tls_.depth > 0) {
+    tls_.slot->epoch.store(0, std::memory_order_release);
+  }
+}
+
+inline void EpochManager::Resume() {
+  if (tls_.owner && tls_.depth > 0) {
+    tls_.slot->epoch.exchange(tls_.owner->global_.load());
+  }
+}
+
+void EpochManager::Retire(std::function<void()> deleter) {
+  std::lock_guard<std::mutex> lk(retired_mu_);
+  retired_.emplace_back(global_.load(), std::move(deleter));
+  num_retired_.store(retired_.size(), std::memory_order_relaxed);
+}
+
+uint64_t EpochManager::SafeEpoch() {
+  uint64_t min_epoch = global_.fetch_add(1) + 1;
+  int n = num_slots_.load();
+  for (int i = 0; i < n; i++) {
+    uint64_t e = slots_[i].epoch.load();
+    if (e != 0 && e < min_epoch) {
+      min_epoch = e;
+    }
+  }
+  return min_epoch;
+}
+
+size_t EpochManager::Reclaim() {
+  uint64_t safe_epoch = SafeEpoch();
+  std::vector<std::function<void()>> deleters;
+  {
+    std::lock_guard<std::mutex> lk(retired_mu_);
+    while (!retired_.empty() && retired_.front().first < safe_epoch) {
+      deleters.push_back(std::move(retired_.front().second));
+      retired_.pop_front();
+    }
+    num_retired_.store(retired_.size(), std::memory_order_relaxed);
+  }
+  for (auto& deleter : deleters) {
+    deleter();
+  }
+  return deleters.size();
+}
+
+void EpochManager::Synchronize() {
+  uint64_t epoch = global_.fetch_add(1) + 1;
+  int n = num_slots_.load();
+  for (int i = 0; i < n; i++) {
+    if (tls_.owner == this && &slots_[i] == tls_.slot) {
+      continue;
+    }
+    while (true) {
+      uint64_t e = slots_[i].epoch.load();
+      if (e == 0 || e >= epoch) {
+        break;
+      }
+      std::this_thread::yield();
+    }
+  }
+}
+
+#endif  // LISTDB_LIB_EPOCH_H_
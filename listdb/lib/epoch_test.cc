@@ -0,0 +1,69 @@
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "listdb/lib/epoch.h"
+
+struct Object {
+  std::atomic<uint64_t> live{1};
+};
+
+int main() {
+  constexpr int kNumReaders = 8;
+  constexpr int kNumSwaps = 100000;
+
+  EpochManager em;
+  std::atomic<Object*> shared{new Object()};
+  std::atomic<bool> stop{false};
+  std::atomic<size_t> num_freed_read{0};
+
+  std::vector<std::thread> readers;
+  for (int i = 0; i < kNumReaders; i++) {
+    readers.emplace_back([&] {
+      while (!stop.load()) {
+        EpochManager::Guard guard(&em);
+        Object* obj = shared.load();
+        if (obj->live.load() != 1) {
+          num_freed_read.fetch_add(1);
+        }
+      }
+    });
+  }
+
+  // Objects are poisoned instead of freed so that a premature reclamation
+  // shows up as a read of a dead object
+  std::vector<Object*> dead;
+  std::mutex dead_mu;
+  for (int i = 0; i < kNumSwaps; i++) {
+    Object* old_obj = shared.exchange(new Object());
+    em.Retire([&, old_obj] {
+      old_obj->live.store(0);
+      std::lock_guard<std::mutex> lk(dead_mu);
+      dead.push_back(old_obj);
+    });
+    if (i % 64 == 0) {
+      em.Reclaim();
+    }
+  }
+  em.Synchronize();
+  em.Reclaim();
+  stop.store(true);
+  for (auto& t : readers) {
+    t.join();
+  }
+  size_t num_reclaimed = dead.size();
+  for (auto obj : dead) {
+    delete obj;
+  }
+
+  fprintf(stdout, "reclaimed: %zu/%d, pending: %zu, dead reads: %zu\n",
+          num_reclaimed, kNumSwaps, em.num_retired(), num_freed_read.load());
+  if (num_freed_read.load() > 0 || num_reclaimed == 0) {
+    fprintf(stdout, "FAILED\n");
+    return 1;
+  }
+  fprintf(stdout, "PASSED\n");
+  return 0;
+}
@@ -1,7 +1,10 @@
 #ifndef LISTDB_LIB_NUMA_H_
 #define LISTDB_LIB_NUMA_H_
 
+#include <algorithm>
 #include <cassert>
+#include <cstdio>
+#include <cstdlib>
 #include <map>
 #include <string>
 #include <vector>
@@ -11,19 +14,28 @@
 class Numa {
  public:
   static void Init();
+  static bool is_initialized() { return is_initialized_; }
   static int num_cpus() { return num_cpus_; }
+  static int num_sockets() { return num_sockets_; }
   inline static int CpuSequenceRR(const int id);
 
+  // Takes the cpus out of CpuSequenceRR() and keeps them for background threads
+  static void Reserve(const std::vector<int>& cpus);
+  static std::vector<int> reserved_cpus() { return reserved_; }
+  static std::vector<int> reserved_cpus(const int socket);
+
  private:
   inline static int num_cpus_;
   inline static int num_sockets_;
   inline static int num_cpus_per_socket_;
   inline static std::map<int, std::vector<int>> table_;
+  inline static std::vector<int> reserved_;
   inline static bool is_initialized_ = false;
 };
 
 void Numa::Init() {
   table_.clear();
+  reserved_.clear();
   num_cpus_ = numa_num_configured_cpus();
   num_sockets_ = numa_num_configured_nodes();
   for (int i = 0; i < num_cpus_; i++) {
@@ -38,7 +50,34 @@ int Numa::CpuSequenceRR(const int num) {
   assert(is_initialized_ == true);
   const int socket = num % num_sockets_;
   const int seq_in_socket = num / num_sockets_;
-  return table_[socket][seq_in_socket];
+  return table_[socket][seq_in_socket % table_[socket].size()];
+}
+
+void Numa::Reserve(const std::vector<int>& cpus) {
+  assert(is_initialized_ == true);
+  for (auto& cpu : cpus) {
+    auto& socket_cpus = table_[numa_node_of_cpu(cpu)];
+    auto it = std::find(socket_cpus.begin(), socket_cpus.end(), cpu);
+    if (it == socket_cpus.end()) {
+      continue;
+    }
+    if (socket_cpus.size() == 1) {
+      fprintf(stderr, "cannot reserve the last cpu of socket %d\n", numa_node_of_cpu(cpu));
+      exit(1);
+    }
+    socket_cpus.erase(it);
+    reserved_.push_back(cpu);
+  }
+}
+
+std::vector<int> Numa::reserved_cpus(const int socket) {
+  std::vector<int> rv;
+  for (auto& cpu : reserved_) {
+    if (numa_node_of_cpu(cpu) == socket) {
+      rv.push_back(cpu);
+    }
+  }
+  return rv;
 }
 
 #endif  // LISTDB_LIB_NUMA_H_
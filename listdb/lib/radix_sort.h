@@ -0,0 +1,99 @@
+#ifndef LISTDB_LIB_RADIX_SORT_H_
+#define LISTDB_LIB_RADIX_SORT_H_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Stable LSD radix sort of data[0, n) by a 64-bit key, one byte per pass.
+// The bytes all the keys share are skipped, so a key of a narrow range
+// costs only a few passes. Every pass splits the input into one chunk per
+// thread: the chunks are counted, then scattered at their own offsets.
+template <typename T, typename KeyFunc>
+void RadixSort(T* data, size_t n, KeyFunc key, int num_threads = 1) {
+  constexpr size_t kMinChunkSize = 4096;
+  constexpr int kRadix = 256;
+  if (n < 2) {
+    return;
+  }
+  num_threads = std::max<int>(1, std::min<size_t>(num_threads, n / kMinChunkSize));
+  size_t chunk_size = (n + num_threads - 1) / num_threads;
+
+  auto run_parallel = [&](auto&& fn) {
+    std::vector<std::thread> threads;
+    for (int t = 1; t < num_threads; t++) {
+      threads.emplace_back(fn, t);
+    }
+    fn(0);
+    for (auto& th : threads) {
+      th.join();
+    }
+  };
+
+  std::vector<uint64_t> and_bits(num_threads, ~0ull);
+  std::vector<uint64_t> or_bits(num_threads, 0);
+  run_parallel([&](int t) {
+    size_t begin = t * chunk_size;
+    size_t end = std::min(n, begin + chunk_size);
+    uint64_t a = ~0ull;
+    uint64_t o = 0;
+    for (size_t i = begin; i < end; i++) {
+      uint64_t k = key(data[i]);
+      a &= k;
+      o |= k;
+    }
+    and_bits[t] = a;
+    or_bits[t] = o;
+  });
+  uint64_t all_and = ~0ull;
+  uint64_t all_or = 0;
+  for (int t = 0; t < num_threads; t++) {
+    all_and &= and_bits[t];
+    all_or |= or_bits[t];
+  }
+  uint64_t diff = all_and ^ all_or;
+
+  std::vector<T> buf(n);
+  T* src = data;
+  T* dst = buf.data();
+  std::vector<size_t> offsets(num_threads * kRadix);
+  for (int shift = 0; shift < 64; shift += 8) {
+    if (((diff >> shift) & 0xff) == 0) {
+      continue;
+    }
+    std::fill(offsets.begin(), offsets.end(), 0);
+    run_parallel([&](int t) {
+      size_t* cnt = &offsets[t * kRadix];
+      size_t begin = t * chunk_size;
+      size_t end = std::min(n, begin + chunk_size);
+      for (size_t i = begin; i < end; i++) {
+        cnt[(key(src[i]) >> shift) & 0xff]++;
+      }
+    });
+    // Digit-major, then chunk order keeps the sort stable
+    size_t sum = 0;
+    for (int d = 0; d < kRadix; d++) {
+      for (int t = 0; t < num_threads; t++) {
+        size_t cnt = offsets[t * kRadix + d];
+        offsets[t * kRadix + d] = sum;
+        sum += cnt;
+      }
+    }
+    run_parallel([&](int t) {
+      size_t* pos = &offsets[t * kRadix];
+      size_t begin = t * chunk_size;
+      size_t end = std::min(n, begin + chunk_size);
+      for (size_t i = begin; i < end; i++) {
+        dst[pos[(key(src[i]) >> shift) & 0xff]++] = src[i];
+      }
+    });
+    std::swap(src, dst);
+  }
+  if (src != data) {
+    std::copy(src, src + n, data);
+  }
+}
+
+#endif  // LISTDB_LIB_RADIX_SORT_H_
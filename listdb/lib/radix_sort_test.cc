@@ -0,0 +1,45 @@
+#include <algorithm>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "listdb/lib/radix_sort.h"
+
+struct Item {
+  uint64_t key;
+  uint64_t order;
+};
+
+int main() {
+  constexpr size_t kNumItems = 1000000;
+
+  std::mt19937_64 rng(1234);
+  std::vector<Item> items(kNumItems);
+  for (size_t i = 0; i < kNumItems; i++) {
+    // Narrow and wide keys with plenty of duplicates
+    uint64_t key = (i % 2) ? rng() % 10000 : (rng() % 10000) << 40;
+    items[i] = Item{key, i};
+  }
+
+  auto expected = items;
+  std::stable_sort(expected.begin(), expected.end(),
+                   [](const Item& a, const Item& b) { return a.key < b.key; });
+
+  int rv = 0;
+  for (int num_threads : {1, 4}) {
+    auto sorted = items;
+    RadixSort(sorted.data(), sorted.size(), [](const Item& item) { return item.key; }, num_threads);
+    bool ok = true;
+    for (size_t i = 0; i < kNumItems; i++) {
+      if (sorted[i].key != expected[i].key || sorted[i].order != expected[i].order) {
+        ok = false;
+        break;
+      }
+    }
+    fprintf(stdout, "threads %d: %s\n", num_threads, ok ? "PASSED" : "FAILED");
+    if (!ok) {
+      rv = 1;
+    }
+  }
+  return rv;
+}
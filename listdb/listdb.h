@@ -3,13 +3,16 @@
 
 #include <deque>
 #include <fstream>
+#include <functional>
 #include <iomanip>
 #include <iostream>
 #include <queue>
 #include <sstream>
 #include <stack>
+#include <string>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <experimental/filesystem>
 
@@ -29,20 +32,27 @@
 #include "listdb/core/double_hashing_cache.h"
 #include "listdb/core/linear_probing_hashtable_cache.h"
 #include "listdb/core/pmem_db.h"
+#include "listdb/core/cache_snapshot.h"
 #include "listdb/index/braided_pmem_skiplist.h"
 #include "listdb/index/lockfree_skiplist.h"
 #include "listdb/index/simple_hash_table.h"
+#include "listdb/lib/arena.h"
+#include "listdb/lib/epoch.h"
+#include "listdb/lib/numa.h"
+#include "listdb/lib/radix_sort.h"
 #include "listdb/lsm/level_list.h"
 #include "listdb/lsm/memtable_list.h"
 #include "listdb/lsm/pmemtable.h"
 #include "listdb/lsm/pmemtable_list.h"
+#include "listdb/pmem/persist.h"
 #include "listdb/util/clock.h"
 #include "listdb/util/random.h"
+#include "listdb/util/rate_limiter.h"
 #include "listdb/util/reporter.h"
 #include "listdb/util/reporter_client.h"
+#include "listdb/util/task_scheduler.h"
 
-#define L0_COMPACTION_ON_IDLE
-#define L0_COMPACTION_YIELD
+//#define L0_COMPACTION_YIELD
 
 //#define REPORT_BACKGROUND_WORKS
 #ifdef REPORT_BACKGROUND_WORKS
@@ -57,10 +67,6 @@
 #define REPORT_DONE
 #endif
 
-
-//#define L0_COMPACTION_ON_IDLE
-//#define L0_COMPACTION_YIELD
-
 namespace fs = std::experimental::filesystem::v1;
 
 class ListDB {
@@ -69,6 +75,8 @@ class ListDB {
   using PmemNode = BraidedPmemSkipList::Node;
 
   struct Task {
+    virtual ~Task() = default;
+
     TaskType type;
     int shard;
   };
@@ -83,13 +91,25 @@ class ListDB {
     MemTableList* memtable_list;
   };
 
+  // Jobs of a RunParallel() call, shared by the caller and helper tasks
+  struct ParallelJobs {
+    std::vector<std::function<void()>>* jobs;
+    std::vector<int> regions;  // preferred region of every job, or empty
+    size_t num_jobs;
+    std::unique_ptr<std::atomic_flag[]> claimed;
+    std::atomic<size_t> num_done{0};
+  };
+
+  struct ParallelJobTask : Task {
+    std::shared_ptr<ParallelJobs> pj;
+  };
+
+  using Scheduler = TaskScheduler<Task>;
+
   struct alignas(64) CompactionWorkerData {
     int id;
-    bool stop;
+    int region;  // home queue of the worker
     Random rnd = Random(0);
-    std::queue<Task*> q;
-    std::mutex mu;
-    std::condition_variable cv;
     Task* current_task;
     uint64_t flush_cnt = 0;
     uint64_t flush_time_usec = 0;
@@ -97,17 +117,122 @@ class ListDB {
     //uint64_t compaction_time_usec = 0;
   };
 
+  struct ZipperItem {
+    PmemPtr node_paddr;
+    PmemNode* preds[1];  // variable length (node height)
+  };
+
+  // A key range of an L0 table, scanned and merged by a single thread.
+  // Scans run in parallel. A partition starts to merge only after the one on
+  // its right is done, so the merged nodes are always a suffix of the L0
+  // table, as in the sequential merge.
+  struct ZipperPartition {
+    PmemPtr begin;
+    PmemPtr end;
+    PmemTable* l1_table = nullptr;  // L1 partition (or older L0 table if combine) to merge into
+    bool combine = false;
+    size_t merged_size = 0;
+    uint64_t* cursor = nullptr;  // persisted progress
+    size_t num_merged = 0;
+    std::atomic<bool> merged{false};
+    Arena arena = Arena(kZipperArenaBlockSize);
+    std::vector<ZipperItem*> zstack;
+  };
+
+  // The tail of a split L1 partition, cut off once the readers of the old
+  // partitions are done
+  struct L1Cut {
+    BraidedPmemSkipList* skiplist;
+    Key end_key;
+    uint64_t epoch;
+  };
+
+  enum class RecoveryState {
+    kRecovered,  // also every shard of a new DB
+    kPending,
+    kRecovering,
+  };
+
+  struct ReplayEntry {
+    uint64_t key_num;
+    uint64_t paddr;
+    uint32_t l0_id;
+  };
+
+  // A table rebuilt from the log. Every region of the shard replays into it.
+  struct ReplayTarget {
+    pmem::obj::persistent_ptr<pmem_l0_info> l0;
+    BraidedPmemSkipList* l0_skiplist = nullptr;  // kFull
+    MemTable* memtable = nullptr;  // kInitialized or kL1FlushInitiated
+    std::atomic<size_t> kv_size{0};
+    std::vector<ReplayEntry> entries[kNumRegions];  // log order
+  };
+
+  struct ShardRecovery {
+    std::deque<Table*> tables;  // oldest to newest
+    std::deque<std::unique_ptr<ReplayTarget>> targets;  // oldest to newest
+    std::deque<pmem::obj::persistent_ptr<pmem_log_block>> log_blocks[kNumRegions];
+    std::atomic<int> num_pending_regions{kNumRegions};
+    MemTable* l1_flush_redo = nullptr;
+  };
+
+  struct RecoveryTask {
+    int shard;
+    int region;  // -1 for the shard unit
+  };
+
+  struct RecoveryStats {
+    std::chrono::steady_clock::time_point begin_tp;
+    std::atomic<int> memtable_cnt{0};
+    std::atomic<int> l0_cnt{0};
+    std::atomic<int> l0_persisted_cnt{0};
+    std::atomic<int> l0_merging_cnt{0};
+    std::atomic<int> merge_done_cnt{0};
+    std::atomic<int> l1_cnt{0};
+    std::atomic<size_t> mem_insert_cnt{0};
+    std::atomic<size_t> l0_insert_cnt{0};
+  };
+
   enum class ServiceStatus {
     kActive,
     kStop,
   };
 
+  // Pool layout and tuning knobs. The defaults are the constants of common.h.
+  struct Options {
+    Pmem::Backend backend = Pmem::backend();
+    Persist::Mode persist_mode = Persist::DefaultMode();
+    std::string db_path = "/pmem/wkim/listdb";  // root pool with the manifests
+    size_t db_pool_size = 64 * (1ull << 20);
+    // Pool directory of every region; /pmem<region>/wkim if not given
+    std::vector<std::string> region_dirs;
+    std::string poolset_part_size = "400G";
+    // Poolset parts and heap extensions are rounded up to it, e.g. 2M or 1G
+    // for huge page mappings. 0 leaves them as they are.
+    size_t pool_alignment = 0;
+    // Open() faults in the log blocks, one thread per region
+    bool prefault = false;
+    size_t memtable_capacity = kMemTableCapacity;  // over all the shards
+    int max_num_memtables = kMaxNumMemTables;  // per shard
+    int num_workers = kNumWorkers;
+    size_t ht_size = kHTSize;  // L0 cache buckets over all the shards
+#ifdef LISTDB_SKIPLIST_CACHE
+    size_t skiplist_cache_capacity = kSkipListCacheCapacity;  // over all the shards
+#endif
+  };
+
   ~ListDB();
 
   void Init();
 
+  void Init(const Options& options);
+
   void Open();
 
+  void Open(const Options& options);
+
+  const Options& options() { return options_; }
+
   void Close();
 
   //void Put(const Key& key, const Value& value);
@@ -117,6 +242,10 @@ class ListDB {
   Reporter* GetOrCreateReporter(const std::string& fname);
 
   // private:
+  // Clients call it before touching a shard. Recovers the shard on the
+  // caller if nobody has started it yet.
+  void WaitForShardRecovery(int shard);
+
   MemTable* GetWritableMemTable(size_t kv_size, int shard);
 
   MemTable* GetMemTable(int shard);
@@ -144,19 +273,108 @@ class ListDB {
 
   int pool_id_to_region(const int pool_id) { return pool_id_to_region_[pool_id]; }
 
+  // Clients hold a guard of it for every operation
+  EpochManager* epoch() { return &epoch_; }
+
   int l0_pool_id(const int region) { return l0_pool_id_[region]; }
 
   int l1_pool_id(const int region) { return l1_pool_id_[region]; }
 
+  std::string RegionDir(int region);
+
+  // Writes a single-part poolset file for the pool directory and returns its path
+  std::string CreatePoolSet(const std::string& path);
+
+  // "400G" to bytes
+  static size_t ParseSize(const std::string& size);
+
+  // Size of the single part of every poolset, i.e. the largest pool offset
+  size_t PoolSetPartSize();
+
+  // Exits on options the db cannot run with
+  void CheckOptions();
+
   // Background Works
+  // Binds each worker to the NUMA node of its home region. Workers run on
+  // the cpus taken by Numa::Reserve() if any. Must be set before Init().
+  void SetBackgroundNumaBinding(bool enable) { bg_numa_binding_ = enable; }
+
+  // Open() returns before the shards are recovered. Must be set before Open().
+  void SetLazyRecovery(bool enable) { lazy_recovery_ = enable; }
+
+  void BindBackgroundThread(int region);
+
+  void InitCaches();
+
+  void StartBackgroundThreads();
+
   void SetL0CompactionSchedulerStatus(const ServiceStatus& status);
 
+  // Applies from the next L0 compaction of the shard. Survives restarts.
+  void SetCompactionMode(int shard, CompactionMode mode);
+
+  CompactionMode compaction_mode(int shard) { return compaction_mode_[shard].load(); }
+
+  void RecoverShard(int shard);
+
+  void ReplayLogRegion(int shard, int region);
+
+  void BuildReplayTarget(int shard, ReplayTarget* target);
+
+  void FinishShardRecovery(int shard);
+
+  bool ClaimShardRecovery(int shard);
+
+  void RecoveryThreadLoop(int region);
+
+  std::string CacheSnapshotPath() { return Pmem::Path(options_.db_path) + "_cache"; }
+
+  uint64_t CacheSnapshotConfig();
+
+  uint64_t ManifestFingerprint(int shard);
+
+  void SaveCacheSnapshot();
+
+  bool LoadCacheSnapshot(int shard);
+
+  void WarmL0Cache(int shard);
+
+  void CacheWarmerThreadLoop(int region);
+
+  void PrefaultLogs();
+
+  // Binds the pools of CoW compaction on first use. Dbs that only ever run
+  // zipper compaction do not create them.
+  void BindCowArenas();
+
+  void StartLogPrefaulters();
+
+  // Keeps spare blocks ready ahead of the logs of the region
+  void LogPrefaultThreadLoop(int region);
+
   void BackgroundThreadLoop();
 
+  void TryScheduleL0Compaction(int shard);
+
+  void UpdateWriteController(int shard);
+
+  // Charges background writes to the I/O budget in kBgIoRequestBytes units
+  void ThrottleBackgroundIo(size_t* pending_bytes, size_t bytes, Env::IOPriority pri);
+
+  void TuneBackgroundIo();
+
+  void RebalanceMemTableCapacity();
+
+  void RecordWriteLatency(uint64_t nanos);
+
   void CompactionWorkerThreadLoop(CompactionWorkerData* td);
 
   void FlushMemTable(MemTableFlushTask* task, CompactionWorkerData* td);
 
+  bool ShouldFlushToL1(MemTableFlushTask* task);
+
+  void FlushMemTableToL1(MemTableFlushTask* task, CompactionWorkerData* td);
+
   void FlushMemTableWAL(MemTableFlushTask* task, CompactionWorkerData* td);
 
   void FlushMemTableToL1WAL(MemTableFlushTask* task, CompactionWorkerData* td);
@@ -165,7 +383,48 @@ class ListDB {
 
   void ZipperCompactionL0(CompactionWorkerData* td, L0CompactionTask* task);
 
-  void L0CompactionCopyOnWrite(L0CompactionTask* task);
+  int FindZipperPivots(BraidedPmemSkipList* l0_skiplist, int num_partitions, std::vector<PmemPtr>* pivots);
+
+  void ZipperScan(BraidedPmemSkipList* l1_skiplist, ZipperPartition* part);
+
+  void ZipperMerge(CompactionWorkerData* td, int shard, ZipperPartition* part);
+
+  void ZipperAdvanceCursor(ZipperPartition* part, PmemPtr node_paddr);
+
+  void PersistZipperProgress(pmem::obj::persistent_ptr<pmem_l0_info> l0_manifest, std::vector<ZipperPartition*>& parts, Level0Status status);
+  void FreeZipperProgress(pmem::obj::persistent_ptr<pmem_l0_info> l0_manifest);
+
+  void ResumeZipperCompactionL0(L0CompactionTask* task);
+
+  void ResumeZipperMerge(int shard, pmem::obj::persistent_ptr<pmem_l0_info> l0_manifest, const std::function<PmemTable*(const Key&)>& find_target);
+
+  void ResumeZipperMergeNode(int shard, PmemTable* target, PmemPtr node_paddr);
+
+  void CombineL0Tables(CompactionWorkerData* td, L0CompactionTask* task);
+
+  void RunParallel(CompactionWorkerData* td, std::vector<std::function<void()>>& jobs,
+                   const std::vector<int>* regions = nullptr);
+
+  void RunParallelJobs(ParallelJobs* pj, int region);
+
+  PmemTable* CreateL1Partition(int shard, const Key& begin_key, pmem::obj::persistent_ptr<pmem_l1_info>* manifest);
+
+  void PersistL1Partition(PmemTable* table);
+
+  // Sets the size in the manifest as well, so splits go on after a restart
+  void SetL1PartitionSize(PmemTable* table, size_t size);
+
+  void SplitL1Partition(int shard, int idx);
+
+  void CutL1Partition(BraidedPmemSkipList* skiplist, const Key& end_key);
+
+  bool ApplyL1Cuts(int shard, bool force);
+
+  void ReclaimLogBlocks(CompactionWorkerData* td, Task* task);
+
+  PmemNode* RelocateL1Node(BraidedPmemSkipList* l1_skiplist, PmemLog* log, PmemPtr node_paddr);
+
+  void L0CompactionCopyOnWrite(CompactionWorkerData* td, L0CompactionTask* task);
 
   // Utility Functions
   void PrintDebugLsmState(int shard);
@@ -197,6 +456,9 @@ class ListDB {
   PmemLog* log_[kNumRegions][kNumShards];
   PmemLog* l0_arena_[kNumRegions][kNumShards];
   PmemLog* l1_arena_[kNumRegions][kNumShards];
+  PmemLog* cow_arena_[kNumRegions][kNumShards] = {};  // L1 nodes copied by CoW compaction
+  std::atomic<bool> cow_arena_bound_{false};
+  std::mutex cow_arena_mu_;
   LevelList* ll_[kNumShards];
 
 #if LISTDB_L0_CACHE == L0_CACHE_T_SIMPLE
@@ -209,26 +471,55 @@ class ListDB {
   LinearProbingHashTableCache* hash_table_[kNumShards];
 #endif
 
-  std::unordered_map<int, int> pool_id_to_region_;
+  alignas(64) int pool_id_to_region_[Pmem::kMaxNumPools] = {};
   std::unordered_map<int, int> log_pool_id_;
   std::unordered_map<int, int> l0_pool_id_;
   std::unordered_map<int, int> l1_pool_id_;
 
-  //std::queue<MemTableFlushTask*> memtable_flush_queue_;
-  //std::mutex bg_mu_;
-  //std::condition_variable bg_cv_;
-
-  std::deque<Task*> work_request_queue_;
-  std::deque<Task*> work_completion_queue_;
-  std::mutex wq_mu_;
-  std::condition_variable wq_cv_;
+  EpochManager epoch_;
+  Scheduler scheduler_{kNumRegions};
+  Options options_;
+  // Set from options_.memtable_capacity by Init() and Open()
+  size_t l1_partition_split_size_ = 0;  // kv bytes
+  // The capacity of a mutable memtable moves with the write rate of its
+  // shard, between these bounds. The capacities of all shards sum up to
+  // options_.memtable_capacity at most.
+  size_t min_shard_memtable_capacity_ = 0;
+  size_t max_shard_memtable_capacity_ = 0;
+  bool bg_numa_binding_ = false;
+  bool lazy_recovery_ = false;
+  std::unique_ptr<ShardRecovery> shard_recovery_[kNumShards];
+  std::atomic<RecoveryState> shard_recovery_state_[kNumShards] = {};
+  std::mutex recovery_mu_;
+  std::condition_variable recovery_cv_;
+  std::unique_ptr<TaskScheduler<RecoveryTask>> recovery_queue_;
+  std::vector<std::thread> recovery_workers_;
+  std::atomic<int> num_pending_recovery_shards_{0};
+  RecoveryStats recovery_stats_;
+  std::unique_ptr<CacheSnapshot> cache_snapshot_;  // until every shard is recovered
+  bool l0_cache_cold_[kNumShards] = {};
+  std::vector<std::thread> cache_warmers_;
+  std::atomic<bool> stop_cache_warming_{false};
+  std::vector<std::thread> log_prefaulters_;
+  std::mutex log_prefault_mu_;
+  std::condition_variable log_prefault_cv_[kNumRegions];
+  bool log_prefault_requested_[kNumRegions] = {};
+  bool stop_log_prefault_ = false;
+  // 0: idle, 1: L0 compaction, 2: log reclamation, 3: memtable flush to L1,
+  // 4: recovery, 5: L0 cache warm-up
+  std::atomic<int> shard_bg_state_[kNumShards] = {};
+  std::atomic<CompactionMode> compaction_mode_[kNumShards];
 
   std::thread bg_thread_;
+  std::mutex bg_mu_;
+  std::condition_variable bg_cv_;
   bool stop_ = false;
-  ServiceStatus l0_compaction_scheduler_status_ = ServiceStatus::kActive;
+  std::atomic<ServiceStatus> l0_compaction_scheduler_status_{ServiceStatus::kActive};
+
+  std::vector<CompactionWorkerData> worker_data_;
+  std::vector<std::thread> worker_threads_;
 
-  CompactionWorkerData worker_data_[kNumWorkers];
-  std::thread worker_threads_[kNumWorkers];
+  std::vector<L1Cut> l1_cuts_[kNumShards];  // accessed by the shard's compaction
 
 #ifdef LISTDB_L1_LRU
   std::vector<std::pair<uint64_t, uint64_t>> sorted_arr_[kNumRegions][kNumShards];
@@ -239,6 +530,22 @@ class ListDB {
   SkipListCacheRep* cache_[kNumShards][kNumRegions];
 #endif
 
+  std::unique_ptr<RateLimiter> bg_io_limiter_{NewGenericRateLimiter(kBgIoMaxRate, kBgIoRefillUsec)};
+  std::atomic<uint64_t> write_latency_nanos_{0};
+  std::atomic<uint64_t> write_latency_cnt_{0};
+  // Written by the bg thread, read by GetStatString()
+  std::atomic<uint64_t> write_latency_baseline_{0};
+  std::atomic<uint64_t> write_latency_last_{0};
+  size_t memtable_written_bytes_[kNumShards] = {};  // accessed by the bg thread
+  double memtable_write_rate_[kNumShards] = {};
+
+  std::atomic<size_t> num_versions_merged_{0};
+  std::atomic<size_t> num_l1_flushes_{0};
+  std::atomic<size_t> num_zipper_merges_{0};
+  std::atomic<size_t> num_zipper_partitions_{0};
+  std::atomic<size_t> num_log_blocks_reclaimed_{0};
+  std::atomic<size_t> num_nodes_relocated_{0};
+
   std::atomic<Reporter*> reporter_;
   std::mutex mu_;
 };
@@ -249,10 +556,82 @@ ListDB::~ListDB() {
   Close();
 }
 
+std::string ListDB::RegionDir(int region) {
+  if (region < (int) options_.region_dirs.size()) {
+    return Pmem::Path(options_.region_dirs[region]);
+  }
+  return Pmem::Path("/pmem" + std::to_string(region) + "/wkim");
+}
+
+size_t ListDB::ParseSize(const std::string& size) {
+  size_t pos = 0;
+  size_t rv = std::stoull(size, &pos);
+  if (pos < size.size()) {
+    switch (toupper(size[pos])) {
+      case 'T': rv <<= 10; [[fallthrough]];
+      case 'G': rv <<= 10; [[fallthrough]];
+      case 'M': rv <<= 10; [[fallthrough]];
+      case 'K': rv <<= 10; break;
+      default:
+        fprintf(stderr, "invalid size: %s\n", size.c_str());
+        exit(1);
+    }
+  }
+  return rv;
+}
+
+std::string ListDB::CreatePoolSet(const std::string& path) {
+  fs::remove_all(path);
+  fs::create_directories(path);
+
+  std::string poolset = path + ".set";
+  std::fstream strm(poolset, strm.out);
+  strm << "PMEMPOOLSET" << std::endl;
+  strm << "OPTION SINGLEHDR" << std::endl;
+  strm << PoolSetPartSize() << " " << path << "/" << std::endl;
+  strm.close();
+  return poolset;
+}
+
+void ListDB::CheckOptions() {
+  // A shard needs an immutable memtable besides the mutable one
+  if (options_.max_num_memtables < 2) {
+    fprintf(stderr, "max_num_memtables must be at least 2 (current: %d)\n", options_.max_num_memtables);
+    exit(1);
+  }
+  if (options_.num_workers < 1) {
+    fprintf(stderr, "num_workers must be at least 1 (current: %d)\n", options_.num_workers);
+    exit(1);
+  }
+}
+
+size_t ListDB::PoolSetPartSize() {
+  size_t part_size = ParseSize(options_.poolset_part_size);
+  if (options_.pool_alignment) {
+    part_size = (part_size + options_.pool_alignment - 1) / options_.pool_alignment * options_.pool_alignment;
+  }
+  return part_size;
+}
+
 void ListDB::Init() {
-  std::string db_path = "/pmem/wkim/listdb";
+  Init(Options());
+}
+
+void ListDB::Init(const Options& options) {
+  options_ = options;
+  CheckOptions();
+  if (options_.backend != Pmem::backend()) {
+    Pmem::SetBackend(options_.backend);
+  }
+  Persist::SetMode(options_.persist_mode);
+  Pmem::SetPoolAlignment(options_.pool_alignment);
+  l1_partition_split_size_ = 16 * options_.memtable_capacity / kNumShards;
+  min_shard_memtable_capacity_ = options_.memtable_capacity / kNumShards / 4;
+  max_shard_memtable_capacity_ = options_.memtable_capacity / 4;
+  std::string db_path = Pmem::Path(options_.db_path);
   fs::remove_all(db_path);
-  int root_pool_id = Pmem::BindPool<pmem_db>(db_path, "", 64*1024*1024);
+  fs::remove(CacheSnapshotPath());
+  int root_pool_id = Pmem::BindPool<pmem_db>(db_path, kDbPoolLayout, options_.db_pool_size);
   if (root_pool_id != 0) {
     std::cerr << "root_pool_id must be zero (current: " << root_pool_id << ")\n";
     exit(1);
@@ -265,32 +644,28 @@ void ListDB::Init() {
     pmem::obj::persistent_ptr<pmem_l0_info> p_l0_manifest;
     pmem::obj::make_persistent_atomic<pmem_l0_info>(db_pool, p_l0_manifest);
     p_shard_manifest->l0_list_head = p_l0_manifest;
+#ifdef L1_COW
+    p_shard_manifest->compaction_mode = CompactionMode::kCopyOnWrite;
+#else
+    p_shard_manifest->compaction_mode = CompactionMode::kZipper;
+#endif
+    compaction_mode_[i].store(p_shard_manifest->compaction_mode);
     db_root->shard[i] = p_shard_manifest;
   }
   // TODO(wkim): write log path on db_root
 
   // Log Pmem Pool
   for (int i = 0; i < kNumRegions; i++) {
-    std::stringstream pss;
-    pss << "/pmem" << i << "/wkim/listdb_log";
-    std::string path = pss.str();
-    fs::remove_all(path);
-    fs::create_directories(path);
-
-    std::string poolset = path + ".set";
-    std::fstream strm(poolset, strm.out);
-    strm << "PMEMPOOLSET" << std::endl;
-    strm << "OPTION SINGLEHDR" << std::endl;
-    strm << "400G " << path << "/" << std::endl;
-    strm.close();
-
-    int pool_id = Pmem::BindPoolSet<pmem_log_root>(poolset, "");
+    std::string poolset = CreatePoolSet(RegionDir(i) + "/listdb_log");
+
+    int pool_id = Pmem::BindPoolSet<pmem_log_root>(poolset, kLogPoolLayout);
     pool_id_to_region_[pool_id] = i;
     log_pool_id_[i] = pool_id;
     auto pool = Pmem::pool<pmem_log_root>(pool_id);
 
     for (int j = 0; j < kNumShards; j++) {
       log_[i][j] = new PmemLog(pool_id, j);
+      log_[i][j]->BindEpochManager(&epoch_);
     }
   }
 #ifndef LISTDB_WAL
@@ -312,18 +687,7 @@ void ListDB::Init() {
   #else
   // WAL
   for (int i = 0; i < kNumRegions; i++) {
-    std::stringstream pss;
-    pss << "/pmem" << i << "/wkim/listdb_nonunified_l0";
-    std::string path = pss.str();
-    fs::remove_all(path);
-    fs::create_directories(path);
-
-    std::string poolset = path + ".set";
-    std::fstream strm(poolset, strm.out);
-    strm << "PMEMPOOLSET" << std::endl;
-    strm << "OPTION SINGLEHDR" << std::endl;
-    strm << "400G " << path << "/" << std::endl;
-    strm.close();
+    std::string poolset = CreatePoolSet(RegionDir(i) + "/listdb_nonunified_l0");
 
     int pool_id = Pmem::BindPoolSet<pmem_blob_root>(poolset, "");
     pool_id_to_region_[pool_id] = i;
@@ -332,6 +696,7 @@ void ListDB::Init() {
 
     for (int j = 0; j < kNumShards; j++) {
       l0_arena_[i][j] = new PmemLog(pool_id, j);
+      l0_arena_[i][j]->BindEpochManager(&epoch_);
     }
   }
   #endif
@@ -339,18 +704,7 @@ void ListDB::Init() {
 
 #ifdef LISTDB_WISCKEY
   for (int i = 0; i < kNumRegions; i++) {
-    std::stringstream pss;
-    pss << "/pmem" << i << "/wkim/listdb_value";
-    std::string path = pss.str();
-    fs::remove_all(path);
-    fs::create_directories(path);
-
-    std::string poolset = path + ".set";
-    std::fstream strm(poolset, strm.out);
-    strm << "PMEMPOOLSET" << std::endl;
-    strm << "OPTION SINGLEHDR" << std::endl;
-    strm << "400G " << path << "/" << std::endl;
-    strm.close();
+    std::string poolset = CreatePoolSet(RegionDir(i) + "/listdb_value");
 
     int pool_id = Pmem::BindPoolSet<pmem_blob_root>(poolset, "");
     pool_id_to_region_[pool_id] = i;
@@ -362,37 +716,21 @@ void ListDB::Init() {
   }
 #endif
 
-#ifdef L1_COW
-  // Pmem Pool for L1
+  // Pmem Pool for L1 nodes copied by CoW compaction, left over from an
+  // earlier db until CoW compaction runs
   for (int i = 0; i < kNumRegions; i++) {
-    std::stringstream pss;
-    pss << "/pmem" << i << "/wkim/listdb_l1";
-    std::string path = pss.str();
-    fs::remove_all(path);
-    fs::create_directories(path);
-
-    std::string poolset = path + ".set";
-    std::fstream strm(poolset, strm.out);
-    strm << "PMEMPOOLSET" << std::endl;
-    strm << "OPTION SINGLEHDR" << std::endl;
-    strm << "400G " << path << "/" << std::endl;
-    strm.close();
-
-    int pool_id = Pmem::BindPoolSet<pmem_log_root>(poolset, "");
-    pool_id_to_region_[pool_id] = i;
-    auto pool = Pmem::pool<pmem_log_root>(pool_id);
-
-    for (int j = 0; j < kNumShards; j++) {
-      l1_arena_[i][j] = new PmemLog(pool_id, j);
-    }
+    fs::remove_all(RegionDir(i) + "/listdb_l1");
+    fs::remove(RegionDir(i) + "/listdb_l1.set");
   }
-#else
+#ifdef L1_COW
+  BindCowArenas();
+#endif
+  // The L1 heads stay in the log pools. L1 nodes live in either pool.
   for (int i = 0; i < kNumRegions; i++) {
     for (int j = 0; j < kNumShards; j++) {
       l1_arena_[i][j] = l0_arena_[i][j];
     }
   }
-#endif
   for (int i = 0; i < kNumRegions; i++) {
     l1_pool_id_[i] = l1_arena_[i][0]->pool_id();
   }
@@ -401,7 +739,8 @@ void ListDB::Init() {
     ll_[i] = new LevelList();
     // MemTableList
     {
-      auto tl = new MemTableList(kMemTableCapacity / kNumShards, i);
+      auto tl = new MemTableList(options_.memtable_capacity / kNumShards, i);
+      tl->SetMaxNumMemTables(options_.max_num_memtables);
       tl->BindEnqueueFunction([&, tl, i](MemTable* mem) {
         //fprintf(stdout, "binded enq fn, mem = %p\n", mem);
         auto task = new MemTableFlushTask();
@@ -409,14 +748,13 @@ void ListDB::Init() {
         task->shard = i;
         task->imm = mem;
         task->memtable_list = tl;
-        std::unique_lock<std::mutex> lk(wq_mu_);
-        work_request_queue_.push_back(task);
-        lk.unlock();
-        wq_cv_.notify_one();
+        scheduler_.Push(task, mem->home_region(), Scheduler::kHigh);
+        UpdateWriteController(i);
       });
       for (int j = 0; j < kNumRegions; j++) {
         tl->BindArena(j, l0_arena_[j][i]);
       }
+      tl->BindEpochManager(&epoch_);
       ll_[i]->SetTableList(0, tl);
     }
 
@@ -426,93 +764,66 @@ void ListDB::Init() {
       for (int j = 0; j < kNumRegions; j++) {
         tl->BindArena(l1_arena_[j][i]->pool_id(), l1_arena_[j][i]);
       }
+      tl->BindEpochManager(&epoch_);
       ll_[i]->SetTableList(1, tl);
     }
   }
 
 #if 1
   for (int i = 0; i < kNumShards; i++) {
-    auto l1_tl = ll_[i]->GetTableList(1);
-    // TODO: impl InitFrontOnce() and use it instead of GetFront()
-    [[maybe_unused]] auto l1_table = (PmemTable*) l1_tl->GetFront();
-  }
-#endif
-
-#ifdef LISTDB_L1_LRU
-  for (int i = 0; i < kNumShards; i++) {
-    for (int j = 0; j < kNumRegions; j++) {
-      cache_[i][j] = new LruSkipList(100000000);
-    }
-  }
-#endif
-#ifdef LISTDB_SKIPLIST_CACHE
-  for (int i = 0; i < kNumShards; i++) {
-    for (int j = 0; j < kNumRegions; j++) {
-      cache_[i][j] = new SkipListCacheRep(l1_arena_[j][i]->pool_id(), kSkipListCacheCapacity / kNumShards / kNumRegions);
-    }
-  }
-#endif
-
-#if LISTDB_L0_CACHE == L0_CACHE_T_SIMPLE
-  for (int i = 0; i < 1; i++) {
-    hash_table_[i] = new SimpleHashTable(kHTSize);
-    for (size_t j = 0; j < kHTSize; j++) {
-      hash_table_[i]->at(j)->version = 1UL;
-    }
-  }
-#elif LISTDB_L0_CACHE == L0_CACHE_T_STATIC
-  for (int i = 0; i < kNumShards; i++) {
-    hash_table_[i] = new StaticHashTableCache(kHTSize / kNumShards, i);
-  }
-#elif LISTDB_L0_CACHE == L0_CACHE_T_DOUBLE_HASHING
-  for (int i = 0; i < kNumShards; i++) {
-    hash_table_[i] = new DoubleHashingCache(kHTSize / kNumShards, i);
-  }
-#elif LISTDB_L0_CACHE == L0_CACHE_T_LINEAR_PROBING
-  for (int i = 0; i < kNumShards; i++) {
-    hash_table_[i] = new LinearProbingHashTableCache(kHTSize / kNumShards, i);
+    auto l1_tl = GetTableList<PmemTableList>(1, i);
+    pmem::obj::persistent_ptr<pmem_l1_info> l1_manifest;
+    auto l1_table = CreateL1Partition(i, Key(0), &l1_manifest);
+    PersistL1Partition(l1_table);
+    db_root->shard[i]->l1_info = l1_manifest;
+    auto partitions = new PmemTableList::Partitions();
+    partitions->begin_keys.push_back(Key(0));
+    partitions->tables.push_back(l1_table);
+    l1_tl->SetPartitions(partitions);
   }
 #endif
 
-  bg_thread_ = std::thread(std::bind(&ListDB::BackgroundThreadLoop, this));
-
-  for (int i = 0; i < kNumWorkers; i++) {
-    worker_data_[i].id = i;
-    worker_data_[i].stop = false;
-    worker_threads_[i] = std::thread(std::bind(&ListDB::CompactionWorkerThreadLoop, this, &worker_data_[i]));
-
-    //sched_param sch;
-    //int policy; 
-    //pthread_getschedparam(worker_threads_[i].native_handle(), &policy, &sch);
-    //sch.sched_priority = 20;
-    //pthread_setschedparam(worker_threads_[i].native_handle(), SCHED_FIFO, &sch);
-  }
+  InitCaches();
+  StartBackgroundThreads();
+  StartLogPrefaulters();
 }
 
 void ListDB::Open() {
-  std::string db_path = "/pmem/wkim/listdb";
-  int root_pool_id = Pmem::BindPool<pmem_db>(db_path, "", 64*1024*1024);
+  Open(Options());
+}
+
+void ListDB::Open(const Options& options) {
+  options_ = options;
+  CheckOptions();
+  if (options_.backend != Pmem::backend()) {
+    Pmem::SetBackend(options_.backend);
+  }
+  Persist::SetMode(options_.persist_mode);
+  Pmem::SetPoolAlignment(options_.pool_alignment);
+  l1_partition_split_size_ = 16 * options_.memtable_capacity / kNumShards;
+  min_shard_memtable_capacity_ = options_.memtable_capacity / kNumShards / 4;
+  max_shard_memtable_capacity_ = options_.memtable_capacity / 4;
+  std::string db_path = Pmem::Path(options_.db_path);
+  Pmem::CheckLayout(db_path, kDbPoolLayout);
+  int root_pool_id = Pmem::BindPool<pmem_db>(db_path, kDbPoolLayout, options_.db_pool_size);
   if (root_pool_id != 0) {
     std::cerr << "root_pool_id must be zero (current: " << root_pool_id << ")\n";
     exit(1);
   }
-  auto db_pool = Pmem::pool<pmem_db>(root_pool_id);
-  auto db_root = db_pool.root();
 
   // Log Pmem Pool
   for (int i = 0; i < kNumRegions; i++) {
-    std::stringstream pss;
-    pss << "/pmem" << i << "/wkim/listdb_log";
-    std::string path = pss.str();
-    std::string poolset = path + ".set";
+    std::string poolset = RegionDir(i) + "/listdb_log.set";
 
-    int pool_id = Pmem::BindPoolSet<pmem_log_root>(poolset, "");
+    Pmem::CheckLayout(poolset, kLogPoolLayout);
+    int pool_id = Pmem::BindPoolSet<pmem_log_root>(poolset, kLogPoolLayout);
     pool_id_to_region_[pool_id] = i;
     //auto pool = Pmem::pool<pmem_log_root>(pool_id);
     l0_pool_id_[i] = pool_id;
 
     for (int j = 0; j < kNumShards; j++) {
       log_[i][j] = new PmemLog(pool_id, j);
+      log_[i][j]->BindEpochManager(&epoch_);
     }
   }
 #ifndef LISTDB_WAL
@@ -530,10 +841,7 @@ void ListDB::Open() {
 
 #ifdef LISTDB_WISCKEY
   for (int i = 0; i < kNumRegions; i++) {
-    std::stringstream pss;
-    pss << "/pmem" << i << "/wkim/listdb_value";
-    std::string path = pss.str();
-    std::string poolset = path + ".set";
+    std::string poolset = RegionDir(i) + "/listdb_value.set";
 
     int pool_id = Pmem::BindPoolSet<pmem_blob_root>(poolset, "");
     pool_id_to_region_[pool_id] = i;
@@ -545,25 +853,28 @@ void ListDB::Open() {
   }
 #endif
 
-#ifdef L1_COW
-  std::cerr << "Open() for L0 CoW compaction is not implemented." << std:endl;
-  exit(1);
-#else
+  // L1 nodes of CoW compaction
+  if (fs::exists(RegionDir(0) + "/listdb_l1.set")) {
+    BindCowArenas();
+  }
   for (int i = 0; i < kNumRegions; i++) {
     for (int j = 0; j < kNumShards; j++) {
       l1_arena_[i][j] = l0_arena_[i][j];
     }
   }
-#endif
   for (int i = 0; i < kNumRegions; i++) {
     l1_pool_id_[i] = l1_arena_[i][0]->pool_id();
   }
+  if (options_.prefault) {
+    PrefaultLogs();
+  }
 
   for (int i = 0; i < kNumShards; i++) {
     ll_[i] = new LevelList();
     // MemTableList
     {
-      auto tl = new MemTableList(kMemTableCapacity / kNumShards, i);
+      auto tl = new MemTableList(options_.memtable_capacity / kNumShards, i);
+      tl->SetMaxNumMemTables(options_.max_num_memtables);
       tl->BindEnqueueFunction([&, tl, i](MemTable* mem) {
         //fprintf(stdout, "binded enq fn, mem = %p\n", mem);
         auto task = new MemTableFlushTask();
@@ -571,14 +882,13 @@ void ListDB::Open() {
         task->shard = i;
         task->imm = mem;
         task->memtable_list = tl;
-        std::unique_lock<std::mutex> lk(wq_mu_);
-        work_request_queue_.push_back(task);
-        lk.unlock();
-        wq_cv_.notify_one();
+        scheduler_.Push(task, mem->home_region(), Scheduler::kHigh);
+        UpdateWriteController(i);
       });
       for (int j = 0; j < kNumRegions; j++) {
         tl->BindArena(j, l0_arena_[j][i]);
       }
+      tl->BindEpochManager(&epoch_);
       ll_[i]->SetTableList(0, tl);
     }
 
@@ -588,19 +898,11 @@ void ListDB::Open() {
       for (int j = 0; j < kNumRegions; j++) {
         tl->BindArena(l1_arena_[j][i]->pool_id(), l1_arena_[j][i]);
       }
+      tl->BindEpochManager(&epoch_);
       ll_[i]->SetTableList(1, tl);
     }
   }
 
-  std::atomic<int> memtable_recovery_cnt_total = 0;
-  std::atomic<int> l0_recovery_cnt_total = 0;
-  std::atomic<int> l0_persisted_cnt_total = 0;
-  std::atomic<int> merge_done_cnt_total = 0;
-  std::atomic<int> l1_recovery_cnt_total = 0;
-  std::atomic<size_t> mem_insert_cnt_total = 0;
-  std::atomic<size_t> l0_insert_cnt_total = 0;
-
-  auto recovery_begin_tp = std::chrono::steady_clock::now();
   // read l1 info
   // read l0 info
   // check the status
@@ -608,318 +910,945 @@ void ListDB::Open() {
   //  - recover as memtable
   //  - recover as L0
   //  - recover as L1
+  recovery_stats_.begin_tp = std::chrono::steady_clock::now();
+  // Recovered shards restore their caches from it
+  cache_snapshot_.reset(new CacheSnapshot());
+  if (!cache_snapshot_->Open(CacheSnapshotPath(), CacheSnapshotConfig())) {
+    cache_snapshot_.reset();
+  }
+  num_pending_recovery_shards_.store(kNumShards);
+  recovery_queue_.reset(new TaskScheduler<RecoveryTask>(kNumRegions));
+  for (int i = 0; i < kNumShards; i++) {
+    shard_recovery_[i].reset(new ShardRecovery());
+    shard_recovery_state_[i].store(RecoveryState::kPending);
+    shard_bg_state_[i].store(4);
+    recovery_queue_->Push(new RecoveryTask{i, -1}, i % kNumRegions, TaskScheduler<RecoveryTask>::kNormal);
+  }
+  if (!Numa::is_initialized()) {
+    Numa::Init();
+  }
 
-  // TODO(wkim): Parallel execution.
-  std::vector<std::thread> recovery_workers;
-  static const int kNumRecoveryThreads = kNumShards;
-  for (int wid = 0; wid < kNumRecoveryThreads; wid++) {
-    recovery_workers.push_back(std::thread([&, wid] {
-      int memtable_recovery_cnt = 0;
-      int l0_recovery_cnt = 0;
-      int l0_persisted_cnt = 0;
-      int merge_done_cnt = 0;
-      int l1_recovery_cnt = 0;
-      size_t mem_insert_cnt = 0;
-      size_t l0_insert_cnt = 0;
-      int shard_begin = (kNumShards / kNumRecoveryThreads) * wid;
-      int shard_end = (kNumShards / kNumRecoveryThreads) * (wid + 1);
-      for (int i = shard_begin ; i < shard_end; i++) {
-        auto shard = db_root->shard[i];
-
-        // read l1 info
-        auto l1_info = shard->l1_info;
-        if (l1_info) {
-          l1_recovery_cnt++;
-          // Prepare L1 SkipList
-          auto l1_skiplist = new BraidedPmemSkipList(l1_arena_[0][0]->pool_id());
-          for (int j = 0; j < kNumRegions; j++) {
-            int pool_id = l1_pool_id_[j];
-            l1_skiplist->BindArena(pool_id, l1_arena_[j][i]);
-            l1_skiplist->BindHead(pool_id, (void*) l1_info->head[j].get());
-          }
-          auto l1_table = new PmemTable(std::numeric_limits<size_t>::max(), l1_skiplist);
-          //l1_table->SetSize(kMemTableCapacity);
-          auto l1_tl = ll_[i]->GetTableList(1);
-          l1_tl->SetFront(l1_table);
-        }
-
-        auto memtable_list = GetTableList<MemTableList>(0, i);
-        // L0 list
-        // Initial -> Persist -> Persist -> ... -> Merging -> Merged -> Merged -> ...
-        auto pred_l0_info = shard->l0_list_head;
-        auto curr_l0_info = pred_l0_info->next;
-        std::deque<pmem::obj::persistent_ptr<pmem_l0_info>> l0_manifests;
-        uint64_t min_l0_id = std::numeric_limits<uint64_t>::max();
-        while (curr_l0_info) {
-          if (curr_l0_info->status == Level0Status::kMergeDone) {
-            merge_done_cnt++;
-            for (int j = 0; j < kNumRegions; j++) {
-              size_t head_node_size = sizeof(PmemNode) + (kMaxHeight - 1) * sizeof(uint64_t);
-              pmem::obj::delete_persistent_atomic<char[]>(curr_l0_info->head[j], head_node_size);
-            }
-            auto succ_l0_info = curr_l0_info->next;
-            // TODO(wkim): do the followings as a transaction
-            pred_l0_info->next = succ_l0_info;
-            pmem::obj::delete_persistent_atomic<pmem_l0_info>(curr_l0_info);
-            curr_l0_info = succ_l0_info;
-            continue;
-          }
-          min_l0_id = curr_l0_info->id;
-          l0_manifests.push_front(curr_l0_info);
-          curr_l0_info = curr_l0_info->next;
-        }
-
-        // Collect log blocks
-        std::deque<pmem::obj::persistent_ptr<pmem_log_block>> log_blocks[kNumRegions];
-        for (int j = 0; j < kNumRegions; j++) {
-          //int pool_id = log_[j][i]->pool_id();
-          auto pool = log_[j][i]->pool();
-          auto log_shard = pool.root()->shard[i];
-          //curr_log_block[j] = log_shard->head;
-          //cursor[j].p_block = log_shard->head;
-          //cursor[j].data = cursor[j].p_block->data;
-          auto curr_block = log_shard->head;
-          while (curr_block) {
-            PmemNode* first_record = (PmemNode*) curr_block->data;
-            log_blocks[j].push_front(curr_block);
-            if (first_record->l0_id() < min_l0_id) {
-              break;
-            }
-            curr_block = curr_block->next;
-          }
-        }
-        // Init log cursor
-        struct LogCursor {
-          char* data = nullptr;
-          uint64_t offset = 0;
-          std::deque<pmem::obj::persistent_ptr<pmem_log_block>>::iterator block_iter;
-          //pmem::obj::persistent_ptr<pmem_log_block> p_block = nullptr;
-
-          char* p() { return data + offset; }
-        } cursor[kNumRegions];
-        for (int j = 0; j < kNumRegions; j++) {
-          cursor[j].block_iter = log_blocks[j].begin();
-          cursor[j].data = (*(cursor[j].block_iter))->data;
-        }
-
-        std::deque<Table*> tables;
-        // l0_manifests: oldest to newest
-        for (auto& l0 : l0_manifests) {
-          // Prepare L0 SkipList
-          auto l0_skiplist = new BraidedPmemSkipList(l0_arena_[0][0]->pool_id());
-          for (int j = 0; j < kNumRegions; j++) {
-            int pool_id = l0_arena_[j][i]->pool_id();
-            int region = pool_id_to_region_[pool_id];
-            l0_skiplist->BindArena(pool_id, l0_arena_[j][i]);
-            l0_skiplist->BindHead(pool_id, (void*) l0->head[region].get());
-          }
-
-          if (l0->status == Level0Status::kMergeInitiated) {
-            fprintf(stdout, "Level0Status::kMergeInitiated.\n");
-            exit(1);
-            // TODO(wkim): Continue and finish L0 to L1 compaction
-          } else if (l0->status == Level0Status::kPersisted) {
-            l0_persisted_cnt++;
-            auto l0_table = new PmemTable(kMemTableCapacity, l0_skiplist);
-            l0_table->SetSize(kMemTableCapacity);
-            //memtable_list->PushFront(l0_table);
-            tables.push_back((Table*) l0_table);
-          } else if (l0->status == Level0Status::kFull) {
-            l0_recovery_cnt++;
-            // Reset L0 skiplist
-            for (int j = 0; j < kNumRegions; j++) {
-              int pool_id = log_[j][i]->pool_id();
-              auto p_head = l0_skiplist->head(pool_id);
-              for (int k = 0; k < kMaxHeight; k++) {
-                p_head->next[k] = 0;
-              }
-            }
-
-            // Replay Log
-            for (int j = 0; j < kNumRegions; j++) {
-              int pool_id = log_[j][i]->pool_id();
-              auto pool = log_[j][i]->pool();
-              //auto log_shard = pool.root()->shard[i];
-
-              bool current_table_done = false;
-              while (cursor[j].block_iter != log_blocks[j].end()) {
-                while (cursor[j].offset < kPmemLogBlockSize - 7) {
-                  char* p = cursor[j].p();
-                  PmemNode* p_node = (PmemNode*) p;
-                  if (!p_node->key.Valid()) {
-                    break;
-                  }
-        //fprintf(stdout, "key: %s,%zu\nheight=%d\nl0_id=%u/%lu\nvalue=%zu\n", std::string(p_node->key.data(), 8).c_str(), *((uint64_t*) &p_node->key), p_node->height(), p_node->l0_id(), l0->id, p_node->value);
-                  if (p_node->l0_id() > l0->id) {
-                    current_table_done = true;
-                    break;
-                  }
-                  if (p_node->l0_id() == l0->id) {
-                    // DO REPLAY
-                    PmemPtr node_paddr(pool_id, (uint64_t) ((uintptr_t) p - (uintptr_t) pool.handle()));
-                    l0_skiplist->Insert(node_paddr);
-                    l0_insert_cnt++;
-                  }
-                  int height = p_node->height();
-                  size_t iul_entry_size = sizeof(PmemNode) + (height - 1) * sizeof(uint64_t);
-                  cursor[j].offset += iul_entry_size;
-                }
-                if (current_table_done)  {
-                  break;
-                }
-                ++cursor[j].block_iter;
-                if (cursor[j].block_iter != log_blocks[j].end()) {
-                  cursor[j].data = (*(cursor[j].block_iter))->data;
-                  cursor[j].offset = 0;
-                }
-              }
-            }
-
-            auto l0_table = new PmemTable(kMemTableCapacity, l0_skiplist);
-            l0_table->SetSize(kMemTableCapacity);
-            //memtable_list->PushFront(l0_table);
-            tables.push_back((Table*) l0_table);
-          } else if (l0->status == Level0Status::kInitialized) {
-            memtable_recovery_cnt++;
-            // Reset L0 skiplist
-            for (int j = 0; j < kNumRegions; j++) {
-              int pool_id = log_[j][i]->pool_id();
-              auto p_head = l0_skiplist->head(pool_id);
-              for (int k = 0; k < kMaxHeight; k++) {
-                p_head->next[k] = 0;
-              }
-            }
-
-            // Init MemTable SkipList
-            auto memtable = new MemTable(kMemTableCapacity);
-            memtable->SetL0SkipList(l0_skiplist);
-            auto skiplist = memtable->skiplist();
-            size_t kv_size_total = 0;
-
-            // Replay Log
-            for (int j = 0; j < kNumRegions; j++) {
-              int pool_id = log_[j][i]->pool_id();
-              auto pool = log_[j][i]->pool();
-              //auto log_shard = pool.root()->shard[i];
-
-              bool current_table_done = false;
-              while (cursor[j].block_iter != log_blocks[j].end()) {
-                while (cursor[j].offset < kPmemLogBlockSize - 7) {
-                  char* p = cursor[j].p();
-                  PmemNode* p_node = (PmemNode*) p;
-                  if (!p_node->key.Valid()) {
-                    break;
-                  }
-        //fprintf(stdout, "key: %s,%zu\nheight=%d\nl0_id=%u/%lu\nvalue=%zu\n", std::string(p_node->key.data(), 8).c_str(), *((uint64_t*) &p_node->key), p_node->height(), p_node->l0_id(), l0->id, p_node->value);
-                  if (p_node->l0_id() > l0->id) {
-                    current_table_done = true;
-                    break;
-                  }
-                  int height = p_node->height();
-                  if (p_node->l0_id() == l0->id) {
-                    // DO REPLAY
-                    PmemPtr log_paddr(pool_id, (uint64_t) ((uintptr_t) p - (uintptr_t) pool.handle()));
-
-                    // Create skiplist node
-                    MemNode* node = (MemNode*) malloc(sizeof(MemNode) + (height - 1) * sizeof(uint64_t));
-                    node->key = p_node->key;
-                    node->tag = height;
-                    node->value = log_paddr.dump();
-                    memset((void*) &node->next[0], 0, height * sizeof(uint64_t));
-
-                    kv_size_total += node->key.size() + sizeof(Value);
-
-                    skiplist->Insert(node);
-                    mem_insert_cnt++;
-                  }
-                  size_t iul_entry_size = sizeof(PmemNode) + (height - 1) * sizeof(uint64_t);
-                  cursor[j].offset += iul_entry_size;
-                }
-                if (current_table_done)  {
-                  break;
-                }
-                ++cursor[j].block_iter;
-                if (cursor[j].block_iter != log_blocks[j].end()) {
-                  cursor[j].data = (*(cursor[j].block_iter))->data;
-                  cursor[j].offset = 0;
-                }
-              }
-            }
-            memtable->SetSize(kv_size_total);
-            //memtable_list->PushFront(memtable);
-            tables.push_back((Table*) memtable);
-          } else {
-            std::cerr << "Unknown L0 status.\n";
-            exit(1);
-          }
-
-        }
-
-        // Build a MemTable List for this shard with individually initialized tables
-        // tables: oldest to newest
-        for (size_t i = 0; i < tables.size(); i++) {
-          if (i > 0) {
-           tables[i]->SetNext(tables[i - 1]);
-          }
-          memtable_list->PushFront(tables[i]);
-        }
-
-      }
-
-      memtable_recovery_cnt_total.fetch_add(memtable_recovery_cnt);
-      l0_recovery_cnt_total.fetch_add(l0_recovery_cnt);
-      l0_persisted_cnt_total.fetch_add(l0_persisted_cnt);
-      merge_done_cnt_total.fetch_add(merge_done_cnt);
-      l1_recovery_cnt_total.fetch_add(l1_recovery_cnt);
-      mem_insert_cnt_total.fetch_add(mem_insert_cnt);
-      l0_insert_cnt_total.fetch_add(l0_insert_cnt);
-    }));
+  InitCaches();
+  if (!lazy_recovery_) {
+    // A fixed pool sized to the cores. Every thread serves the queue of the
+    // region it runs on and steals from the others.
+    int num_threads = std::max<int>(1, std::min<int>(std::thread::hardware_concurrency(), kNumShards * kNumRegions));
+    for (int i = 0; i < num_threads; i++) {
+      recovery_workers_.emplace_back(&ListDB::RecoveryThreadLoop, this, i % kNumRegions);
+    }
+    for (auto& rw : recovery_workers_) {
+      rw.join();
+    }
+    recovery_workers_.clear();
+    StartBackgroundThreads();
+  } else {
+    // Clients recover the shards they touch; one sweeper per region does
+    // the rest
+    StartBackgroundThreads();
+    for (int i = 0; i < kNumRegions; i++) {
+      recovery_workers_.emplace_back(&ListDB::RecoveryThreadLoop, this, i);
+    }
   }
-  for (auto& rw : recovery_workers) {
-    if (rw.joinable()) rw.join();
+#if defined(LISTDB_L0_CACHE) && LISTDB_L0_CACHE != L0_CACHE_T_SIMPLE
+  for (int i = 0; i < kNumRegions; i++) {
+    cache_warmers_.emplace_back(&ListDB::CacheWarmerThreadLoop, this, i);
   }
-  auto recovery_end_tp = std::chrono::steady_clock::now();
-  std::chrono::duration<double> recovery_duration = recovery_end_tp - recovery_begin_tp;
-  fprintf(stdout, "recovery time : %.3lf sec\n", recovery_duration.count());
-  fprintf(stdout, "recovery count:\n");
-  fprintf(stdout, "  -     memtable: %d\n", memtable_recovery_cnt_total.load());
-  fprintf(stdout, "  -           l0: %d\n", l0_recovery_cnt_total.load());
-  fprintf(stdout, "  - persisted l0: %d\n", l0_persisted_cnt_total.load());
-  fprintf(stdout, "  -           l1: %d\n", l1_recovery_cnt_total.load());
-  fprintf(stdout, "  -    merged l0: %d\n", merge_done_cnt_total.load());
-  fprintf(stdout, "mem insert cnt: %zu\n", mem_insert_cnt_total.load());
-  fprintf(stdout, " l0 insert cnt: %zu\n", l0_insert_cnt_total.load());
+#endif
+  StartLogPrefaulters();
 }
 
-void ListDB::Close() {
-  stop_ = true;
-  if (bg_thread_.joinable()) {
-    bg_thread_.join();
+// Reads the manifests of the shard and sets up the tables to rebuild from
+// the log
+void ListDB::RecoverShard(int i) {
+  auto sr = shard_recovery_[i].get();
+  auto db_root = Pmem::pool<pmem_db>(0).root();
+  auto shard = db_root->shard[i];
+  compaction_mode_[i].store(shard->compaction_mode);
+
+  // read l1 info
+  auto l1_info = shard->l1_info;
+  if (l1_info) {
+    recovery_stats_.l1_cnt++;
+    auto partitions = new PmemTableList::Partitions();
+    while (l1_info) {
+      // Prepare L1 SkipList
+      auto l1_skiplist = new BraidedPmemSkipList(l1_arena_[0][0]->pool_id());
+      for (int j = 0; j < kNumRegions; j++) {
+        int pool_id = l1_pool_id_[j];
+        l1_skiplist->BindArena(pool_id, l1_arena_[j][i]);
+        l1_skiplist->BindHead(pool_id, (void*) l1_info->head[j].get());
+      }
+      auto l1_table = new PmemTable(std::numeric_limits<size_t>::max(), l1_skiplist);
+      l1_table->SetSize(l1_info->size);
+      l1_table->SetManifest(l1_info);
+      partitions->begin_keys.push_back(*((Key*) l1_info->begin_key));
+      partitions->tables.push_back(l1_table);
+      l1_info = l1_info->next;
+    }
+    // Redo the tail cuts of the splits done before the crash
+    for (size_t k = 0; k + 1 < partitions->tables.size(); k++) {
+      CutL1Partition(partitions->tables[k]->skiplist(), partitions->begin_keys[k + 1]);
+    }
+    auto l1_tl = GetTableList<PmemTableList>(1, i);
+    l1_tl->SetPartitions(partitions);
   }
 
-  for (int i = 0; i < kNumWorkers; i++) {
-    worker_data_[i].stop = true;
-    worker_data_[i].cv.notify_one();
-    if (worker_threads_[i].joinable()) {
-      worker_threads_[i].join();
+  // L0 list
+  // Initial -> Persist -> Persist -> ... -> Merging -> Merged -> Merged -> ...
+  auto pred_l0_info = shard->l0_list_head;
+  auto curr_l0_info = pred_l0_info->next;
+  std::deque<pmem::obj::persistent_ptr<pmem_l0_info>> l0_manifests;
+  uint64_t min_l0_id = std::numeric_limits<uint64_t>::max();
+  while (curr_l0_info) {
+    if (curr_l0_info->status == Level0Status::kMergeDone) {
+      recovery_stats_.merge_done_cnt++;
+      for (int j = 0; j < kNumRegions; j++) {
+        size_t head_node_size = sizeof(PmemNode) + (kMaxHeight - 1) * sizeof(uint64_t);
+        pmem::obj::delete_persistent_atomic<char[]>(curr_l0_info->head[j], head_node_size);
+      }
+      FreeZipperProgress(curr_l0_info);
+      auto succ_l0_info = curr_l0_info->next;
+      // TODO(wkim): do the followings as a transaction
+      pred_l0_info->next = succ_l0_info;
+      pmem::obj::delete_persistent_atomic<pmem_l0_info>(curr_l0_info);
+      curr_l0_info = succ_l0_info;
+      continue;
     }
+    l0_manifests.push_front(curr_l0_info);
+    curr_l0_info = curr_l0_info->next;
   }
 
+  // Settle the L0 tables being combined at the crash. A source whose
+  // target gets replayed from the log is replayed and combined again.
   {
-    std::lock_guard<std::mutex> lk(mu_);
-    auto reporter = reporter_.load();
-    if (reporter != nullptr) {
-      delete reporter_;
+    std::deque<pmem::obj::persistent_ptr<pmem_l0_info>> settled;
+    for (auto& l0 : l0_manifests) {
+      if (l0->status == Level0Status::kCombineInitiated) {
+        if (settled.empty()) {
+          fprintf(stderr, "No L0 table to combine into (l0_id=%lu).\n", l0->id);
+          exit(1);
+        }
+        auto target = settled.back();
+        if (l0->id <= target->id_end) {
+          l0->status = Level0Status::kMergeDone;
+          clwb(&l0->status, sizeof(Level0Status));
+          sfence();
+          continue;
+        }
+        if (target->status == Level0Status::kFull) {
+          l0->status = Level0Status::kFull;
+          clwb(&l0->status, sizeof(Level0Status));
+          sfence();
+        }
+      }
+      settled.push_back(l0);
     }
+    l0_manifests.swap(settled);
   }
 
-  // Save log cursor info
-  for (int i = 0; i < kNumShards; i++) {
-    for (int j = 0; j < kNumRegions; j++) {
-      delete log_[j][i];
+  // Only the tables not persisted before the crash are replayed, so the
+  // log is read from the oldest of them
+  for (auto& l0 : l0_manifests) {
+    if (l0->status == Level0Status::kFull || l0->status == Level0Status::kInitialized ||
+        l0->status == Level0Status::kL1FlushInitiated) {
+      min_l0_id = l0->id;
+      break;
     }
   }
 
+  // Collect log blocks
+  for (int j = 0; j < kNumRegions; j++) {
+    auto pool = log_[j][i]->pool();
+    auto log_shard = pool.root()->shard[i];
+    auto curr_block = log_shard->head;
+    while (curr_block) {
+      PmemNode* first_record = (PmemNode*) curr_block->data;
+      sr->log_blocks[j].push_front(curr_block);
+      if (first_record->l0_id() < min_l0_id) {
+        break;
+      }
+      curr_block = curr_block->next;
+    }
+  }
+
+  // l0_manifests: oldest to newest
+  for (auto& l0 : l0_manifests) {
+    // Prepare L0 SkipList
+    auto l0_skiplist = new BraidedPmemSkipList(l0_arena_[0][0]->pool_id());
+    for (int j = 0; j < kNumRegions; j++) {
+      int pool_id = l0_arena_[j][i]->pool_id();
+      int region = pool_id_to_region_[pool_id];
+      l0_skiplist->BindArena(pool_id, l0_arena_[j][i]);
+      l0_skiplist->BindHead(pool_id, (void*) l0->head[region].get());
+    }
+
+    if (l0->status == Level0Status::kCombineInitiated) {
+      // The unmerged part is bounded by the persisted cursor
+      auto target = (PmemTable*) sr->tables.back();
+      auto target_manifest = target->manifest<pmem_l0_info>();
+      ResumeZipperMerge(i, l0, [&](const Key&) { return target; });
+      target_manifest->id_end = l0->id_end;
+      clwb(&target_manifest->id_end, 8);
+      sfence();
+      l0->status = Level0Status::kMergeDone;
+      clwb(&l0->status, sizeof(Level0Status));
+      sfence();
+      recovery_stats_.merge_done_cnt++;
+      delete l0_skiplist;
+    } else if (l0->status == Level0Status::kMergeInitiated ||
+               l0->status == Level0Status::kPersisted) {
+      // A merge is finished by the first compaction after Open()
+      if (l0->status == Level0Status::kMergeInitiated) {
+        recovery_stats_.l0_merging_cnt++;
+      } else {
+        recovery_stats_.l0_persisted_cnt++;
+      }
+      auto l0_table = new PmemTable(options_.memtable_capacity, l0_skiplist);
+      l0_table->SetSize(options_.memtable_capacity);
+      l0_table->SetManifest(l0);
+      sr->tables.push_back((Table*) l0_table);
+    } else if (l0->status == Level0Status::kFull ||
+               l0->status == Level0Status::kInitialized ||
+               l0->status == Level0Status::kL1FlushInitiated) {
+      // Reset L0 skiplist
+      for (int j = 0; j < kNumRegions; j++) {
+        int pool_id = log_[j][i]->pool_id();
+        auto p_head = l0_skiplist->head(pool_id);
+        for (int k = 0; k < kMaxHeight; k++) {
+          p_head->next[k] = 0;
+        }
+      }
+      auto target = new ReplayTarget();
+      target->l0 = l0;
+      if (l0->status == Level0Status::kFull) {
+        recovery_stats_.l0_cnt++;
+        target->l0_skiplist = l0_skiplist;
+        auto l0_table = new PmemTable(options_.memtable_capacity, l0_skiplist);
+        l0_table->SetSize(options_.memtable_capacity);
+        l0_table->SetManifest(l0);
+        sr->tables.push_back((Table*) l0_table);
+      } else {
+        // A flush to L1 is redone from the memtable
+        recovery_stats_.memtable_cnt++;
+        auto memtable = new MemTable(options_.memtable_capacity);
+        memtable->SetL0SkipList(l0_skiplist);
+        memtable->SetL0Manifest(l0);
+        target->memtable = memtable;
+        sr->tables.push_back((Table*) memtable);
+        if (l0->status == Level0Status::kL1FlushInitiated) {
+          sr->l1_flush_redo = memtable;
+        }
+      }
+      sr->targets.emplace_back(target);
+    } else {
+      std::cerr << "Unknown L0 status.\n";
+      exit(1);
+    }
+  }
+}
+
+// Replays the log of a region into every table of the shard that needs it.
+// The log is in L0 id order, so one pass serves all of them.
+void ListDB::ReplayLogRegion(int i, int j) {
+  auto sr = shard_recovery_[i].get();
+  auto& log_blocks = sr->log_blocks[j];
+  if (log_blocks.empty()) {
+    return;
+  }
+  int pool_id = log_[j][i]->pool_id();
+  auto pool = log_[j][i]->pool();
+  auto block_iter = log_blocks.begin();
+  char* data = (*block_iter)->data;
+  uint64_t offset = 0;
+  size_t mem_insert_cnt = 0;
+  size_t l0_insert_cnt = 0;
+  for (auto& target : sr->targets) {
+    auto l0 = target->l0;
+    // Entries of a memtable carry its own id only
+    uint64_t id_end = (target->memtable) ? l0->id : l0->id_end;
+    size_t kv_size = 0;
+    bool current_table_done = false;
+    while (block_iter != log_blocks.end()) {
+      while (offset < kPmemLogBlockSize - 7) {
+        char* p = data + offset;
+        PmemNode* p_node = (PmemNode*) p;
+        if (!p_node->key.Valid()) {
+          break;
+        }
+        if (p_node->l0_id() > id_end) {
+          current_table_done = true;
+          break;
+        }
+        int height = p_node->height();
+        if (p_node->l0_id() >= l0->id) {
+          // DO REPLAY
+          PmemPtr node_paddr(pool_id, (uint64_t) ((uintptr_t) p - (uintptr_t) pool.handle()));
+#ifndef LISTDB_RECOVERY_INSERT
+          target->entries[j].push_back(ReplayEntry{p_node->key.key_num(), node_paddr.dump(), p_node->l0_id()});
+          if (target->l0_skiplist) {
+            l0_insert_cnt++;
+          } else {
+            kv_size += p_node->key.size() + sizeof(Value);
+            mem_insert_cnt++;
+          }
+#else
+          if (target->l0_skiplist) {
+            target->l0_skiplist->Insert(node_paddr);
+            l0_insert_cnt++;
+          } else {
+            // Create skiplist node
+            MemNode* node = (MemNode*) malloc(sizeof(MemNode) + (height - 1) * sizeof(uint64_t));
+            node->key = p_node->key;
+            node->tag = height;
+            node->value = node_paddr.dump();
+            memset((void*) &node->next[0], 0, height * sizeof(uint64_t));
+            kv_size += node->key.size() + sizeof(Value);
+            target->memtable->skiplist()->Insert(node);
+            mem_insert_cnt++;
+          }
+#endif
+        }
+        size_t iul_entry_size = sizeof(PmemNode) + (height - 1) * sizeof(uint64_t);
+        offset += iul_entry_size;
+      }
+      if (current_table_done) {
+        break;
+      }
+      ++block_iter;
+      if (block_iter != log_blocks.end()) {
+        data = (*block_iter)->data;
+        offset = 0;
+      }
+    }
+    target->kv_size.fetch_add(kv_size);
+  }
+  recovery_stats_.mem_insert_cnt.fetch_add(mem_insert_cnt);
+  recovery_stats_.l0_insert_cnt.fetch_add(l0_insert_cnt);
+}
+
+// Builds a replayed table from its log entries sorted by key. The towers are
+// linked bottom-up in one pass from the last node of every level, with no
+// search and no CAS. A rebuilt L0 table is persisted so that it is not
+// replayed again.
+void ListDB::BuildReplayTarget(int shard, ReplayTarget* target) {
+  std::vector<ReplayEntry> entries;
+  size_t n = 0;
+  for (int j = 0; j < kNumRegions; j++) {
+    n += target->entries[j].size();
+  }
+  entries.reserve(n);
+  // Newer versions of a key go first: newest first within a region, then
+  // the newer L0 id first across the regions
+  for (int j = 0; j < kNumRegions; j++) {
+    auto& region_entries = target->entries[j];
+    entries.insert(entries.end(), region_entries.rbegin(), region_entries.rend());
+    std::vector<ReplayEntry>().swap(region_entries);
+  }
+  // Single-threaded: the recovery workers already build the shards in
+  // parallel, and a thread per sort pass would only oversubscribe them
+  RadixSort(entries.data(), n, [](const ReplayEntry& e) { return (uint64_t) ~e.l0_id; });
+  RadixSort(entries.data(), n, [](const ReplayEntry& e) { return e.key_num; });
+#ifdef LISTDB_STRING_KEY
+  // key_num() orders the first 8 bytes only
+  auto key_less = [](const ReplayEntry& a, const ReplayEntry& b) {
+    PmemNode* a_node = (PmemNode*) PmemPtr(a.paddr).get();
+    PmemNode* b_node = (PmemNode*) PmemPtr(b.paddr).get();
+    return a_node->key.Compare(b_node->key) < 0;
+  };
+  size_t run_begin = 0;
+  for (size_t k = 1; k <= n; k++) {
+    if (k == n || entries[k].key_num != entries[run_begin].key_num) {
+      if (k - run_begin > 1) {
+        std::stable_sort(entries.begin() + run_begin, entries.begin() + k, key_less);
+      }
+      run_begin = k;
+    }
+  }
+#endif
+
+  if (target->memtable) {
+    auto skiplist = target->memtable->skiplist();
+    MemNode* preds[kMaxHeight];
+    for (int l = 0; l < kMaxHeight; l++) {
+      preds[l] = skiplist->head();
+    }
+    for (auto& e : entries) {
+      PmemNode* p_node = (PmemNode*) PmemPtr(e.paddr).get();
+      int height = p_node->height();
+      MemNode* node = (MemNode*) malloc(sizeof(MemNode) + (height - 1) * sizeof(uint64_t));
+      node->key = p_node->key;
+      node->tag = height;
+      node->value = e.paddr;
+      for (int l = 0; l < height; l++) {
+        node->next[l].store(nullptr, MO_RELAXED);
+        preds[l]->next[l].store(node, MO_RELAXED);
+        preds[l] = node;
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    return;
+  }
+
+  // Upper levels are linked within the region of the node, level 0 across
+  // all of them
+  auto skiplist = target->l0_skiplist;
+  PmemNode* preds[kNumRegions][kMaxHeight];
+  for (int j = 0; j < kNumRegions; j++) {
+    int pool_id = log_[j][shard]->pool_id();
+    int region = pool_id_to_region_[pool_id];
+    for (int l = 0; l < kMaxHeight; l++) {
+      preds[region][l] = skiplist->head(pool_id);
+    }
+  }
+  PmemNode* pred = skiplist->head();
+  for (auto& e : entries) {
+    PmemPtr node_paddr(e.paddr);
+    PmemNode* node = (PmemNode*) node_paddr.get();
+    auto region_preds = preds[pool_id_to_region_[node_paddr.pool_id()]];
+    pred->next[0] = e.paddr;
+    clwb(&pred->next[0], 8);
+    pred = node;
+    for (int l = 1; l < node->height(); l++) {
+      region_preds[l]->next[l] = e.paddr;
+      clwb(&region_preds[l]->next[l], 8);
+      region_preds[l] = node;
+    }
+  }
+  pred->next[0] = 0;
+  clwb(&pred->next[0], 8);
+  for (int r = 0; r < kNumRegions; r++) {
+    for (int l = 1; l < kMaxHeight; l++) {
+      preds[r][l]->next[l] = 0;
+      clwb(&preds[r][l]->next[l], 8);
+    }
+  }
+  sfence();
+  target->l0->status = Level0Status::kPersisted;
+  clwb(&target->l0->status, sizeof(Level0Status));
+  sfence();
+}
+
+// Links the table list of the shard and hands it to the clients and the
+// background work
+void ListDB::FinishShardRecovery(int shard) {
+  auto sr = shard_recovery_[shard].get();
+  for (auto& target : sr->targets) {
+#ifndef LISTDB_RECOVERY_INSERT
+    BuildReplayTarget(shard, target.get());
+#endif
+    if (target->memtable) {
+      target->memtable->SetSize(target->kv_size.load());
+    }
+  }
+  // Build a MemTable List for this shard with individually initialized tables
+  // tables: oldest to newest
+  auto memtable_list = GetTableList<MemTableList>(0, shard);
+  auto& tables = sr->tables;
+  for (size_t i = 0; i < tables.size(); i++) {
+    if (i > 0) {
+     tables[i]->SetNext(tables[i - 1]);
+    }
+    memtable_list->PushFront(tables[i]);
+  }
+  l0_cache_cold_[shard] = !LoadCacheSnapshot(shard);
+  // Interrupted merges are resumed first as they hold the oldest tables
+  if (sr->l1_flush_redo) {
+    auto task = new MemTableFlushTask();
+    task->type = TaskType::kMemTableFlush;
+    task->shard = shard;
+    task->imm = sr->l1_flush_redo;
+    task->memtable_list = memtable_list;
+    scheduler_.Push(task, shard % kNumRegions, Scheduler::kHigh);
+  }
+  shard_recovery_[shard].reset();
+  shard_bg_state_[shard].store(0);
+  {
+    std::lock_guard<std::mutex> lk(recovery_mu_);
+    shard_recovery_state_[shard].store(RecoveryState::kRecovered, std::memory_order_release);
+  }
+  recovery_cv_.notify_all();
+  UpdateWriteController(shard);
+  TryScheduleL0Compaction(shard);
+
+  if (num_pending_recovery_shards_.fetch_sub(1) > 1) {
+    return;
+  }
+  auto& st = recovery_stats_;
+  std::chrono::duration<double> recovery_duration = std::chrono::steady_clock::now() - st.begin_tp;
+  fprintf(stdout, "recovery time : %.3lf sec\n", recovery_duration.count());
+  fprintf(stdout, "recovery count:\n");
+  fprintf(stdout, "  -     memtable: %d\n", st.memtable_cnt.load());
+  fprintf(stdout, "  -           l0: %d\n", st.l0_cnt.load());
+  fprintf(stdout, "  - persisted l0: %d\n", st.l0_persisted_cnt.load());
+  fprintf(stdout, "  -   merging l0: %d\n", st.l0_merging_cnt.load());
+  fprintf(stdout, "  -           l1: %d\n", st.l1_cnt.load());
+  fprintf(stdout, "  -    merged l0: %d\n", st.merge_done_cnt.load());
+  fprintf(stdout, "mem insert cnt: %zu\n", st.mem_insert_cnt.load());
+  fprintf(stdout, " l0 insert cnt: %zu\n", st.l0_insert_cnt.load());
+  cache_snapshot_.reset();
+  recovery_queue_->Stop();
+}
+
+inline bool ListDB::ClaimShardRecovery(int shard) {
+  auto pending = RecoveryState::kPending;
+  return shard_recovery_state_[shard].compare_exchange_strong(pending, RecoveryState::kRecovering);
+}
+
+// A recovery pool thread. A shard unit reads the manifests and queues one log
+// replay unit per region of the shard, so the regions of a shard replay
+// concurrently. The last replay unit of a shard finishes it.
+void ListDB::RecoveryThreadLoop(int region) {
+  numa_run_on_node(region % Numa::num_sockets());
+  while (true) {
+    auto task = recovery_queue_->Pop(region);
+    if (task == nullptr) {
+      break;
+    }
+    int shard = task->shard;
+    if (task->region < 0) {
+      // Skipped if a client got there first
+      if (ClaimShardRecovery(shard)) {
+        RecoverShard(shard);
+        // Replays go first so that shards in flight finish
+        for (int j = 0; j < kNumRegions; j++) {
+          recovery_queue_->Push(new RecoveryTask{shard, j}, j, TaskScheduler<RecoveryTask>::kHigh);
+        }
+      }
+    } else {
+      ReplayLogRegion(shard, task->region);
+      if (shard_recovery_[shard]->num_pending_regions.fetch_sub(1) == 1) {
+        FinishShardRecovery(shard);
+      }
+    }
+    delete task;
+  }
+}
+
+inline void ListDB::WaitForShardRecovery(int shard) {
+  if (shard_recovery_state_[shard].load(std::memory_order_acquire) == RecoveryState::kRecovered) {
+    return;
+  }
+  if (ClaimShardRecovery(shard)) {
+    RecoverShard(shard);
+    for (int j = 0; j < kNumRegions; j++) {
+      ReplayLogRegion(shard, j);
+    }
+    FinishShardRecovery(shard);
+    return;
+  }
+  std::unique_lock<std::mutex> lk(recovery_mu_);
+  recovery_cv_.wait(lk, [&] { return shard_recovery_state_[shard].load() == RecoveryState::kRecovered; });
+}
+
+
+// Changes whenever a snapshot of this build could point to the wrong nodes
+// or buckets
+uint64_t ListDB::CacheSnapshotConfig() {
+  uint64_t h = 0xcbf29ce484222325ull;
+  auto mix = [&](uint64_t v) { h = (h ^ v) * 0x100000001b3ull; };
+  mix(kNumShards);
+  mix(kNumRegions);
+  mix(sizeof(Key));
+#ifdef LISTDB_L0_CACHE
+  mix(LISTDB_L0_CACHE);
+  mix(options_.ht_size);
+#endif
+#ifdef LISTDB_SKIPLIST_CACHE
+  mix(1);
+#endif
+#ifdef LISTDB_L1_LRU
+  mix(2);
+#endif
+#ifdef LISTDB_WISCKEY
+  mix(3);
+#endif
+  return h;
+}
+
+// Identifies the L0 and L1 tables of a shard. The tables recovery drops are
+// left out.
+uint64_t ListDB::ManifestFingerprint(int shard) {
+  auto shard_manifest = Pmem::pool<pmem_db>(0).root()->shard[shard];
+  uint64_t h = 0xcbf29ce484222325ull;
+  auto mix = [&](uint64_t v) { h = (h ^ v) * 0x100000001b3ull; };
+  for (auto l0 = shard_manifest->l0_list_head->next; l0; l0 = l0->next) {
+    if (l0->status == Level0Status::kMergeDone || l0->status == Level0Status::kCombineInitiated) {
+      continue;
+    }
+    mix(l0->id);
+    mix(l0->id_end);
+  }
+  mix(std::numeric_limits<uint64_t>::max());
+  for (auto l1 = shard_manifest->l1_info; l1; l1 = l1->next) {
+    mix(l1->id);
+  }
+  return h;
+}
+
+// Called by Close() once the background work is stopped
+void ListDB::SaveCacheSnapshot() {
+  std::vector<CacheSnapshot::SectionInfo> infos(kNumShards);
+  std::vector<std::vector<CacheSnapshot::Entry>> entries(kNumShards);
+  size_t num_entries = 0;
+  for (int i = 0; i < kNumShards; i++) {
+    auto& info = infos[i];
+    auto& shard_entries = entries[i];
+    info.fingerprint = ManifestFingerprint(i);
+    // The pool of a node is the nearest one below it
+    auto node_paddr = [&](PmemNode* node) {
+      int pool_id = -1;
+      uintptr_t pool_base = 0;
+      for (int j = 0; j < kNumRegions; j++) {
+        int cow_pool_id = cow_arena_bound_.load() ? cow_arena_[j][i]->pool_id() : -1;
+        for (int id : {l0_arena_[j][i]->pool_id(), cow_pool_id}) {
+          if (id < 0) {
+            continue;
+          }
+          uintptr_t base = Pmem::base_addr(id);
+          if (base <= (uintptr_t) node && base >= pool_base) {
+            pool_base = base;
+            pool_id = id;
+          }
+        }
+      }
+      return PmemPtr(pool_id, (char*) node);
+    };
+    (void) node_paddr;
+#if defined(LISTDB_L0_CACHE) && LISTDB_L0_CACHE != L0_CACHE_T_SIMPLE
+    {
+      auto hash_table = GetHashTable(i);
+      for (size_t k = 0; k < hash_table->size(); k++) {
+        PmemNode* node = hash_table->at(k)->value.load(MO_RELAXED);
+        if (node) {
+          shard_entries.push_back(CacheSnapshot::Entry{k, node_paddr(node).dump()});
+        }
+      }
+    }
+#endif
+    info.num_l0_entries = shard_entries.size();
+#ifdef LISTDB_SKIPLIST_CACHE
+    for (int j = 0; j < kNumRegions; j++) {
+      cache_[i][j]->ForEach([&](PmemNode* node) {
+        shard_entries.push_back(CacheSnapshot::Entry{(uint64_t) j, node_paddr(node).dump()});
+      });
+    }
+#endif
+#ifdef LISTDB_L1_LRU
+    for (int j = 0; j < kNumRegions; j++) {
+      cache_[i][j]->ForEach([&](const Key&, uint64_t value, int height) {
+        shard_entries.push_back(CacheSnapshot::Entry{((uint64_t) height << 8) | j, value});
+      });
+    }
+#endif
+    info.num_l1_entries = shard_entries.size() - info.num_l0_entries;
+    num_entries += shard_entries.size();
+  }
+  if (num_entries > 0) {
+    CacheSnapshot::Write(CacheSnapshotPath(), CacheSnapshotConfig(), infos, entries);
+  }
+}
+
+// Restores the caches of a recovered shard from the snapshot. Returns false
+// if there is no snapshot of its current manifests.
+bool ListDB::LoadCacheSnapshot(int shard) {
+  const CacheSnapshot::Entry* l0_entries;
+  const CacheSnapshot::Entry* l1_entries;
+  size_t num_l0_entries;
+  size_t num_l1_entries;
+  if (!cache_snapshot_ || !cache_snapshot_->GetSection(shard, ManifestFingerprint(shard),
+                                                       &l0_entries, &num_l0_entries,
+                                                       &l1_entries, &num_l1_entries)) {
+    return false;
+  }
+  // Drops an entry pointing outside the pools of the shard
+  size_t pool_size = PoolSetPartSize();
+  auto node_of = [&](uint64_t paddr) -> PmemNode* {
+    int pool_id = PmemPtr(paddr).pool_id();
+    if (PmemPtr(paddr).offset() + sizeof(PmemNode) > pool_size) {
+      return nullptr;
+    }
+    for (int j = 0; j < kNumRegions; j++) {
+      if (pool_id == l0_arena_[j][shard]->pool_id() ||
+          (cow_arena_bound_.load() && pool_id == cow_arena_[j][shard]->pool_id())) {
+        PmemNode* node = PmemPtr(paddr).get<PmemNode>();
+        return (node && node->key.Valid()) ? node : nullptr;
+      }
+    }
+    return nullptr;
+  };
+#if defined(LISTDB_L0_CACHE) && LISTDB_L0_CACHE != L0_CACHE_T_SIMPLE
+  auto hash_table = GetHashTable(shard);
+  for (size_t k = 0; k < num_l0_entries; k++) {
+    auto& e = l0_entries[k];
+    PmemNode* node = node_of(e.paddr);
+    if (node && e.slot < hash_table->size()) {
+      hash_table->at(e.slot)->value.store(node, MO_RELAXED);
+    }
+  }
+#endif
+  for (size_t k = 0; k < num_l1_entries; k++) {
+    auto& e = l1_entries[k];
+    int region = e.slot & 0xff;
+    PmemNode* node = node_of(e.paddr);
+    if (node == nullptr || region >= kNumRegions) {
+      continue;
+    }
+#ifdef LISTDB_SKIPLIST_CACHE
+    // L1 nodes of the region, in its log or CoW pool
+    int pool_id = PmemPtr(e.paddr).pool_id();
+    if (pool_id == l1_arena_[region][shard]->pool_id() ||
+        (cow_arena_bound_.load() && pool_id == cow_arena_[region][shard]->pool_id())) {
+      cache_[shard][region]->Insert(node);
+    }
+#endif
+#ifdef LISTDB_L1_LRU
+    cache_[shard][region]->Insert(node->key, e.paddr, e.slot >> 8);
+#endif
+  }
+  std::atomic_thread_fence(std::memory_order_release);
+  return true;
+}
+
+// Fills the L0 cache of a shard no snapshot restored from its L0 tables,
+// newest first. The shard is held against compaction and log reclamation so
+// that no node moves meanwhile.
+void ListDB::WarmL0Cache(int shard) {
+#if defined(LISTDB_L0_CACHE) && LISTDB_L0_CACHE != L0_CACHE_T_SIMPLE
+  int idle = 0;
+  while (!shard_bg_state_[shard].compare_exchange_strong(idle, 5)) {
+    if (stop_cache_warming_.load()) {
+      return;
+    }
+    idle = 0;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  {
+    EpochManager::Guard guard(&epoch_);
+    auto hash_table = GetHashTable(shard);
+    auto table = ll_[shard]->GetTableList(0)->GetFront();
+    for (; table && !stop_cache_warming_.load(); table = table->Next()) {
+      // A table half merged into L1 shares its nodes with L1
+      if (table->type() != TableType::kPmemTable ||
+          ((PmemTable*) table)->manifest<pmem_l0_info>()->status == Level0Status::kMergeInitiated) {
+        continue;
+      }
+      // The newest version of a key comes first
+      uint64_t curr_paddr = ((PmemTable*) table)->skiplist()->head()->next[0];
+      while (curr_paddr) {
+        PmemNode* node = PmemPtr(curr_paddr).get<PmemNode>();
+        hash_table->Fill(node->key, node);
+        curr_paddr = node->next[0];
+      }
+    }
+  }
+  shard_bg_state_[shard].store(0);
+  TryScheduleL0Compaction(shard);
+#endif
+}
+
+void ListDB::CacheWarmerThreadLoop(int region) {
+  numa_run_on_node(region % Numa::num_sockets());
+  for (int i = region; i < kNumShards && !stop_cache_warming_.load(); i += kNumRegions) {
+    WaitForShardRecovery(i);
+    if (l0_cache_cold_[i]) {
+      WarmL0Cache(i);
+    }
+  }
+}
+
+void ListDB::InitCaches() {
+#ifdef LISTDB_L1_LRU
+  for (int i = 0; i < kNumShards; i++) {
+    for (int j = 0; j < kNumRegions; j++) {
+      cache_[i][j] = new LruSkipList(100000000);
+    }
+  }
+#endif
+#ifdef LISTDB_SKIPLIST_CACHE
+  for (int i = 0; i < kNumShards; i++) {
+    for (int j = 0; j < kNumRegions; j++) {
+      cache_[i][j] = new SkipListCacheRep(l1_arena_[j][i]->pool_id(), options_.skiplist_cache_capacity / kNumShards / kNumRegions);
+    }
+  }
+#endif
+
+#if LISTDB_L0_CACHE == L0_CACHE_T_SIMPLE
+  // One table for all the shards
+  for (int i = 0; i < 1; i++) {
+    hash_table_[i] = new SimpleHashTable(options_.ht_size);
+    for (size_t j = 0; j < options_.ht_size; j++) {
+      hash_table_[i]->at(j)->version = 1UL;
+    }
+  }
+#elif LISTDB_L0_CACHE == L0_CACHE_T_STATIC
+  for (int i = 0; i < kNumShards; i++) {
+    hash_table_[i] = new StaticHashTableCache(options_.ht_size / kNumShards, i);
+  }
+#elif LISTDB_L0_CACHE == L0_CACHE_T_DOUBLE_HASHING
+  for (int i = 0; i < kNumShards; i++) {
+    hash_table_[i] = new DoubleHashingCache(options_.ht_size / kNumShards, i);
+  }
+#elif LISTDB_L0_CACHE == L0_CACHE_T_LINEAR_PROBING
+  for (int i = 0; i < kNumShards; i++) {
+    hash_table_[i] = new LinearProbingHashTableCache(options_.ht_size / kNumShards, i);
+  }
+#endif
+}
+
+void ListDB::BindCowArenas() {
+  if (cow_arena_bound_.load()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lk(cow_arena_mu_);
+  if (cow_arena_bound_.load()) {
+    return;
+  }
+  for (int i = 0; i < kNumRegions; i++) {
+    std::string poolset = RegionDir(i) + "/listdb_l1.set";
+    if (fs::exists(poolset)) {
+      Pmem::CheckLayout(poolset, kLogPoolLayout);
+    } else {
+      poolset = CreatePoolSet(RegionDir(i) + "/listdb_l1");
+    }
+
+    int pool_id = Pmem::BindPoolSet<pmem_log_root>(poolset, kLogPoolLayout);
+    pool_id_to_region_[pool_id] = i;
+
+    for (int j = 0; j < kNumShards; j++) {
+      cow_arena_[i][j] = new PmemLog(pool_id, j);
+      cow_arena_[i][j]->BindEpochManager(&epoch_);
+    }
+  }
+  cow_arena_bound_.store(true);
+}
+
+void ListDB::PrefaultLogs() {
+  std::vector<std::thread> threads;
+  for (int i = 0; i < kNumRegions; i++) {
+    threads.emplace_back([&, i] {
+      for (int j = 0; j < kNumShards; j++) {
+        log_[i][j]->Prefault();
+        if (cow_arena_bound_.load()) {
+          cow_arena_[i][j]->Prefault();
+        }
+      }
+    });
+  }
+  for (auto& t : threads) {
+    t.join();
+  }
+}
+
+void ListDB::StartLogPrefaulters() {
+  stop_log_prefault_ = false;
+  for (int i = 0; i < kNumRegions; i++) {
+    for (int j = 0; j < kNumShards; j++) {
+      log_[i][j]->BindSpareBlockRequest([&, i] {
+        {
+          std::lock_guard<std::mutex> lk(log_prefault_mu_);
+          log_prefault_requested_[i] = true;
+        }
+        log_prefault_cv_[i].notify_one();
+      });
+    }
+    log_prefaulters_.emplace_back(&ListDB::LogPrefaultThreadLoop, this, i);
+  }
+}
+
+void ListDB::LogPrefaultThreadLoop(int region) {
+  BindBackgroundThread(region);
+  std::unique_lock<std::mutex> lk(log_prefault_mu_);
+  while (!stop_log_prefault_) {
+    log_prefault_requested_[region] = false;
+    lk.unlock();
+    for (int j = 0; j < kNumShards; j++) {
+      while (log_[region][j]->NeedsSpareBlock()) {
+        log_[region][j]->PrepareSpareBlock();
+      }
+    }
+    lk.lock();
+    log_prefault_cv_[region].wait(lk, [&] { return stop_log_prefault_ || log_prefault_requested_[region]; });
+  }
+}
+
+void ListDB::StartBackgroundThreads() {
+  if (!Numa::is_initialized()) {
+    Numa::Init();
+  }
+  bg_thread_ = std::thread(std::bind(&ListDB::BackgroundThreadLoop, this));
+
+  worker_data_ = std::vector<CompactionWorkerData>(options_.num_workers);
+  worker_threads_.resize(options_.num_workers);
+  for (int i = 0; i < options_.num_workers; i++) {
+    worker_data_[i].id = i;
+    worker_data_[i].region = i % kNumRegions;
+    worker_threads_[i] = std::thread(std::bind(&ListDB::CompactionWorkerThreadLoop, this, &worker_data_[i]));
+
+    //sched_param sch;
+    //int policy; 
+    //pthread_getschedparam(worker_threads_[i].native_handle(), &policy, &sch);
+    //sch.sched_priority = 20;
+    //pthread_setschedparam(worker_threads_[i].native_handle(), SCHED_FIFO, &sch);
+  }
+}
+
+void ListDB::Close() {
+  stop_cache_warming_.store(true);
+  for (auto& cw : cache_warmers_) {
+    cw.join();
+  }
+  cache_warmers_.clear();
+  {
+    std::lock_guard<std::mutex> lk(log_prefault_mu_);
+    stop_log_prefault_ = true;
+  }
+  for (int i = 0; i < kNumRegions; i++) {
+    log_prefault_cv_[i].notify_all();
+  }
+  for (auto& lp : log_prefaulters_) {
+    lp.join();
+  }
+  log_prefaulters_.clear();
+  // Lazy recovery is finished first
+  for (auto& rw : recovery_workers_) {
+    rw.join();
+  }
+  recovery_workers_.clear();
+  {
+    std::lock_guard<std::mutex> lk(bg_mu_);
+    stop_ = true;
+  }
+  bg_cv_.notify_all();
+  if (bg_thread_.joinable()) {
+    bg_thread_.join();
+  }
+
+  scheduler_.Stop();
+  for (size_t i = 0; i < worker_threads_.size(); i++) {
+    if (worker_threads_[i].joinable()) {
+      worker_threads_[i].join();
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lk(mu_);
+    auto reporter = reporter_.load();
+    if (reporter != nullptr) {
+      delete reporter_;
+    }
+  }
+
+  SaveCacheSnapshot();
+
+  // Save log cursor info
+  for (int i = 0; i < kNumShards; i++) {
+    for (int j = 0; j < kNumRegions; j++) {
+      delete log_[j][i];
+      delete cow_arena_[j][i];
+    }
+  }
+  cow_arena_bound_.store(false);
+
   Pmem::Clear();
 }
 
@@ -942,167 +1871,266 @@ Reporter* ListDB::GetOrCreateReporter(const std::string& fname) {
 }
 
 void ListDB::SetL0CompactionSchedulerStatus(const ServiceStatus& status) {
-  std::lock_guard<std::mutex> guard(wq_mu_);
-  l0_compaction_scheduler_status_ = status;
+  l0_compaction_scheduler_status_.store(status);
+  if (status == ServiceStatus::kActive) {
+    for (int i = 0; i < kNumShards; i++) {
+      TryScheduleL0Compaction(i);
+    }
+  }
 }
 
+// Flushes and L0 compactions are scheduled by the workers on task completion.
+// This thread only wakes up periodically to look for log garbage.
 void ListDB::BackgroundThreadLoop() {
 #if 0
   numa_run_on_node(0);
 #endif
-  static const int kWorkerQueueDepth = 2;
-  std::vector<int> num_assigned_tasks(kNumWorkers);
-  std::unordered_map<Task*, int> task_to_worker;
-  std::deque<Task*> memtable_flush_requests;
-  std::deque<Task*> l0_compaction_requests;
-  std::vector<int> l0_compaction_state(kNumShards);
-  struct ReqCompCounter {
-    size_t req_cnt = 0;
-    size_t comp_cnt = 0;
-  };
-  std::map<TaskType, ReqCompCounter> req_comp_cnt;
-  req_comp_cnt.emplace(TaskType::kMemTableFlush, ReqCompCounter());
-
+#ifdef LISTDB_LOG_RECLAMATION
+  std::vector<std::chrono::steady_clock::time_point> last_reclaim_tp(kNumShards);
+#endif
   while (true) {
-    std::deque<Task*> new_work_requests;
-    std::deque<Task*> work_completions;
-    std::unique_lock<std::mutex> lk(wq_mu_);
-    bool schedule_l0_compaction;
-    wq_cv_.wait_for(lk, std::chrono::seconds(1), [&]{
-      //return !work_request_queue_.empty() || !work_completion_queue_.empty();
-      return !work_request_queue_.empty() || !memtable_flush_requests.empty();
-    });
-    new_work_requests.swap(work_request_queue_);
-    work_completions.swap(work_completion_queue_);
-    schedule_l0_compaction = (l0_compaction_scheduler_status_ == ServiceStatus::kActive);
+    std::unique_lock<std::mutex> lk(bg_mu_);
+    bg_cv_.wait_for(lk, std::chrono::seconds(1), [&]{ return stop_; });
+    if (stop_) {
+      fprintf(stdout, "bg thread terminating\n");
+      break;
+    }
     lk.unlock();
 
-    for (auto& task : work_completions) {
-      auto it = task_to_worker.find(task);
-      int worker_id = it->second;
-      task_to_worker.erase(it);
-      if (task->type == TaskType::kL0Compaction) {
-        l0_compaction_state[task->shard] = 0;
-      }
-      num_assigned_tasks[worker_id]--;
-      req_comp_cnt[task->type].comp_cnt++;
-      delete task;
-    }
+    TuneBackgroundIo();
+    RebalanceMemTableCapacity();
+    epoch_.Reclaim();
 
-    for (auto& task : new_work_requests) {
-      if (task->type == TaskType::kMemTableFlush) {
-        memtable_flush_requests.push_back(task);
-      } else {
-        fprintf(stdout, "unknown task request: %d\n", (int) task->type);
-        exit(1);
+#ifdef LISTDB_LOG_RECLAMATION
+    if (l0_compaction_scheduler_status_.load() != ServiceStatus::kActive) {
+      continue;
+    }
+    auto now = std::chrono::steady_clock::now();
+    for (int i = 0; i < kNumShards; i++) {
+      if (now - last_reclaim_tp[i] < std::chrono::milliseconds(kLogReclaimIntervalMsec)) {
+        continue;
       }
-      req_comp_cnt[task->type].req_cnt++;
-    }
-    if (schedule_l0_compaction) {
-      for (int i = 0; i < kNumShards; i++) {
-        if (l0_compaction_state[i] == 0) {
-          auto tl = ll_[i]->GetTableList(0);
-          auto table = tl->GetFront();
-          while (true) {
-            auto next_table = table->Next();
-            if (next_table) {
-              table = next_table;
-            } else {
-              break;
-            }
-          }
-          if (table->type() == TableType::kPmemTable) {
-            auto task = new L0CompactionTask();
-            task->type = TaskType::kL0Compaction;
-            task->shard = i;
-            task->l0 = (PmemTable*) table;
-            task->memtable_list = (MemTableList*) tl;
-            l0_compaction_state[i] = 1;  // configured
-            l0_compaction_requests.push_back(task);
-            req_comp_cnt[task->type].req_cnt++;
-          }
+      bool has_garbage = false;
+      int home_region = 0;
+      size_t max_obsolete_bytes = 0;
+      for (int j = 0; j < kNumRegions; j++) {
+        auto log = l1_arena_[j][i];
+        if (log->obsolete_bytes() >= kLogReclaimThreshold * kPmemLogBlockSize || log->HasRetiredBlocks()) {
+          has_garbage = true;
+        }
+        if (log->obsolete_bytes() > max_obsolete_bytes) {
+          max_obsolete_bytes = log->obsolete_bytes();
+          home_region = j;
         }
       }
-    }
-
-    std::vector<CompactionWorkerData*> available_workers;
-    for (int i = 0; i < kNumWorkers; i++) {
-      if (num_assigned_tasks[i] < kWorkerQueueDepth) {
-        available_workers.push_back(&worker_data_[i]);
+      if (!has_garbage) {
+        last_reclaim_tp[i] = now;
+        continue;
+      }
+      // Log reclamation relinks L1 nodes, so it excludes L0 compaction of the shard
+      int idle = 0;
+      if (shard_bg_state_[i].compare_exchange_strong(idle, 2)) {
+        last_reclaim_tp[i] = now;
+        auto task = new Task();
+        task->type = TaskType::kLogReclamation;
+        task->shard = i;
+        scheduler_.Push(task, home_region, Scheduler::kLow);
       }
     }
+#endif
+  }
+}
 
-    if (!memtable_flush_requests.empty()) {
-      while (!available_workers.empty() && !memtable_flush_requests.empty()) {
-        std::sort(available_workers.begin(), available_workers.end(), [&](auto& a, auto& b) {
-          return num_assigned_tasks[a->id] > num_assigned_tasks[b->id];
-        });
-        auto& worker = available_workers.back();
-        auto& task = memtable_flush_requests.front();
-        memtable_flush_requests.pop_front();
-        std::unique_lock<std::mutex> wlk(worker->mu);
-        worker->q.push(task);
-        wlk.unlock();
-        worker->cv.notify_one();
-        task_to_worker[task] = worker->id;
-        num_assigned_tasks[worker->id]++;
-        if (num_assigned_tasks[worker->id] >= kWorkerQueueDepth) {
-          available_workers.pop_back();
-        }
+// Schedules a compaction of the oldest L0 table of the shard unless the shard
+// already has a compaction or log reclamation in flight
+void ListDB::TryScheduleL0Compaction(int shard) {
+#ifndef LISTDB_NO_L0_COMPACTION
+  if (l0_compaction_scheduler_status_.load() != ServiceStatus::kActive) {
+    return;
+  }
+  if (shard_bg_state_[shard].load() != 0) {
+    return;
+  }
+  EpochManager::Guard guard(&epoch_);
+  auto tl = ll_[shard]->GetTableList(0);
+  auto table = tl->GetFront();
+  if (table == nullptr) {
+    return;
+  }
+  int num_l0_tables = (table->type() == TableType::kPmemTable) ? 1 : 0;
+  while (true) {
+    auto next_table = table->Next();
+    if (next_table) {
+      table = next_table;
+      if (table->type() == TableType::kPmemTable) {
+        num_l0_tables++;
       }
-#ifdef L0_COMPACTION_ON_IDLE
-      continue;
+    } else {
+      break;
+    }
+  }
+  if (table->type() != TableType::kPmemTable) {
+    return;
+  }
+  // A combined table goes to L1 next. So does a table half merged into L1.
+  auto l0_manifest = ((PmemTable*) table)->manifest<pmem_l0_info>();
+  bool combine = (num_l0_tables >= kL0CombineTrigger && l0_manifest->id_end == l0_manifest->id &&
+                  l0_manifest->status != Level0Status::kMergeInitiated);
+  int idle = 0;
+  if (!shard_bg_state_[shard].compare_exchange_strong(idle, 1)) {
+    return;
+  }
+  auto task = new L0CompactionTask();
+  task->type = (combine) ? TaskType::kL0Combine : TaskType::kL0Compaction;
+  task->shard = shard;
+  task->l0 = (PmemTable*) table;
+  task->memtable_list = (MemTableList*) tl;
+  int region = (table->home_region() >= 0) ? table->home_region() : shard % kNumRegions;
+  scheduler_.Push(task, region, Scheduler::kLow);
 #endif
+}
+
+void ListDB::UpdateWriteController(int shard) {
+  EpochManager::Guard guard(&epoch_);
+  auto tl = GetTableList<MemTableList>(0, shard);
+  int num_l0_tables = 0;
+  auto table = tl->GetFront();
+  while (table) {
+    if (table->type() == TableType::kPmemTable) {
+      num_l0_tables++;
     }
+    table = table->Next();
+  }
+  tl->write_controller()->Update(tl->num_memtables() - 1, num_l0_tables);
+}
 
-    //available_workers.clear();
-    //for (int i = 0; i < kNumWorkers; i++) {
-    //  if (num_assigned_tasks[i] == 0) {
-    //    available_workers.push_back(&worker_data_[i]);
-    //  }
-    //}
-#ifndef LISTDB_NO_L0_COMPACTION
-    while (!available_workers.empty() && !l0_compaction_requests.empty()) {
-      std::sort(available_workers.begin(), available_workers.end(), [&](auto& a, auto& b) {
-        return num_assigned_tasks[a->id] > num_assigned_tasks[b->id];
-      });
-      auto& worker = available_workers.back();
-      auto& task = l0_compaction_requests.front();
-      l0_compaction_requests.pop_front();
+inline void ListDB::ThrottleBackgroundIo(size_t* pending_bytes, size_t bytes, Env::IOPriority pri) {
+  *pending_bytes += bytes;
+  while (*pending_bytes >= kBgIoRequestBytes) {
+    bg_io_limiter_->Request(kBgIoRequestBytes, pri, RateLimiter::OpType::kWrite);
+    *pending_bytes -= kBgIoRequestBytes;
+  }
+}
 
-      std::unique_lock<std::mutex> wlk(worker->mu);
-      worker->q.push(task);
-      wlk.unlock();
-      worker->cv.notify_one();
+// Shrinks the budget while the sampled foreground write latency is above
+// its baseline. The baseline is the lowest latency seen, drifting up by 1%
+// per call. A delayed or stopped shard means that flushes fall behind, so the
+// budget grows regardless of the latency.
+void ListDB::TuneBackgroundIo() {
+  uint64_t sum = write_latency_nanos_.exchange(0);
+  uint64_t cnt = write_latency_cnt_.exchange(0);
+  bool write_stalled = false;
+  for (int i = 0; i < kNumShards; i++) {
+    auto tl = GetTableList<MemTableList>(0, i);
+    if (tl->write_controller()->state() != WriteController::State::kNormal) {
+      write_stalled = true;
+      break;
+    }
+  }
+  int64_t rate = bg_io_limiter_->GetBytesPerSecond();
+  bool slow = false;
+  if (cnt > 0) {
+    uint64_t latency = sum / cnt;
+    uint64_t baseline = write_latency_baseline_.load(MO_RELAXED);
+    if (baseline == 0 || latency < baseline) {
+      baseline = latency;
+    } else {
+      baseline += baseline / 100;
+    }
+    write_latency_last_.store(latency, MO_RELAXED);
+    write_latency_baseline_.store(baseline, MO_RELAXED);
+    slow = (latency * 100 > baseline * (100 + kBgIoLatencyTolerancePct));
+  }
+  if (slow && !write_stalled) {
+    rate = rate * 100 / (100 + kBgIoAdjustPct);
+  } else {
+    rate = rate * (100 + kBgIoAdjustPct) / 100;
+  }
+  rate = std::min(kBgIoMaxRate, std::max(kBgIoMinRate, rate));
+  if (rate != bg_io_limiter_->GetBytesPerSecond()) {
+    bg_io_limiter_->SetBytesPerSecond(rate);
+  }
+}
 
-      task_to_worker[task] = worker->id;
-      num_assigned_tasks[worker->id]++;
-      l0_compaction_state[task->shard] = 2;  // assigned
-      if (num_assigned_tasks[worker->id] >= kWorkerQueueDepth) {
-        available_workers.pop_back();
-      }
+// Moves the memtable capacity toward the shards taking the most writes. A
+// cold shard gives up at most half of its capacity per round and the hot
+// shards grow only into what the others gave up. A new capacity applies from
+// the next mutable memtable of the shard.
+void ListDB::RebalanceMemTableCapacity() {
+  double rate_sum = 0;
+  for (int i = 0; i < kNumShards; i++) {
+    size_t written = GetTableList<MemTableList>(0, i)->written_bytes();
+    // The sealed bytes of the old front are added after the switch
+    double delta = 0;
+    if (written > memtable_written_bytes_[i]) {
+      delta = written - memtable_written_bytes_[i];
+      memtable_written_bytes_[i] = written;
     }
-#endif
+    memtable_write_rate_[i] = (memtable_write_rate_[i] + delta) / 2;
+    rate_sum += memtable_write_rate_[i];
+  }
+  if (rate_sum == 0) {
+    return;
+  }
 
-    if (stop_) {
-      fprintf(stdout, "bg thread terminating\n");
-      break;
+  size_t capacity[kNumShards];
+  size_t wanted[kNumShards];
+  size_t total = 0;
+  size_t growth = 0;
+  for (int i = 0; i < kNumShards; i++) {
+    size_t current = GetTableList<MemTableList>(0, i)->table_capacity();
+    wanted[i] = (size_t) (options_.memtable_capacity * (memtable_write_rate_[i] / rate_sum));
+    wanted[i] = std::min(max_shard_memtable_capacity_, std::max(min_shard_memtable_capacity_, wanted[i]));
+    if (wanted[i] < current) {
+      capacity[i] = std::max(wanted[i], current / 2);
+    } else {
+      capacity[i] = current;
+      growth += wanted[i] - current;
     }
+    total += capacity[i];
+  }
+  size_t avail = (options_.memtable_capacity > total) ? options_.memtable_capacity - total : 0;
+  double scale = (growth > avail) ? (double) avail / growth : 1.0;
+  for (int i = 0; i < kNumShards; i++) {
+    if (wanted[i] > capacity[i]) {
+      capacity[i] += (size_t) ((wanted[i] - capacity[i]) * scale);
+    }
+    GetTableList<MemTableList>(0, i)->SetTableCapacity(capacity[i]);
+  }
+}
+
+inline void ListDB::RecordWriteLatency(uint64_t nanos) {
+  write_latency_nanos_.fetch_add(nanos, MO_RELAXED);
+  write_latency_cnt_.fetch_add(1, MO_RELAXED);
+}
+
+void ListDB::BindBackgroundThread(int region) {
+  auto cpus = Numa::reserved_cpus();
+  if (bg_numa_binding_) {
+    int node = region % Numa::num_sockets();
+    if (cpus.empty()) {
+      numa_run_on_node(node);
+      return;
+    }
+    auto node_cpus = Numa::reserved_cpus(node);
+    if (!node_cpus.empty()) {
+      cpus = node_cpus;
+    }
+  }
+  if (!cpus.empty()) {
+    SetAffinity(cpus);
   }
 }
 
 void ListDB::CompactionWorkerThreadLoop(CompactionWorkerData* td) {
+  BindBackgroundThread(td->region);
   td->rnd.Reset((td->id + 1) * (td->id + 1));
   while (true) {
-    std::unique_lock<std::mutex> lk(td->mu);
-    td->cv.wait(lk, [&]{ return td->stop || !td->q.empty(); });
-    if (td->stop) {
+    auto task = scheduler_.Pop(td->region);
+    if (task == nullptr) {
       break;
     }
-    auto task = td->q.front();
-    td->q.pop();
     td->current_task = task;
-    lk.unlock();
 
     if (task->type == TaskType::kMemTableFlush) {
 #ifndef LISTDB_WAL
@@ -1110,27 +2138,48 @@ void ListDB::CompactionWorkerThreadLoop(CompactionWorkerData* td) {
 #else
       FlushMemTableWAL((MemTableFlushTask*) task, td);
 #endif
-      td->current_task = nullptr;
     } else if (task->type == TaskType::kL0Compaction) {
-      ZipperCompactionL0(td, (L0CompactionTask*) task);
-      //L0CompactionCopyOnWrite((L0CompactionTask*) task);
-      td->current_task = nullptr;
+      // An interrupted merge goes on in the mode it started with
+      auto l0_manifest = ((L0CompactionTask*) task)->l0->manifest<pmem_l0_info>();
+      auto mode = (l0_manifest->status == Level0Status::kMergeInitiated) ?
+          l0_manifest->merge_mode : compaction_mode_[task->shard].load();
+      if (mode == CompactionMode::kCopyOnWrite) {
+        L0CompactionCopyOnWrite(td, (L0CompactionTask*) task);
+      } else {
+        ZipperCompactionL0(td, (L0CompactionTask*) task);
+      }
+      shard_bg_state_[task->shard].store(0);
+    } else if (task->type == TaskType::kL0Combine) {
+      CombineL0Tables(td, (L0CompactionTask*) task);
+      shard_bg_state_[task->shard].store(0);
+    } else if (task->type == TaskType::kLogReclamation) {
+      ReclaimLogBlocks(td, task);
+      shard_bg_state_[task->shard].store(0);
+    } else if (task->type == TaskType::kParallelJob) {
+      RunParallelJobs(((ParallelJobTask*) task)->pj.get(), td->region);
+    }
+    td->current_task = nullptr;
+    if (task->type != TaskType::kParallelJob) {
+      UpdateWriteController(task->shard);
+      TryScheduleL0Compaction(task->shard);
     }
-    std::unique_lock<std::mutex> bg_lk(wq_mu_);
-    work_completion_queue_.push_back(task);
-    bg_lk.unlock();
-    wq_cv_.notify_one();
+    delete task;
   }
 }
 
 //void ListDB::Put(const Key& key, const Value& value) {
 //}
 
-// Any table this function returns must be unreferenced manually
-// TODO(wkim): Make this function to return a wrapper of table
-//   table is unreferenced on the destruction of its wrapper
+// The caller must hold an epoch guard until it is done with the table
 inline MemTable* ListDB::GetWritableMemTable(size_t kv_size, int shard) {
-  auto tl = ll_[shard]->GetTableList(0);
+  auto tl = GetTableList<MemTableList>(0, shard);
+  auto wc = tl->write_controller();
+  if (wc->state() != WriteController::State::kNormal) {
+    // A delayed writer must not hold back the flushes
+    EpochManager::Suspend();
+    wc->Throttle(kv_size);
+    EpochManager::Resume();
+  }
   auto mem = tl->GetMutable(kv_size);
   return (MemTable*) mem;
 }
@@ -1172,15 +2221,25 @@ inline T* ListDB::GetTableList(int level, int shard) {
 }
 
 void ListDB::FlushMemTable(MemTableFlushTask* task, CompactionWorkerData* td) {
-#if LISTDB_FLUSH_MEMTABLE_TO_L1 == 1
-  fprintf(stdout, "FlushMemTableToL1 is not implemented for IUL.\n");
-  abort();
-#endif
-  if (task->shard == 0) fprintf(stdout, "FlushMemTable: %p\n", task->imm);
-  // Check Reference Counter
-  while (task->imm->w_RefCount() > 0) {
-    continue;
+  // Wait for the writers that took the memtable before it became immutable
+  epoch_.Synchronize();
+
+  // Going to L1 excludes the other background work on the shard's L1. A
+  // flush interrupted by a crash waits for it.
+  bool redo = (task->imm->l0_manifest()->status == Level0Status::kL1FlushInitiated);
+  if (redo || ShouldFlushToL1(task)) {
+    int idle = 0;
+    while (!shard_bg_state_[task->shard].compare_exchange_strong(idle, 3) && redo) {
+      idle = 0;
+      std::this_thread::yield();
+    }
+    if (idle == 0) {
+      FlushMemTableToL1(task, td);
+      shard_bg_state_[task->shard].store(0);
+      return;
+    }
   }
+  if (task->shard == 0) fprintf(stdout, "FlushMemTable: %p\n", task->imm);
 
   // Flush (IUL)
 #if 0
@@ -1194,84 +2253,369 @@ void ListDB::FlushMemTable(MemTableFlushTask* task, CompactionWorkerData* td) {
   auto l0_skiplist = task->imm->l0_skiplist();
 #endif
 
-  auto skiplist = task->imm->skiplist();
-  auto mem_node = skiplist->head();
-  mem_node = mem_node->next[0].load(MO_RELAXED);
+  using Node = PmemNode;
+  using MemNode = MemTable::Node;
+  uint64_t begin_micros = Clock::NowMicros();
+
+  // The DRAM order of the nodes, shared by the passes below
+  std::vector<MemNode*> mem_nodes;
+  auto mem_node = task->imm->skiplist()->head()->next[0].load(MO_RELAXED);
+  while (mem_node) {
+#ifdef GROUP_LOGGING
+    while (((std::atomic<uint64_t>*) &mem_node->value)->load(std::memory_order_relaxed) == 0) continue;
+#endif
+    mem_nodes.push_back(mem_node);
+    mem_node = mem_node->next[0].load(MO_RELAXED);
+  }
+  uint64_t flush_cnt = mem_nodes.size();
+
+  // One pass per region links its upper levels on a worker of the region,
+  // one more pass links the bottom level
+  std::vector<std::function<void()>> jobs;
+  std::vector<int> job_regions;
+  for (int r = 0; r < kNumRegions; r++) {
+    jobs.push_back([&, r] {
+      Node* preds[kMaxHeight];
+      for (int i = 1; i < kMaxHeight; i++) {
+        preds[i] = l0_skiplist->head(l0_arena_[r][0]->pool_id());
+      }
+      size_t io_bytes = 0;
+      for (auto mem_node : mem_nodes) {
+        auto paddr = (PmemPtr*) &mem_node->value;
+        if (pool_id_to_region_[paddr->pool_id()] != r) {
+          continue;
+        }
+        Node* node = paddr->get<Node>();
+        int height = node->height();
+        ThrottleBackgroundIo(&io_bytes, (height - 1) * sizeof(uint64_t), Env::IO_HIGH);
+        for (int i = 1; i < height; i++) {
+          preds[i]->next[i] = mem_node->value;
+          clwb(&preds[i]->next[i], 8);
+          preds[i] = node;
+        }
+      }
+      sfence();
+    });
+    job_regions.push_back(r);
+  }
+  jobs.push_back([&] {
+    Node* pred = l0_skiplist->head(l0_arena_[0][0]->pool_id());
+    size_t io_bytes = 0;
+    INIT_REPORTER_CLIENT;
+    for (auto mem_node : mem_nodes) {
+      ThrottleBackgroundIo(&io_bytes, sizeof(uint64_t), Env::IO_HIGH);
+      pred->next[0] = mem_node->value;
+      clwb(&pred->next[0], 8);
+      pred = ((PmemPtr*) &mem_node->value)->get<Node>();
+      REPORT_FLUSH_OPS(1);
+    }
+    sfence();
+    REPORT_DONE;  // Up report all remainings
+  });
+  job_regions.push_back(td->region);
+#ifdef LISTDB_L0_CACHE
+  // Batched so the buckets of a batch are fetched in parallel
+  jobs.push_back([&] {
+    auto hash_table = GetHashTable(task->shard);
+    for (size_t begin = 0; begin < mem_nodes.size(); begin += kFlushCacheBatch) {
+      size_t end = std::min(begin + kFlushCacheBatch, mem_nodes.size());
+      for (size_t i = begin; i < end; i++) {
+        hash_table->Prefetch(mem_nodes[i]->key);
+      }
+      for (size_t i = begin; i < end; i++) {
+        auto mem_node = mem_nodes[i];
+#if LISTDB_L0_CACHE == L0_CACHE_T_SIMPLE
+        hash_table->Add(mem_node->key, mem_node->value);
+#else
+        hash_table->Insert(mem_node->key, ((PmemPtr*) &mem_node->value)->get<Node>());
+#endif
+      }
+    }
+  });
+  job_regions.push_back(td->region);
+#endif
+  RunParallel(td, jobs, &job_regions);
+
+  // Every pass fenced its own flushes, so the L0 table is durable
+  auto l0_manifest = task->imm->l0_manifest();
+  l0_manifest->status = Level0Status::kPersisted;
+  clwb(&l0_manifest->status, sizeof(Level0Status));
+  sfence();
 
+  uint64_t end_micros = Clock::NowMicros();
+  td->flush_cnt += flush_cnt;
+  td->flush_time_usec += (end_micros - begin_micros);
+
+  PmemTable* l0_table = new PmemTable(options_.memtable_capacity, l0_skiplist);
+  l0_table->SetManifest(l0_manifest);
+  l0_table->SetHomeRegion(task->imm->home_region());
+  task->imm->SetPersistentTable((Table*) l0_table);
+  //task->imm->FinalizeFlush();
+  task->memtable_list->CleanUpFlushedImmutables();
+}
+
+// The oldest memtable of a shard may skip L0, as no older version of its
+// keys is left to merge after it. Taken if the merge into L1 costs about as
+// much as linking an L0 table: L1 is small, or the memtable lies past its
+// last key. Only in zipper mode, as the nodes are linked in place.
+bool ListDB::ShouldFlushToL1(MemTableFlushTask* task) {
   using Node = PmemNode;
-  Node* preds[kNumRegions][kMaxHeight];
-  Node* pred;
-  pred = l0_skiplist->head(l0_arena_[0][0]->pool_id());
-  for (int i = 0; i < kNumRegions; i++) {
-    int pool_id = l0_arena_[i][0]->pool_id();
-    for (int j = 1; j < kMaxHeight; j++) {
-      preds[i][j] = l0_skiplist->head(pool_id);
+  if (compaction_mode_[task->shard].load() != CompactionMode::kZipper || task->imm->Next() != nullptr) {
+    return false;
+  }
+  EpochManager::Guard guard(&epoch_);
+  auto l1_parts = GetTableList<PmemTableList>(1, task->shard)->partitions();
+  if (l1_parts == nullptr) {
+    return false;
+  }
+#if LISTDB_FLUSH_MEMTABLE_TO_L1 == 1
+  return true;
+#endif
+  size_t l1_size = 0;
+  for (auto& table : l1_parts->tables) {
+    l1_size += table->size();
+  }
+  if (l1_size <= kFlushToL1MaxRatio * task->imm->size()) {
+    return true;
+  }
+
+  auto first = task->imm->skiplist()->head()->next[0].load(MO_RELAXED);
+  if (first == nullptr) {
+    return true;
+  }
+  auto l1_skiplist = l1_parts->tables.back()->skiplist();
+  Node* pred = l1_skiplist->head(l1_pool_id_[0]);
+  for (int i = kMaxHeight - 1; i >= 0; i--) {
+    if (i == 0 && pred == l1_skiplist->head(l1_pool_id_[0])) {
+      pred = l1_skiplist->head();
+    }
+    while (true) {
+      Node* curr = ((PmemPtr*) &pred->next[i])->get<Node>();
+      if (curr == nullptr) {
+        break;
+      }
+      pred = curr;
     }
   }
+  return pred == l1_skiplist->head() || first->key.Compare(pred->key) > 0;
+}
 
+// Links the log entries of the memtable into L1 in key order, like the L0
+// compaction in copy-on-write mode but in place. Every step checks what is
+// already done, so a flush interrupted by a crash is redone from a memtable
+// replayed from the log.
+void ListDB::FlushMemTableToL1(MemTableFlushTask* task, CompactionWorkerData* td) {
+  if (task->shard == 0) fprintf(stdout, "FlushMemTable -> L1: %p\n", task->imm);
+  using Node = PmemNode;
+  using MemNode = MemTable::Node;
+  uint64_t begin_micros = Clock::NowMicros();
+
+  auto l0_manifest = task->imm->l0_manifest();
+  if (l0_manifest->status != Level0Status::kL1FlushInitiated) {
+    l0_manifest->status = Level0Status::kL1FlushInitiated;
+    clwb(&l0_manifest->status, sizeof(Level0Status));
+    sfence();
+  }
+  auto l1_tl = GetTableList<PmemTableList>(1, task->shard);
+  [[maybe_unused]] bool l1_cuts_done = ApplyL1Cuts(task->shard, false);
+  auto l1_parts = l1_tl->partitions();
+  std::vector<size_t> merged_size(l1_parts->tables.size(), 0);
 #ifdef LISTDB_L0_CACHE
   auto hash_table = GetHashTable(task->shard);
 #endif
 
+  BraidedPmemSkipList* l1_skiplist = nullptr;
+  int l1_idx = -1;
+  Node* preds[kNumRegions][kMaxHeight];
+  MemNode* prev_mem_node = nullptr;
   uint64_t flush_cnt = 0;
-  uint64_t begin_micros = Clock::NowMicros();
+  size_t io_bytes = 0;
   INIT_REPORTER_CLIENT;
-  while (mem_node) {
-    //std::this_thread::yield();
+  for (auto mem_node = task->imm->skiplist()->head()->next[0].load(MO_RELAXED); mem_node;
+       mem_node = mem_node->next[0].load(MO_RELAXED)) {
 #ifdef GROUP_LOGGING
     while (((std::atomic<uint64_t>*) &mem_node->value)->load(std::memory_order_relaxed) == 0) continue;
 #endif
-    int pool_id = ((PmemPtr*) &mem_node->value)->pool_id();
-    int region = pool_id_to_region_[pool_id];
-    Node* node = ((PmemPtr*) &mem_node->value)->get<Node>();
+    PmemPtr node_paddr(mem_node->value);
+    Node* node = node_paddr.get<Node>();
+    int region = pool_id_to_region_[node_paddr.pool_id()];
     int height = node->height();
-    for (int i = 1; i < height; i++) {
-      //std::this_thread::yield();
-      preds[region][i]->next[i] = mem_node->value;
-      preds[region][i] = ((PmemPtr*) &(preds[region][i]->next[i]))->get<Node>();
+    size_t node_size = sizeof(PmemNode) + (height - 1) * sizeof(uint64_t);
+    ThrottleBackgroundIo(&io_bytes, 2 * height * sizeof(uint64_t), Env::IO_HIGH);
+    flush_cnt++;
+    REPORT_FLUSH_OPS(1);
+
+    // Older versions follow the newest one in the memtable
+    if (prev_mem_node && prev_mem_node->key.Compare(mem_node->key) == 0) {
+      l0_arena_[region][task->shard]->RetireEntry(node_paddr, node_size);
+      num_versions_merged_.fetch_add(1, MO_RELAXED);
+      continue;
+    }
+    prev_mem_node = mem_node;
+
+    int idx = l1_tl->FindPartitionIndex(l1_parts, mem_node->key);
+    if (idx != l1_idx) {
+      l1_idx = idx;
+      l1_skiplist = l1_parts->tables[idx]->skiplist();
+      for (int r = 0; r < kNumRegions; r++) {
+        for (int i = 0; i < kMaxHeight; i++) {
+          preds[r][i] = l1_skiplist->head(l1_pool_id_[r]);
+        }
+      }
+      preds[0][0] = l1_skiplist->head();
+    }
+    // Both predecessors are before the node. Takes the one further right.
+    auto closer = [&](Node* a, Node* b, Node* head) {
+      if (b == l1_skiplist->head(l1_pool_id_[region]) ||
+          (a != head && b->key.Compare(a->key) <= 0)) {
+        return a;
+      }
+      return b;
+    };
+
+    // Upper levels of the region, then level 0
+    for (int i = kMaxHeight - 1; i > 0; i--) {
+      Node* head = l1_skiplist->head(l1_pool_id_[region]);
+      Node* pred = (i < kMaxHeight - 1) ? closer(preds[region][i], preds[region][i + 1], head) : preds[region][i];
+      while (true) {
+        Node* curr = ((PmemPtr*) &pred->next[i])->get<Node>();
+        if (curr && curr->key.Compare(node->key) < 0) {
+          pred = curr;
+          continue;
+        }
+        break;
+      }
+      preds[region][i] = pred;
+    }
+    {
+      Node* pred = closer(preds[0][0], preds[region][1], l1_skiplist->head());
+      while (true) {
+        Node* curr = ((PmemPtr*) &pred->next[0])->get<Node>();
+        if (curr && curr->key.Compare(node->key) < 0) {
+          pred = curr;
+          continue;
+        }
+        break;
+      }
+      preds[0][0] = pred;
+    }
+
+    uint64_t succ = preds[0][0]->next[0];
+    Node* old_node = ((PmemPtr*) &succ)->get<Node>();
+    if (succ == node_paddr.dump()) {
+      // Linked before the crash. Upper levels lost with it are linked now.
+      for (int i = 1; i < height; i++) {
+        if (preds[region][i]->next[i] != node_paddr.dump()) {
+          node->next[i] = preds[region][i]->next[i];
+          clwb(&node->next[i], 8);
+          sfence();
+          preds[region][i]->next[i] = node_paddr.dump();
+          clwb(&preds[region][i]->next[i], 8);
+        }
+        preds[region][i] = node;
+      }
+      preds[0][0] = node;
+      continue;
+    }
+    if (old_node && old_node->key.Compare(node->key) == 0) {
+      if (old_node->value != node->value) {
+        old_node->value = node->value;
+        clwb(&old_node->value, 8);
+        sfence();
+      }
+      l0_arena_[region][task->shard]->RetireEntry(node_paddr, node_size);
+      num_versions_merged_.fetch_add(1, MO_RELAXED);
+#if LISTDB_L0_CACHE == L0_CACHE_T_SIMPLE
+      hash_table->Add(mem_node->key, succ);
+#elif defined(LISTDB_L0_CACHE)
+      hash_table->Insert(mem_node->key, old_node);
+#endif
+      continue;
     }
-    pred->next[0] = mem_node->value;
-    pred = ((PmemPtr*) &(pred->next[0]))->get<Node>();
 
+    node->next[0] = succ;
+    for (int i = 1; i < height; i++) {
+      node->next[i] = preds[region][i]->next[i];
+    }
+    clwb(&node->next[0], height * sizeof(uint64_t));
+    sfence();
+    preds[0][0]->next[0] = node_paddr.dump();
+    clwb(&preds[0][0]->next[0], 8);
+    sfence();
+    // Flushed ahead of kMergeDone by the fence of SetL1PartitionSize()
+    for (int i = 1; i < height; i++) {
+      preds[region][i]->next[i] = node_paddr.dump();
+      clwb(&preds[region][i]->next[i], 8);
+    }
+    preds[0][0] = node;
+    for (int i = 1; i < height; i++) {
+      preds[region][i] = node;
+    }
+    merged_size[idx] += node->key.size() + sizeof(Value);
 #if LISTDB_L0_CACHE == L0_CACHE_T_SIMPLE
     hash_table->Add(mem_node->key, mem_node->value);
-#elif LISTDB_L0_CACHE == L0_CACHE_T_STATIC
-    hash_table->Insert(mem_node->key, node);
-#elif LISTDB_L0_CACHE == L0_CACHE_T_DOUBLE_HASHING
-    hash_table->Insert(mem_node->key, node);
-#elif LISTDB_L0_CACHE == L0_CACHE_T_LINEAR_PROBING
+#elif defined(LISTDB_L0_CACHE)
     hash_table->Insert(mem_node->key, node);
 #endif
-
-    REPORT_FLUSH_OPS(1);
-    flush_cnt++;
-
-    //std::this_thread::yield();
-    mem_node = mem_node->next[0].load(MO_RELAXED);
+#ifdef LISTDB_SKIPLIST_CACHE
+    if (height >= kSkipListCacheMinPmemHeight) {
+      cache_[task->shard][region]->Insert(node);
+    }
+#endif
   }
   REPORT_DONE;  // Up report all remainings
+  for (size_t i = 0; i < merged_size.size(); i++) {
+    SetL1PartitionSize(l1_parts->tables[i], l1_parts->tables[i]->size() + merged_size[i]);
+  }
+
+  l0_manifest->status = Level0Status::kMergeDone;
+  clwb(&l0_manifest->status, sizeof(Level0Status));
+  sfence();
+  num_l1_flushes_.fetch_add(1, MO_RELAXED);
+
   uint64_t end_micros = Clock::NowMicros();
   td->flush_cnt += flush_cnt;
   td->flush_time_usec += (end_micros - begin_micros);
 
-  PmemTable* l0_table = new PmemTable(kMemTableCapacity, l0_skiplist);
-  l0_table->SetManifest(task->imm->l0_manifest());
-  task->imm->SetPersistentTable((Table*) l0_table);
-  // TODO(wkim): Log this L0 table for recovery
-  //task->imm->FinalizeFlush();
+  task->imm->SetFlushedToL1();
   task->memtable_list->CleanUpFlushedImmutables();
+
+#ifdef LISTDB_L1_PARTITION
+  // One split at a time, after the tail of the last one is cut
+  if (l1_cuts_done) {
+    for (size_t i = 0; i < l1_parts->tables.size(); i++) {
+      if (l1_parts->tables[i]->size() > l1_partition_split_size_) {
+        SplitL1Partition(task->shard, i);
+        break;
+      }
+    }
+  }
+#endif
 }
 
 void ListDB::FlushMemTableToL1WAL(MemTableFlushTask* task, CompactionWorkerData* td) {
   if (task->shard == 0) fprintf(stdout, "MemTable -> L1\n");
-  // Check Reference Counter
-  while (task->imm->w_RefCount() > 0) {
-    continue;
-  }
+  // Wait for the writers that took the memtable before it became immutable
+  epoch_.Synchronize();
 
-  auto l1_tl = ll_[task->shard]->GetTableList(1);
-  auto l1_table = (PmemTable*) l1_tl->GetFront();
+  auto l1_tl = GetTableList<PmemTableList>(1, task->shard);
+  if (l1_tl->partitions() == nullptr) {
+    pmem::obj::persistent_ptr<pmem_l1_info> l1_manifest;
+    auto l1_table = CreateL1Partition(task->shard, Key(0), &l1_manifest);
+    PersistL1Partition(l1_table);
+    auto shard_manifest = Pmem::pool<pmem_db>(0).root()->shard[task->shard];
+    shard_manifest->l1_info = l1_manifest;
+    clwb(&shard_manifest->l1_info, sizeof(shard_manifest->l1_info));
+    sfence();
+    auto partitions = new PmemTableList::Partitions();
+    partitions->begin_keys.push_back(Key(0));
+    partitions->tables.push_back(l1_table);
+    l1_tl->SetPartitions(partitions);
+  }
+  // L1 is not split in WAL builds
+  auto l1_table = l1_tl->partitions()->tables[0];
   auto l1_skiplist = l1_table->skiplist();
+  size_t flush_size = 0;
 
   auto skiplist = task->imm->skiplist();
   auto mem_node = skiplist->head();
@@ -1351,10 +2695,10 @@ void ListDB::FlushMemTableToL1WAL(MemTableFlushTask* task, CompactionWorkerData*
     }
     node->key = mem_node->key;
     clwb(node, node_size);
-    _mm_sfence();
+    sfence();
     preds[0][0]->next[0] = node_paddr.dump();
     clwb(&(preds[0][0]->next[0]), 8);
-    _mm_sfence();
+    sfence();
     for (int i = 1 ;i < height; i++) {
       preds[region][i]->next[i] = node_paddr.dump();
     }
@@ -1373,18 +2717,20 @@ void ListDB::FlushMemTableToL1WAL(MemTableFlushTask* task, CompactionWorkerData*
     PmemPtr node_paddr = PmemPtr(mem_value_pool_id, ((uintptr_t) node - (uintptr_t) pool.handle()));
     node->tag = height;
     node->value = mem_node->value;
-    _mm_sfence();
+    sfence();
     node->key = mem_node->key;
     clwb(node, sizeof(PmemNode) - sizeof(uint64_t));
     l1_skiplist->Insert(node_paddr);
 #endif
     REPORT_FLUSH_OPS(1);
     flush_cnt++;
+    flush_size += mem_node->key.size() + sizeof(Value);
 
     //std::this_thread::yield();
     mem_node = mem_node->next[0].load(MO_RELAXED);
   }
   REPORT_DONE;  // Up report all remainings
+  SetL1PartitionSize(l1_table, l1_table->size() + flush_size);
   uint64_t end_micros = Clock::NowMicros();
   td->flush_cnt += flush_cnt;
   td->flush_time_usec += (end_micros - begin_micros);
@@ -1400,10 +2746,8 @@ void ListDB::FlushMemTableWAL(MemTableFlushTask* task, CompactionWorkerData* td)
   return FlushMemTableToL1WAL(task, td);
 #endif
   if (task->shard == 0) fprintf(stdout, "FlushMemTable: %p\n", task->imm);
-  // Check Reference Counter
-  while (task->imm->w_RefCount() > 0) {
-    continue;
-  }
+  // Wait for the writers that took the memtable before it became immutable
+  epoch_.Synchronize();
 
   // Flush (WAL)
   auto l0_skiplist = task->imm->l0_skiplist();
@@ -1464,12 +2808,12 @@ void ListDB::FlushMemTableWAL(MemTableFlushTask* task, CompactionWorkerData* td)
 
     node->tag = height;
     node->value = mem_node->value;
-    _mm_sfence();
+    sfence();
     node->key = mem_node->key;
     clwb(node, sizeof(PmemNode) - sizeof(uint64_t));
 
     pred->next[0] = node_paddr.dump();
-    _mm_sfence();
+    sfence();
     clwb(&pred->next[0], 8);
     for (int i = 1; i < height; i++) {
       //std::this_thread::yield();
@@ -1499,7 +2843,7 @@ void ListDB::FlushMemTableWAL(MemTableFlushTask* task, CompactionWorkerData* td)
   td->flush_cnt += flush_cnt;
   td->flush_time_usec += (end_micros - begin_micros);
 
-  PmemTable* l0_table = new PmemTable(kMemTableCapacity, l0_skiplist);
+  PmemTable* l0_table = new PmemTable(options_.memtable_capacity, l0_skiplist);
   l0_table->SetManifest(task->imm->l0_manifest());
   task->imm->SetPersistentTable((Table*) l0_table);
   // TODO(wkim): Log this L0 table for recovery
@@ -1520,7 +2864,8 @@ void ListDB::ManualFlushMemTable(int shard) {
   }
 
   tl->CreateNewFront();  // Level0Status is set to kFull.
-  
+  epoch_.Synchronize();
+
   // Flush (IUL)
   auto l0_skiplist = reinterpret_cast<MemTable*>(table)->l0_skiplist();
 
@@ -1554,9 +2899,11 @@ void ListDB::ManualFlushMemTable(int shard) {
     int height = node->height();
     for (int i = 1; i < height; i++) {
       preds[region][i]->next[i] = mem_node->value;
+      clwb(&preds[region][i]->next[i], 8);
       preds[region][i] = ((PmemPtr*) &(preds[region][i]->next[i]))->get<Node>();
     }
     pred->next[0] = mem_node->value;
+    clwb(&pred->next[0], 8);
     pred = ((PmemPtr*) &(pred->next[0]))->get<Node>();
 
 #if LISTDB_L0_CACHE == L0_CACHE_T_SIMPLE
@@ -1575,11 +2922,16 @@ void ListDB::ManualFlushMemTable(int shard) {
     mem_node = mem_node->next[0].load(MO_RELAXED);
   }
   REPORT_DONE;  // Up report all remainings
+  sfence();
 
-  PmemTable* l0_table = new PmemTable(kMemTableCapacity, l0_skiplist);
-  l0_table->SetManifest(reinterpret_cast<MemTable*>(table)->l0_manifest());
+  auto l0_manifest = reinterpret_cast<MemTable*>(table)->l0_manifest();
+  l0_manifest->status = Level0Status::kPersisted;
+  clwb(&l0_manifest->status, sizeof(Level0Status));
+  sfence();
+
+  PmemTable* l0_table = new PmemTable(options_.memtable_capacity, l0_skiplist);
+  l0_table->SetManifest(l0_manifest);
   reinterpret_cast<MemTable*>(table)->SetPersistentTable((Table*) l0_table);
-  // TODO(wkim): Log this L0 table for recovery
   tl->CleanUpFlushedImmutables();
 #else
 
@@ -1651,12 +3003,12 @@ void ListDB::ManualFlushMemTable(int shard) {
 
     node->tag = height;
     node->value = mem_node->value;
-    _mm_sfence();
+    sfence();
     node->key = mem_node->key;
     clwb(node, sizeof(PmemNode) - sizeof(uint64_t));
 
     pred->next[0] = node_paddr.dump();
-    _mm_sfence();
+    sfence();
     clwb(&pred->next[0], 8);
     for (int i = 1; i < height; i++) {
       preds[region][i]->next[i] = node_paddr.dump();
@@ -1681,7 +3033,7 @@ void ListDB::ManualFlushMemTable(int shard) {
   }
   REPORT_DONE;  // Up report all remainings
 
-  PmemTable* l0_table = new PmemTable(kMemTableCapacity, l0_skiplist);
+  PmemTable* l0_table = new PmemTable(options_.memtable_capacity, l0_skiplist);
   l0_table->SetManifest(reinterpret_cast<MemTable*>(table)->l0_manifest());
   reinterpret_cast<MemTable*>(table)->SetPersistentTable((Table*) l0_table);
   // TODO(wkim): Log this L0 table for recovery
@@ -1691,9 +3043,8 @@ void ListDB::ManualFlushMemTable(int shard) {
 
 void ListDB::ZipperCompactionL0(CompactionWorkerData* td, L0CompactionTask* task) {
   auto l0_manifest = task->l0->manifest<pmem_l0_info>();
-  l0_manifest->status = Level0Status::kMergeInitiated;
-  // call clwb
 #if 0
+  l0_manifest->status = Level0Status::kMergeInitiated;
   if (task->shard == 0) fprintf(stdout, "L0 compaction\n");
   using Node = PmemNode;
   auto l0_skiplist = task->l0->skiplist();
@@ -1853,35 +3204,171 @@ void ListDB::ZipperCompactionL0(CompactionWorkerData* td, L0CompactionTask* task
   using Node = PmemNode;
   auto l0_skiplist = task->l0->skiplist();
 
-  auto l1_tl = ll_[task->shard]->GetTableList(1);
-  if (l1_tl->IsEmpty()) {
+  auto l1_tl = GetTableList<PmemTableList>(1, task->shard);
+  if (l0_manifest->status == Level0Status::kMergeInitiated && l1_tl->partitions() != nullptr) {
+    // Interrupted by a crash
+    ResumeZipperCompactionL0(task);
+    return;
+  }
+  if (l1_tl->partitions() == nullptr) {
+    l0_manifest->merge_mode = CompactionMode::kZipper;
+    l0_manifest->status = Level0Status::kMergeInitiated;
+    clwb(l0_manifest.get(), sizeof(pmem_l0_info));
+    sfence();
 #if 0
     auto l1_table = new PmemTable(std::numeric_limits<size_t>::max(), l0_skiplist);
 #else
     // Init the new manifest for a new table
     pmem::obj::persistent_ptr<pmem_l1_info> l1_manifest;
     auto db_pool = Pmem::pool<pmem_db>(0);
-    pmem::obj::make_persistent_atomic<pmem_l1_info>(db_pool, l1_manifest);
     auto db_root = db_pool.root();
     auto shard_manifest = db_root->shard[task->shard];
     //l1_manifest->id = ??;
-    BraidedPmemSkipList* l1_skiplist = new BraidedPmemSkipList(l1_arena_[0][0]->pool_id());
-    for (int i = 0; i < kNumRegions; i++) {
-      l1_skiplist->BindArena(l1_pool_id_[i], l1_arena_[i][task->shard]);
-    }
-    l1_skiplist->Init();
+    auto l1_table = CreateL1Partition(task->shard, Key(0), &l1_manifest);
+    auto l1_skiplist = l1_table->skiplist();
     for (int i = 0; i < kNumRegions; i++) {
-      auto p_head = l1_skiplist->p_head(l1_pool_id_[i]);
-      PmemNode* head = (PmemNode*) p_head.get();
+      PmemNode* head = l1_skiplist->head(l1_pool_id_[i]);
       PmemNode* l0_head = l0_skiplist->head(l0_pool_id_[i]);
       for (int h = 0; h < head->height(); h++) {
         head->next[h] = l0_head->next[h];
       }
-      l1_manifest->head[i] = p_head;
     }
+    PersistL1Partition(l1_table);
+    SetL1PartitionSize(l1_table, task->l0->size());
     shard_manifest->l1_info = l1_manifest;
-    auto l1_table = new PmemTable(std::numeric_limits<size_t>::max(), l1_skiplist);
 #endif
+    auto partitions = new PmemTableList::Partitions();
+    partitions->begin_keys.push_back(Key(0));
+    partitions->tables.push_back(l1_table);
+    l1_tl->SetPartitions(partitions);
+    task->memtable_list->RemoveTable(task->l0);
+    // Update manifest
+    l0_manifest->status = Level0Status::kMergeDone;
+    clwb(&l0_manifest->status, sizeof(Level0Status));
+    sfence();
+    return;
+  }
+  [[maybe_unused]] bool l1_cuts_done = ApplyL1Cuts(task->shard, false);
+  auto l1_parts = l1_tl->partitions();
+
+  // Split the L0 table into key ranges at the pivots taken from its upper
+  // levels and at the L1 partition boundaries
+#if defined(LISTDB_L1_LRU) || defined(LISTDB_SKIPLIST_CACHE)
+  // L1 caches are not thread-safe for insertion
+  int num_partitions = 1;
+#else
+  int num_partitions = kNumZipperPartitions;
+#endif
+  std::vector<PmemPtr> pivots;
+  if (num_partitions > 1) {
+    FindZipperPivots(l0_skiplist, num_partitions, &pivots);
+  }
+  std::vector<PmemPtr> fences;
+  for (size_t i = 1; i < l1_parts->begin_keys.size(); i++) {
+    PmemPtr paddr = l0_skiplist->Lookup(l1_parts->begin_keys[i], l0_skiplist->primary_pool_id());
+    if (paddr.get() != nullptr) {
+      fences.push_back(paddr);
+    }
+  }
+  // The L0 head itself is not merged. It is freed after the compaction.
+  PmemPtr begin_paddr = l0_skiplist->head()->next[0];
+  // Cuts are the first L0 nodes of the partitions after the first, in L0
+  // order. A fence is the first node of its key, so it goes before a pivot
+  // of the same key.
+  std::vector<PmemPtr> cuts;
+  size_t pi = 0;
+  size_t fi = 0;
+  while (pi < pivots.size() || fi < fences.size()) {
+    bool is_fence = (pi == pivots.size()) || (fi < fences.size() &&
+        fences[fi].get<Node>()->key.Compare(pivots[pi].get<Node>()->key) <= 0);
+    PmemPtr paddr = (is_fence) ? fences[fi++] : pivots[pi++];
+    if (paddr.dump() == begin_paddr.dump() || (!cuts.empty() && cuts.back().dump() == paddr.dump())) {
+      continue;
+    }
+    cuts.push_back(paddr);
+  }
+  std::vector<ZipperPartition*> parts;
+  for (size_t i = 0; i <= cuts.size(); i++) {
+    auto part = new ZipperPartition();
+    part->begin = (i == 0) ? begin_paddr : cuts[i - 1];
+    part->end = (i < cuts.size()) ? cuts[i] : PmemPtr();
+    Node* begin_node = part->begin.get<Node>();
+    int l1_idx = (begin_node) ? l1_tl->FindPartitionIndex(l1_parts, begin_node->key) : 0;
+    part->l1_table = l1_parts->tables[l1_idx];
+    parts.push_back(part);
+  }
+
+  // A crash from here on is recovered by ResumeZipperCompactionL0()
+  l0_manifest->merge_mode = CompactionMode::kZipper;
+  PersistZipperProgress(l0_manifest, parts, Level0Status::kMergeInitiated);
+
+  // Scan, then merge once the partition on the right is merged. A merge
+  // only links nodes greater than the keys of the partitions on its left, so
+  // their scans are not affected. Jobs are claimed in order, so the
+  // rightmost partition goes first and a job never waits for an unclaimed
+  // one.
+  std::vector<std::function<void()>> jobs;
+  for (size_t i = parts.size(); i-- > 0;) {
+    jobs.push_back([&, i] {
+      auto part = parts[i];
+      ZipperScan(part->l1_table->skiplist(), part);
+      if (i + 1 < parts.size()) {
+        while (!parts[i + 1]->merged.load()) {
+          std::this_thread::yield();
+        }
+      }
+      ZipperMerge(td, task->shard, part);
+      part->merged.store(true);
+    });
+  }
+  RunParallel(td, jobs);
+  num_zipper_merges_.fetch_add(1, MO_RELAXED);
+  num_zipper_partitions_.fetch_add(parts.size(), MO_RELAXED);
+  for (auto& part : parts) {
+    SetL1PartitionSize(part->l1_table, part->l1_table->size() + part->merged_size);
+    delete part;
+  }
+
+#ifdef LISTDB_L1_LRU
+  using MyType1 = std::pair<uint64_t, uint64_t>;
+  for (int i = 0; i < kNumRegions; i++) {
+    std::sort(sorted_arr_[i][task->shard].begin(), sorted_arr_[i][task->shard].end(),
+        [&](const MyType1 &a, const MyType1 &b) { return a.first > b.first; });
+  }
+#endif
+
+  // Update manifest
+  l0_manifest->status = Level0Status::kMergeDone;
+  clwb(&l0_manifest->status, sizeof(Level0Status));
+  sfence();
+  FreeZipperProgress(l0_manifest);
+
+  // Remove empty L0 from MemTableList
+  task->memtable_list->RemoveTable(task->l0);
+
+#ifdef LISTDB_L1_PARTITION
+  // One split at a time, after the tail of the last one is cut
+  if (l1_cuts_done) {
+    for (size_t i = 0; i < l1_parts->tables.size(); i++) {
+      if (l1_parts->tables[i]->size() > l1_partition_split_size_) {
+        SplitL1Partition(task->shard, i);
+        break;
+      }
+    }
+  }
+#endif
+#else
+  // Insert N times
+  // For Test
+  l0_manifest->status = Level0Status::kMergeInitiated;
+  if (task->shard == 0) fprintf(stdout, "L0 compaction\n");
+
+  using Node = PmemNode;
+  auto l0_skiplist = task->l0->skiplist();
+
+  auto l1_tl = ll_[task->shard]->GetTableList(1);
+  if (l1_tl->IsEmpty()) {
+    auto l1_table = new PmemTable(std::numeric_limits<size_t>::max(), l0_skiplist);
     l1_tl->SetFront(l1_table);
     auto table = task->memtable_list->GetFront();
     while (true) {
@@ -1896,19 +3383,83 @@ void ListDB::ZipperCompactionL0(CompactionWorkerData* td, L0CompactionTask* task
         break;
       }
     }
-    // Update manifest
-    l0_manifest->status = Level0Status::kMergeDone;
-    // call clwb
     return;
   }
   auto l1_skiplist = ((PmemTable*) l1_tl->GetFront())->skiplist();
 
-  struct ZipperItem {
-    PmemPtr node_paddr;
-    Node* preds[kMaxHeight];
-  };
+  PmemPtr node_paddr = l0_skiplist->head_paddr();
 
-  std::stack<ZipperItem*> zstack;
+  std::stack<PmemPtr> nstack;
+
+  // 1. Scan
+  while (true) {
+    auto l0_node = node_paddr.get<Node>();
+    if (l0_node == nullptr) {
+      break;
+    }
+
+    nstack.push(node_paddr);
+    node_paddr = l0_node->next[0];
+  }
+
+  // 2. Merge
+  while (!nstack.empty()) {
+    auto& l0_paddr = nstack.top();
+    //auto l0_node = l0_paddr.get<Node>();
+
+    l1_skiplist->Insert(l0_paddr);
+
+    nstack.pop();
+  }
+  // Remove empty L0 from MemTableList
+  //auto tl = ll_[task->shard]->GetTableList(0);
+  auto table = task->memtable_list->GetFront();
+  while (true) {
+    auto next_table = table->Next();
+    if (next_table) {
+      if (next_table == (Table*) task->l0) {
+        table->SetNext(nullptr);
+        break;
+      }
+      table = next_table;
+    } else {
+      break;
+    }
+  }
+#endif
+#endif
+}
+
+// Picks (num_partitions - 1) evenly spaced pivots from the highest level of
+// the primary region that has enough nodes. Levels below kZipperPivotMinHeight
+// are not used so that a partition is not too small to be worth a thread.
+// Returns the number of partitions.
+int ListDB::FindZipperPivots(BraidedPmemSkipList* l0_skiplist, int num_partitions, std::vector<PmemPtr>* pivots) {
+  using Node = PmemNode;
+  Node* head = l0_skiplist->head();
+  std::vector<PmemPtr> level_nodes;
+  for (int h = kMaxHeight - 1; h >= kZipperPivotMinHeight; h--) {
+    level_nodes.clear();
+    PmemPtr curr_paddr = head->next[h];
+    Node* curr = curr_paddr.get<Node>();
+    while (curr) {
+      level_nodes.push_back(curr_paddr);
+      curr_paddr = curr->next[h];
+      curr = curr_paddr.get<Node>();
+    }
+    if ((int) level_nodes.size() >= num_partitions - 1) {
+      break;
+    }
+  }
+  int n = std::min<int>(num_partitions, level_nodes.size() + 1);
+  for (int i = 1; i < n; i++) {
+    pivots->push_back(level_nodes[i * level_nodes.size() / n]);
+  }
+  return n;
+}
+
+void ListDB::ZipperScan(BraidedPmemSkipList* l1_skiplist, ZipperPartition* part) {
+  using Node = PmemNode;
   Node* preds[kNumRegions][kMaxHeight];
   for (int i = 0; i < kNumRegions; i++) {
     int pool_id = l1_arena_[i][0]->pool_id();
@@ -1917,10 +3468,8 @@ void ListDB::ZipperCompactionL0(CompactionWorkerData* td, L0CompactionTask* task
     }
   }
 
-  PmemPtr node_paddr = l0_skiplist->head_paddr();
-
-  // 1. Scan
-  while (true) {
+  PmemPtr node_paddr = part->begin;
+  while (node_paddr.dump() != part->end.dump()) {
 #ifdef L0_COMPACTION_YIELD
     std::this_thread::yield();
 #endif
@@ -1971,189 +3520,686 @@ void ListDB::ZipperCompactionL0(CompactionWorkerData* td, L0CompactionTask* task
         break;
       }
     }
-    auto z = new ZipperItem();
+    int height = l0_node->height();
+    auto z = (ZipperItem*) part->arena.allocate(sizeof(ZipperItem) + (height - 1) * sizeof(Node*));
     z->node_paddr = node_paddr;
     z->preds[0] = preds[0][0];
-    for (int i = 1; i < l0_node->height(); i++) {
+    for (int i = 1; i < height; i++) {
       z->preds[i] = preds[region][i];
     }
-    zstack.push(z);
+    part->zstack.push_back(z);
     node_paddr = l0_node->next[0];
   }
+}
 
-  // 2. Merge
-  //bool print_debug = false;
-  //if (preds[0][0]->next[0] != 0) {
-  //  print_debug = true;
-  //}
+void ListDB::ZipperMerge(CompactionWorkerData* td, int shard, ZipperPartition* part) {
+  using Node = PmemNode;
+  size_t io_bytes = 0;
   INIT_REPORTER_CLIENT;
-  while (!zstack.empty()) {
+  for (auto it = part->zstack.rbegin(); it != part->zstack.rend(); ++it) {
 #ifdef L0_COMPACTION_YIELD
     std::this_thread::yield();
 #endif
-    auto& z = zstack.top();
+    auto z = *it;
     auto l0_node = z->node_paddr.get<Node>();
+    int region = pool_id_to_region_[z->node_paddr.pool_id()];
+    ThrottleBackgroundIo(&io_bytes, 2 * l0_node->height() * sizeof(uint64_t), Env::IO_MID);
     {
-      l0_node->next[0] = z->preds[0]->next[0];
-      clwb(&l0_node->next[0], 8);
-      _mm_sfence();
-      z->preds[0]->next[0] = z->node_paddr.dump();
-      clwb(&z->preds[0]->next[0], 8);
-      _mm_sfence();
-      //uint64_t tag = l0_node->tag;
-      //tag |= 0x100;
-      //l0_node->tag = tag;
+      // Reuse the successor if it is an older version of the same key
+      Node* old_node = ((PmemPtr*) &z->preds[0]->next[0])->get<Node>();
+      if (old_node && old_node->key.Compare(l0_node->key) == 0) {
+        old_node->value = l0_node->value;
+        clwb(&old_node->value, 8);
+        sfence();
+        size_t node_size = sizeof(PmemNode) + (l0_node->height() - 1) * sizeof(uint64_t);
+        l0_arena_[region][shard]->RetireEntry(z->node_paddr, node_size);
+        num_versions_merged_.fetch_add(1, MO_RELAXED);
+        ZipperAdvanceCursor(part, z->node_paddr);
+        REPORT_COMPACTION_OPS(1);
+        continue;
+      }
     }
-    for (int i = 1; i < l0_node->height(); i++) {
+    for (int i = 0; i < l0_node->height(); i++) {
       l0_node->next[i] = z->preds[i]->next[i];
+      if (i == 0) {
+        clwb(&l0_node->next[0], 8);
+        sfence();
+      }
       z->preds[i]->next[i] = z->node_paddr.dump();
+      if (i == 0) {
+        clwb(&z->preds[0]->next[0], 8);
+        sfence();
+      }
     }
+    part->merged_size += l0_node->key.size() + sizeof(Value);
+    ZipperAdvanceCursor(part, z->node_paddr);
 #ifdef LISTDB_L1_LRU
-    if (l0_node->height() >= kMaxHeight - (kNumCachedLevels - 1)) {
+    if (!part->combine && l0_node->height() >= kMaxHeight - (kNumCachedLevels - 1)) {
       int region = z->node_paddr.pool_id();
-      //sorted_arr_[region][task->shard].emplace_back(l0_node->key, z->node_paddr.dump());
+      //sorted_arr_[region][shard].emplace_back(l0_node->key, z->node_paddr.dump());
       //int lru_height = l0_node->height() - (kMaxHeight - kLruMaxHeight);
       //lru_height = (lru_height + 1) / 2;
       int lru_height = 1;
       while (lru_height < kLruMaxHeight && td->rnd.Next() % 2== 0) {
         lru_height++;
       }
-      cache_[task->shard][region]->Insert(l0_node->key, z->node_paddr.dump(), lru_height);
+      cache_[shard][region]->Insert(l0_node->key, z->node_paddr.dump(), lru_height);
     }
 #endif
 
 #ifdef LISTDB_SKIPLIST_CACHE
-    if (l0_node->height() >= kSkipListCacheMinPmemHeight) {
-      int region = pool_id_to_region_[z->node_paddr.pool_id()];
-      cache_[task->shard][region]->Insert(l0_node);
+    if (!part->combine && l0_node->height() >= kSkipListCacheMinPmemHeight) {
+      cache_[shard][region]->Insert(l0_node);
     }
 #endif
     REPORT_COMPACTION_OPS(1);
-    zstack.pop();
-    delete z;
   }
+  sfence();
   REPORT_DONE;  // Up report all remainings
+}
 
-#ifdef LISTDB_L1_LRU
-  using MyType1 = std::pair<uint64_t, uint64_t>;
-  for (int i = 0; i < kNumRegions; i++) {
-    std::sort(sorted_arr_[i][task->shard].begin(), sorted_arr_[i][task->shard].end(),
-        [&](const MyType1 &a, const MyType1 &b) { return a.first > b.first; });
+// Persists the merge progress of a partition every kZipperCursorInterval
+// nodes. The fences of the merged links order the store after them.
+inline void ListDB::ZipperAdvanceCursor(ZipperPartition* part, PmemPtr node_paddr) {
+  if (part->cursor == nullptr || ++part->num_merged % kZipperCursorInterval != 0) {
+    return;
+  }
+  *part->cursor = node_paddr.dump();
+  clwb(part->cursor, 8);
+}
+
+// Persists the partitions of a zipper merge before the first link, then
+// moves the L0 table to the given status
+void ListDB::PersistZipperProgress(pmem::obj::persistent_ptr<pmem_l0_info> l0_manifest,
+                                   std::vector<ZipperPartition*>& parts, Level0Status status) {
+  FreeZipperProgress(l0_manifest);
+  size_t num_parts = parts.size();
+  pmem::obj::persistent_ptr<uint64_t[]> progress;
+  auto db_pool = Pmem::pool<pmem_db>(0);
+  pmem::obj::make_persistent_atomic<uint64_t[]>(db_pool, progress, 2 * num_parts);
+  for (size_t i = 0; i < num_parts; i++) {
+    progress[i] = parts[i]->begin.dump();
+    progress[num_parts + i] = 0;
+    parts[i]->cursor = &progress[num_parts + i];
+  }
+  clwb(progress.get(), 2 * num_parts * sizeof(uint64_t));
+  l0_manifest->zipper_progress = progress;
+  l0_manifest->num_zipper_parts = num_parts;
+  clwb(l0_manifest.get(), sizeof(pmem_l0_info));
+  sfence();
+  l0_manifest->status = status;
+  clwb(&l0_manifest->status, sizeof(Level0Status));
+  sfence();
+}
+
+// pmemobj_free() clears the persistent pointer along with the free, so a
+// manifest that outlives its merge is never freed twice
+void ListDB::FreeZipperProgress(pmem::obj::persistent_ptr<pmem_l0_info> l0_manifest) {
+  if (l0_manifest->zipper_progress) {
+    pmemobj_free(l0_manifest->zipper_progress.raw_ptr());
+  }
+  l0_manifest->num_zipper_parts = 0;
+  clwb(&l0_manifest->num_zipper_parts, 8);
+  sfence();
+}
+
+// Finishes a merge into L1 interrupted by a crash
+void ListDB::ResumeZipperCompactionL0(L0CompactionTask* task) {
+  if (task->shard == 0) fprintf(stdout, "Resume L0 compaction\n");
+  auto l0_manifest = task->l0->manifest<pmem_l0_info>();
+  auto l1_tl = GetTableList<PmemTableList>(1, task->shard);
+  // No progress if the L0 table became the first L1 partition
+  if (l0_manifest->zipper_progress) {
+    ResumeZipperMerge(task->shard, l0_manifest, [&](const Key& key) { return l1_tl->FindPartition(key); });
+    for (auto& table : l1_tl->partitions()->tables) {
+      SetL1PartitionSize(table, table->size());
+    }
   }
-#endif
 
   // Update manifest
   l0_manifest->status = Level0Status::kMergeDone;
-  // call clwb
+  clwb(&l0_manifest->status, sizeof(Level0Status));
+  sfence();
+  FreeZipperProgress(l0_manifest);
 
   // Remove empty L0 from MemTableList
-  //auto tl = ll_[task->shard]->GetTableList(0);
-  auto table = task->memtable_list->GetFront();
-  while (true) {
-    auto next_table = table->Next();
-    if (next_table) {
-      if (next_table == (Table*) task->l0) {
-        table->SetNext(nullptr);
+  task->memtable_list->RemoveTable(task->l0);
+}
+
+// The merge goes right to left in every partition, so the nodes not merged
+// yet are still chained in L0 order from the first node of the partition.
+// The walk stops at the persisted cursor, at most kZipperCursorInterval
+// nodes past the last merged one.
+void ListDB::ResumeZipperMerge(int shard, pmem::obj::persistent_ptr<pmem_l0_info> l0_manifest,
+                               const std::function<PmemTable*(const Key&)>& find_target) {
+  using Node = PmemNode;
+  size_t num_parts = l0_manifest->num_zipper_parts;
+  auto progress = l0_manifest->zipper_progress;
+  for (size_t p = 0; p < num_parts; p++) {
+    PmemPtr end((p + 1 < num_parts) ? progress[p + 1] : 0);
+    PmemPtr cursor(progress[num_parts + p]);
+    Node* end_node = end.get<Node>();
+    Node* cursor_node = cursor.get<Node>();
+    std::vector<PmemPtr> nodes;
+    PmemPtr paddr(progress[p]);
+    while (true) {
+      Node* node = paddr.get<Node>();
+      if (node == nullptr || paddr.dump() == end.dump() || paddr.dump() == cursor.dump() ||
+          node->l0_id() < l0_manifest->id || node->l0_id() > l0_manifest->id_end) {
         break;
       }
-      table = next_table;
-    } else {
-      break;
+      if ((end_node && node->key.Compare(end_node->key) > 0) ||
+          (cursor_node && node->key.Compare(cursor_node->key) > 0)) {
+        break;
+      }
+      nodes.push_back(paddr);
+      paddr = node->next[0];
+    }
+    for (auto it = nodes.rbegin(); it != nodes.rend(); ++it) {
+      Node* node = it->get<Node>();
+      ResumeZipperMergeNode(shard, find_target(node->key), *it);
     }
   }
-#else
-  // Insert N times
-  // For Test
-  if (task->shard == 0) fprintf(stdout, "L0 compaction\n");
+}
 
+// Merges a node into the target unless an earlier run already did. Level 0
+// is linked as in ZipperMerge(). Upper levels are linked where missing.
+void ListDB::ResumeZipperMergeNode(int shard, PmemTable* target, PmemPtr node_paddr) {
   using Node = PmemNode;
-  auto l0_skiplist = task->l0->skiplist();
-
-  auto l1_tl = ll_[task->shard]->GetTableList(1);
-  if (l1_tl->IsEmpty()) {
-    auto l1_table = new PmemTable(std::numeric_limits<size_t>::max(), l0_skiplist);
-    l1_tl->SetFront(l1_table);
-    auto table = task->memtable_list->GetFront();
+  Node* node = node_paddr.get<Node>();
+  int pool_id = node_paddr.pool_id();
+  int region = pool_id_to_region_[pool_id];
+  int height = node->height();
+  uint64_t node_dump = node_paddr.dump();
+  auto l1_skiplist = target->skiplist();
+
+  Node* preds[kMaxHeight];
+  Node* pred = l1_skiplist->head(pool_id);
+  for (int i = kMaxHeight - 1; i >= 0; i--) {
+    if (i == 0 && pred == l1_skiplist->head(pool_id)) {
+      pred = l1_skiplist->head();
+    }
     while (true) {
-      auto next_table = table->Next();
-      if (next_table) {
-        if (next_table == (Table*) task->l0) {
-          table->SetNext(nullptr);
-          break;
-        }
-        table = next_table;
-      } else {
+      Node* curr = ((PmemPtr*) &pred->next[i])->get<Node>();
+      if (curr && curr->key.Compare(node->key) < 0) {
+        pred = curr;
+        continue;
+      }
+      break;
+    }
+    preds[i] = pred;
+  }
+
+  bool merged = false;
+  uint64_t succ = preds[0]->next[0];
+  Node* old_node = ((PmemPtr*) &succ)->get<Node>();
+  while (old_node && old_node->key.Compare(node->key) == 0) {
+    if (succ == node_dump) {
+      merged = true;
+      break;
+    }
+    succ = old_node->next[0];
+    old_node = ((PmemPtr*) &succ)->get<Node>();
+  }
+  if (!merged) {
+    old_node = ((PmemPtr*) &preds[0]->next[0])->get<Node>();
+    if (old_node && old_node->key.Compare(node->key) == 0) {
+      old_node->value = node->value;
+      clwb(&old_node->value, 8);
+      sfence();
+      size_t node_size = sizeof(PmemNode) + (height - 1) * sizeof(uint64_t);
+      l0_arena_[region][shard]->RetireEntry(node_paddr, node_size);
+      num_versions_merged_.fetch_add(1, MO_RELAXED);
+      return;
+    }
+
+    node->next[0] = preds[0]->next[0];
+    clwb(&node->next[0], 8);
+    sfence();
+    preds[0]->next[0] = node_dump;
+    clwb(&preds[0]->next[0], 8);
+    sfence();
+    target->SetSize(target->size() + node->key.size() + sizeof(Value));
+  }
+  // The upper levels of the merge before the crash were not flushed. They
+  // are persisted here like level 0, so another crash does not lose them.
+  for (int i = 1; i < height; i++) {
+    if (preds[i]->next[i] != node_dump) {
+      node->next[i] = preds[i]->next[i];
+      clwb(&node->next[i], 8);
+      sfence();
+      preds[i]->next[i] = node_dump;
+      clwb(&preds[i]->next[i], 8);
+    }
+  }
+  sfence();
+}
+
+// Merges the L0 tables queued right after the oldest one into it, oldest
+// first, so a single zipper pass over L1 follows. A combined source is
+// marked kMergeDone after the target covers its L0 id.
+void ListDB::CombineL0Tables(CompactionWorkerData* td, L0CompactionTask* task) {
+  auto target = task->l0;
+  auto target_manifest = target->manifest<pmem_l0_info>();
+  std::vector<PmemTable*> sources;
+  {
+    EpochManager::Guard guard(&epoch_);
+    std::vector<Table*> tables;
+    for (auto table = task->memtable_list->GetFront(); table; table = table->Next()) {
+      tables.push_back(table);
+    }
+    for (int i = (int) tables.size() - 2; i >= 0 && (int) sources.size() < kMaxL0CombineTables; i--) {
+      if (tables[i]->type() != TableType::kPmemTable) {
         break;
       }
+      sources.push_back((PmemTable*) tables[i]);
     }
-    return;
   }
-  auto l1_skiplist = ((PmemTable*) l1_tl->GetFront())->skiplist();
+  if (task->shard == 0) fprintf(stdout, "L0 combine: %zu tables\n", sources.size());
 
-  PmemPtr node_paddr = l0_skiplist->head_paddr();
+  for (auto& src : sources) {
+    auto src_manifest = src->manifest<pmem_l0_info>();
+    if (src_manifest->status == Level0Status::kCombineInitiated) {
+      // Interrupted by a crash
+      ResumeZipperMerge(task->shard, src_manifest, [&](const Key&) { return target; });
+    } else {
+      auto part = new ZipperPartition();
+      part->begin = src->skiplist()->head()->next[0];
+      part->l1_table = target;
+      part->combine = true;
+      std::vector<ZipperPartition*> parts(1, part);
+      PersistZipperProgress(src_manifest, parts, Level0Status::kCombineInitiated);
+      ZipperScan(target->skiplist(), part);
+      ZipperMerge(td, task->shard, part);
+      delete part;
+    }
 
-  std::stack<PmemPtr> nstack;
+    // Update manifests
+    target_manifest->id_end = src_manifest->id_end;
+    clwb(&target_manifest->id_end, 8);
+    sfence();
+    src_manifest->status = Level0Status::kMergeDone;
+    clwb(&src_manifest->status, sizeof(Level0Status));
+    sfence();
+    FreeZipperProgress(src_manifest);
 
-  // 1. Scan
-  while (true) {
-    auto l0_node = node_paddr.get<Node>();
-    if (l0_node == nullptr) {
-      break;
+    task->memtable_list->RemoveTable(src);
+  }
+}
+
+// Runs the jobs on the caller and up to kNumZipperPartitions - 1 workers.
+// Helpers are scheduled as tasks, so the caller never blocks on a job that
+// has not started.
+// With regions given, a helper is queued in the region of every job but one
+// the caller takes itself, and workers take the jobs of their own region first
+void ListDB::RunParallel(CompactionWorkerData* td, std::vector<std::function<void()>>& jobs,
+                         const std::vector<int>* regions) {
+  auto pj = std::make_shared<ParallelJobs>();
+  pj->jobs = &jobs;
+  if (regions) {
+    pj->regions = *regions;
+  }
+  pj->num_jobs = jobs.size();
+  pj->claimed.reset(new std::atomic_flag[jobs.size()]);
+  for (size_t i = 0; i < jobs.size(); i++) {
+    pj->claimed[i].clear();
+  }
+  std::vector<int> helper_queues;
+  if (regions) {
+    helper_queues = *regions;
+    auto it = std::find(helper_queues.begin(), helper_queues.end(), td->region);
+    helper_queues.erase((it != helper_queues.end()) ? it : helper_queues.begin());
+  } else {
+    int num_helpers = std::min<int>(jobs.size(), kNumZipperPartitions) - 1;
+    helper_queues.assign(std::max(num_helpers, 0), td->region);
+  }
+  for (int queue : helper_queues) {
+    auto task = new ParallelJobTask();
+    task->type = TaskType::kParallelJob;
+    task->shard = td->current_task->shard;
+    task->pj = pj;
+    scheduler_.Push(task, queue, Scheduler::kNormal);
+  }
+  RunParallelJobs(pj.get(), td->region);
+  while (pj->num_done.load() < pj->num_jobs) {
+    std::this_thread::yield();
+  }
+}
+
+void ListDB::RunParallelJobs(ParallelJobs* pj, int region) {
+  for (int local = (pj->regions.empty()) ? 0 : 1; local >= 0; local--) {
+    for (size_t i = 0; i < pj->num_jobs; i++) {
+      if (local && pj->regions[i] != region) {
+        continue;
+      }
+      if (!pj->claimed[i].test_and_set()) {
+        (*pj->jobs)[i]();
+        pj->num_done.fetch_add(1);
+      }
     }
+  }
+}
 
-    nstack.push(node_paddr);
-    node_paddr = l0_node->next[0];
+// Creates an L1 partition with empty heads. The caller fills the heads,
+// persists them with PersistL1Partition() and links the manifest.
+PmemTable* ListDB::CreateL1Partition(int shard, const Key& begin_key, pmem::obj::persistent_ptr<pmem_l1_info>* manifest) {
+  auto db_pool = Pmem::pool<pmem_db>(0);
+  pmem::obj::make_persistent_atomic<pmem_l1_info>(db_pool, *manifest);
+  BraidedPmemSkipList* l1_skiplist = new BraidedPmemSkipList(l1_pool_id_[0]);
+  for (int i = 0; i < kNumRegions; i++) {
+    l1_skiplist->BindArena(l1_pool_id_[i], l1_arena_[i][shard]);
+  }
+  l1_skiplist->Init();
+  for (int i = 0; i < kNumRegions; i++) {
+    (*manifest)->head[i] = l1_skiplist->p_head(l1_pool_id_[i]);
   }
+  memcpy((*manifest)->begin_key, (void*) &begin_key, sizeof(Key));
+  (*manifest)->size = 0;
+  (*manifest)->next = nullptr;
+  auto l1_table = new PmemTable(std::numeric_limits<size_t>::max(), l1_skiplist);
+  l1_table->SetManifest(*manifest);
+  return l1_table;
+}
 
-  // 2. Merge
-  while (!nstack.empty()) {
-    auto& l0_paddr = nstack.top();
-    //auto l0_node = l0_paddr.get<Node>();
+void ListDB::PersistL1Partition(PmemTable* table) {
+  size_t head_size = sizeof(PmemNode) + (kMaxHeight - 1) * sizeof(uint64_t);
+  for (int i = 0; i < kNumRegions; i++) {
+    clwb(table->skiplist()->head(l1_pool_id_[i]), head_size);
+  }
+  auto manifest = table->manifest<pmem_l1_info>();
+  clwb(manifest.get(), sizeof(pmem_l1_info));
+  sfence();
+}
 
-    l1_skiplist->Insert(l0_paddr);
+void ListDB::SetL1PartitionSize(PmemTable* table, size_t size) {
+  table->SetSize(size);
+  auto manifest = table->manifest<pmem_l1_info>();
+  manifest->size = size;
+  clwb(&manifest->size, sizeof(uint64_t));
+  sfence();
+}
 
-    nstack.pop();
+// Splits an L1 partition at a key taken from its upper levels. The heads of
+// the new partition point into the tail of the old one, which is cut off
+// after the readers routed with the old fences are gone.
+void ListDB::SplitL1Partition(int shard, int idx) {
+  using Node = PmemNode;
+  auto l1_tl = GetTableList<PmemTableList>(1, shard);
+  auto l1_parts = l1_tl->partitions();
+  auto table = l1_parts->tables[idx];
+  auto skiplist = table->skiplist();
+  std::vector<PmemPtr> pivots;
+  if (FindZipperPivots(skiplist, 2, &pivots) < 2) {
+    return;
   }
-  // Remove empty L0 from MemTableList
-  //auto tl = ll_[task->shard]->GetTableList(0);
-  auto table = task->memtable_list->GetFront();
-  while (true) {
-    auto next_table = table->Next();
-    if (next_table) {
-      if (next_table == (Table*) task->l0) {
-        table->SetNext(nullptr);
+  Key split_key = pivots[0].get<Node>()->key;
+  if (split_key.Compare(l1_parts->begin_keys[idx]) <= 0) {
+    return;
+  }
+
+  pmem::obj::persistent_ptr<pmem_l1_info> new_manifest;
+  auto new_table = CreateL1Partition(shard, split_key, &new_manifest);
+  auto new_skiplist = new_table->skiplist();
+  for (int i = 0; i < kNumRegions; i++) {
+    int pool_id = l1_pool_id_[i];
+    Node* pred = skiplist->head(pool_id);
+    Node* new_head = new_skiplist->head(pool_id);
+    // The bottom level is braided from the primary head
+    for (int h = kMaxHeight - 1; h >= ((i == 0) ? 0 : 1); h--) {
+      while (true) {
+        Node* curr = ((PmemPtr*) &pred->next[h])->get<Node>();
+        if (curr && curr->key.Compare(split_key) < 0) {
+          pred = curr;
+          continue;
+        }
         break;
       }
-      table = next_table;
-    } else {
-      break;
+      new_head->next[h] = pred->next[h];
     }
   }
-#endif
-#endif
+  PersistL1Partition(new_table);
+
+  auto manifest = table->manifest<pmem_l1_info>();
+  new_manifest->next = manifest->next;
+  clwb(&new_manifest->next, sizeof(new_manifest->next));
+  sfence();
+  manifest->next = new_manifest;
+  clwb(&manifest->next, sizeof(manifest->next));
+  sfence();
+
+  size_t new_size = table->size() / 2;
+  SetL1PartitionSize(new_table, new_size);
+  SetL1PartitionSize(table, table->size() - new_size);
+  auto new_parts = new PmemTableList::Partitions(*l1_parts);
+  new_parts->begin_keys.insert(new_parts->begin_keys.begin() + idx + 1, split_key);
+  new_parts->tables.insert(new_parts->tables.begin() + idx + 1, new_table);
+  l1_tl->SetPartitions(new_parts);
+
+  l1_cuts_[shard].push_back(L1Cut{skiplist, split_key, epoch_.current()});
 }
 
-void ListDB::L0CompactionCopyOnWrite(L0CompactionTask* task) {
-  if (task->shard == 0) fprintf(stdout, "L0 compaction\n");
-
+// Unlinks the nodes at or after end_key from every level. Idempotent.
+void ListDB::CutL1Partition(BraidedPmemSkipList* skiplist, const Key& end_key) {
   using Node = PmemNode;
-  auto l0_skiplist = task->l0->skiplist();
+  for (int i = 0; i < kNumRegions; i++) {
+    Node* pred = skiplist->head(l1_pool_id_[i]);
+    for (int h = kMaxHeight - 1; h >= ((i == 0) ? 0 : 1); h--) {
+      while (true) {
+        Node* curr = ((PmemPtr*) &pred->next[h])->get<Node>();
+        if (curr && curr->key.Compare(end_key) < 0) {
+          pred = curr;
+          continue;
+        }
+        break;
+      }
+      if (pred->next[h] != 0) {
+        pred->next[h] = 0;
+        clwb(&pred->next[h], 8);
+      }
+    }
+  }
+  sfence();
+}
 
-  auto l1_tl = ll_[task->shard]->GetTableList(1);
-  auto l1_skiplist = ((PmemTable*) l1_tl->GetFront())->skiplist();
+// Returns true if no cut is left
+bool ListDB::ApplyL1Cuts(int shard, bool force) {
+  auto& cuts = l1_cuts_[shard];
+  if (cuts.empty()) {
+    return true;
+  }
+  uint64_t safe_epoch = epoch_.SafeEpoch();
+  for (auto it = cuts.begin(); it != cuts.end();) {
+    if (force || it->epoch < safe_epoch) {
+      CutL1Partition(it->skiplist, it->end_key);
+      it = cuts.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  return cuts.empty();
+}
 
-  Node* preds[kNumRegions][kMaxHeight];
-  uint64_t succs[kNumRegions][kMaxHeight];
+// Frees the log blocks of a shard that are mostly taken by the obsolete
+// versions dropped in L0 compaction. The block must be sealed before the
+// oldest unmerged L0 table was created, so that every entry in it is either
+// an L1 node or an obsolete version.
+void ListDB::ReclaimLogBlocks(CompactionWorkerData* td, Task* task) {
+  using Node = PmemNode;
+  int shard = task->shard;
+  auto l1_tl = GetTableList<PmemTableList>(1, shard);
+  // A node past a split point is also reachable from the uncut tail
+  bool l1_ready = (l1_tl->partitions() != nullptr) && ApplyL1Cuts(shard, false);
+
+  auto db_pool = Pmem::pool<pmem_db>(0);
+  auto shard_manifest = db_pool.root()->shard[shard];
+  uint64_t l0_cnt = shard_manifest->l0_cnt;
+  uint64_t min_unmerged_l0_id = l0_cnt;
+  // L0 tables are merged from the oldest
+  auto l0_info = shard_manifest->l0_list_head->next;
+  while (l0_info && l0_info->status != Level0Status::kMergeDone) {
+    min_unmerged_l0_id = l0_info->id;
+    l0_info = l0_info->next;
+  }
+
+  size_t io_bytes = 0;
   for (int i = 0; i < kNumRegions; i++) {
-    int pool_id = l1_arena_[i][0]->pool_id();
-    for (int j = 0; j < kMaxHeight; j++) {
-      preds[i][j] = l1_skiplist->head(pool_id);
-      succs[i][j] = 0;
+    auto log = l1_arena_[i][shard];
+    log->FreeRetiredBlocks();
+    if (!l1_ready) {
+      continue;
+    }
+    std::vector<pmem_log_block*> blocks;
+    log->GetReclaimCandidates(l0_cnt, min_unmerged_l0_id, &blocks);
+    // A relocation interrupted by a crash may have relinked some levels of a
+    // node only, so it is finished first
+    auto resumed = log->relocating_block();
+    if (resumed && std::find(blocks.begin(), blocks.end(), resumed) == blocks.end()) {
+      blocks.insert(blocks.begin(), resumed);
+    }
+    for (auto& block : blocks) {
+      log->BeginRelocation(block);
+      size_t offset = 0;
+      while (offset < kPmemLogBlockSize - 7) {
+        Node* node = (Node*) (block->data + offset);
+        if (!node->key.Valid()) {
+          break;
+        }
+        PmemPtr node_paddr(log->pool_id(), (char*) node);
+        auto l1_skiplist = l1_tl->FindPartition(node->key)->skiplist();
+        Node* new_node = RelocateL1Node(l1_skiplist, log, node_paddr);
+#if defined(LISTDB_L0_CACHE) && LISTDB_L0_CACHE != L0_CACHE_T_SIMPLE
+        GetHashTable(shard)->Replace(node->key, node, new_node);
+#endif
+        size_t node_size = sizeof(Node) + (node->height() - 1) * sizeof(uint64_t);
+        if (new_node) {
+          num_nodes_relocated_.fetch_add(1, MO_RELAXED);
+          ThrottleBackgroundIo(&io_bytes, node_size, Env::IO_LOW);
+        }
+        offset += node_size;
+      }
     }
+    log->UnlinkBlocks(blocks);
+    log->EndRelocation();
+    num_log_blocks_reclaimed_.fetch_add(blocks.size(), MO_RELAXED);
   }
+}
 
-  PmemPtr node_paddr = l0_skiplist->head_paddr();
+// Moves an L1 node to the relocation chain of its log and relinks every
+// level that points to it. Returns the new node, or nullptr if the node is
+// not linked in L1. A node that has been copied but not fully relinked
+// before a crash is finished off with the copy already on level 0.
+ListDB::PmemNode* ListDB::RelocateL1Node(BraidedPmemSkipList* l1_skiplist, PmemLog* log, PmemPtr node_paddr) {
+  using Node = PmemNode;
+  Node* node = node_paddr.get<Node>();
+  int pool_id = node_paddr.pool_id();
+  int height = node->height();
+  uint64_t node_dump = node_paddr.dump();
+
+  // preds[i] is the node whose next[i] points to the node, if any
+  Node* preds[kMaxHeight];
+  Node* pred = l1_skiplist->head(pool_id);
+  bool linked = false;
+  for (int i = kMaxHeight - 1; i >= 0; i--) {
+    if (i == 0 && pred == l1_skiplist->head(pool_id)) {
+      pred = l1_skiplist->head();
+    }
+    while (true) {
+      Node* curr = ((PmemPtr*) &pred->next[i])->get<Node>();
+      if (curr && curr->key.Compare(node->key) < 0) {
+        pred = curr;
+        continue;
+      }
+      break;
+    }
+    preds[i] = nullptr;
+    if (i >= height) {
+      continue;
+    }
+    Node* p = pred;
+    while (true) {
+      uint64_t next_dump = p->next[i];
+      if (next_dump == node_dump) {
+        preds[i] = p;
+        linked = true;
+        break;
+      }
+      Node* curr = ((PmemPtr*) &next_dump)->get<Node>();
+      if (curr == nullptr || curr->key.Compare(node->key) != 0) {
+        break;
+      }
+      p = curr;
+    }
+  }
+  if (!linked) {
+    return nullptr;
+  }
+
+  size_t node_size = sizeof(Node) + (height - 1) * sizeof(uint64_t);
+  Node* new_node = nullptr;
+  PmemPtr new_paddr;
+  if (preds[0]) {
+    new_paddr = log->AllocateRelocation(node_size);
+    new_node = new_paddr.get<Node>();
+    memcpy((void*) new_node, (void*) node, node_size);
+    clwb(new_node, node_size);
+    sfence();
+  } else {
+    // Resumed relocation; level 0 already points to the copy
+    new_node = ((PmemPtr*) &pred->next[0])->get<Node>();
+    while (new_node && new_node->key.Compare(node->key) == 0 && new_node->tag != node->tag) {
+      new_node = ((PmemPtr*) &new_node->next[0])->get<Node>();
+    }
+    if (new_node == nullptr || new_node->key.Compare(node->key) != 0) {
+      return nullptr;
+    }
+    new_paddr = PmemPtr(((PmemPtr*) &pred->next[0])->pool_id(), (char*) new_node);
+  }
+  for (int i = 0; i < height; i++) {
+    if (preds[i]) {
+      preds[i]->next[i] = new_paddr.dump();
+      clwb(&preds[i]->next[i], 8);
+    }
+  }
+  sfence();
+  return new_node;
+}
+
+// Copies the L0 nodes into L1 in key order. The L0 chain is left untouched,
+// so a merge interrupted by a crash is simply run again: a key already copied
+// is found in L1 and takes the value swap path.
+void ListDB::L0CompactionCopyOnWrite(CompactionWorkerData* td, L0CompactionTask* task) {
+  auto l1_tl = GetTableList<PmemTableList>(1, task->shard);
+  if (l1_tl->partitions() == nullptr) {
+    // The L0 table becomes the first L1 partition
+    ZipperCompactionL0(td, task);
+    return;
+  }
+  if (task->shard == 0) fprintf(stdout, "L0 compaction (CoW)\n");
+  // A shard recovered in CoW mode may get here before any SetCompactionMode()
+  BindCowArenas();
 
+  using Node = PmemNode;
+  auto l0_manifest = task->l0->manifest<pmem_l0_info>();
+  if (l0_manifest->status != Level0Status::kMergeInitiated) {
+    l0_manifest->merge_mode = CompactionMode::kCopyOnWrite;
+    clwb(&l0_manifest->merge_mode, sizeof(CompactionMode));
+    sfence();
+    l0_manifest->status = Level0Status::kMergeInitiated;
+    clwb(&l0_manifest->status, sizeof(Level0Status));
+    sfence();
+  }
+  [[maybe_unused]] bool l1_cuts_done = ApplyL1Cuts(task->shard, false);
+  auto l1_parts = l1_tl->partitions();
+  std::vector<size_t> merged_size(l1_parts->tables.size(), 0);
+
+  auto l0_skiplist = task->l0->skiplist();
+  BraidedPmemSkipList* l1_skiplist = nullptr;
+  int l1_idx = -1;
+  Node* preds[kNumRegions][kMaxHeight];
+  Node* prev_l0_node = nullptr;
+
+  PmemPtr node_paddr = l0_skiplist->head()->next[0];
+  size_t io_bytes = 0;
   INIT_REPORTER_CLIENT;
   while (true) {
 #ifdef L0_COMPACTION_YIELD
@@ -2163,80 +4209,151 @@ void ListDB::L0CompactionCopyOnWrite(L0CompactionTask* task) {
     if (l0_node == nullptr) {
       break;
     }
-
     int pool_id = node_paddr.pool_id();
     int region = pool_id_to_region_[pool_id];
     int height = l0_node->height();
-    PmemPtr curr_paddr = preds[region][height - 1]->next[height - 1];
-    for (int i = height - 1; i > 0; i--) {
-      auto curr = curr_paddr.get<Node>();
-      while (curr) {
-        if (curr->key.Compare(l0_node->key) < 0) {
-          preds[region][i] = curr;
-          curr_paddr = curr->next[i];
-          curr = curr_paddr.get<Node>();
+    size_t node_size = sizeof(PmemNode) + (height - 1) * sizeof(uint64_t);
+    ThrottleBackgroundIo(&io_bytes, node_size + height * sizeof(uint64_t), Env::IO_MID);
+
+    // Older versions follow the newest one in L0
+    if (prev_l0_node && prev_l0_node->key.Compare(l0_node->key) == 0) {
+      l0_arena_[region][task->shard]->RetireEntry(node_paddr, node_size);
+      num_versions_merged_.fetch_add(1, MO_RELAXED);
+      node_paddr = l0_node->next[0];
+      REPORT_COMPACTION_OPS(1);
+      continue;
+    }
+    prev_l0_node = l0_node;
+
+    int idx = l1_tl->FindPartitionIndex(l1_parts, l0_node->key);
+    if (idx != l1_idx) {
+      l1_idx = idx;
+      l1_skiplist = l1_parts->tables[idx]->skiplist();
+      for (int r = 0; r < kNumRegions; r++) {
+        for (int i = 0; i < kMaxHeight; i++) {
+          preds[r][i] = l1_skiplist->head(l1_pool_id_[r]);
+        }
+      }
+      preds[0][0] = l1_skiplist->head();
+    }
+    // Both predecessors are before the node. Takes the one further right.
+    auto closer = [&](Node* a, Node* b, Node* head) {
+      if (b == l1_skiplist->head(l1_pool_id_[region]) ||
+          (a != head && b->key.Compare(a->key) <= 0)) {
+        return a;
+      }
+      return b;
+    };
+
+    // Upper levels of the region, then level 0
+    for (int i = kMaxHeight - 1; i > 0; i--) {
+      Node* head = l1_skiplist->head(l1_pool_id_[region]);
+      Node* pred = (i < kMaxHeight - 1) ? closer(preds[region][i], preds[region][i + 1], head) : preds[region][i];
+      while (true) {
+        Node* curr = ((PmemPtr*) &pred->next[i])->get<Node>();
+        if (curr && curr->key.Compare(l0_node->key) < 0) {
+          pred = curr;
           continue;
         }
         break;
       }
-      succs[region][i] = curr_paddr.dump();
+      preds[region][i] = pred;
     }
     {
-      PmemPtr curr_paddr = preds[0][0]->next[0];
-      auto curr = curr_paddr.get<Node>();
-      while (curr) {
-        if (curr->key.Compare(l0_node->key) < 0) {
-          preds[0][0] = curr;
-          curr_paddr = curr->next[0];
-          curr = curr_paddr.get<Node>();
+      Node* pred = closer(preds[0][0], preds[region][1], l1_skiplist->head());
+      while (true) {
+        Node* curr = ((PmemPtr*) &pred->next[0])->get<Node>();
+        if (curr && curr->key.Compare(l0_node->key) < 0) {
+          pred = curr;
           continue;
         }
         break;
       }
-      succs[0][0] = curr_paddr.dump();
+      preds[0][0] = pred;
     }
 
-    size_t node_size = sizeof(PmemNode) + (height - 1) * 8;
-    auto l1_node_paddr = l1_arena_[region][task->shard]->Allocate(node_size);
-    auto l1_node = l1_node_paddr.get<Node>();
-    l1_node->key = l0_node->key;
-    l1_node->tag = l0_node->tag;
-    l1_node->value = l0_node->value;
-    l1_node->next[0] = succs[0][0];
-    for (int i = 1; i < height; i++) {
-      l1_node->next[i] = succs[region][i];
-    }
-    clwb(l1_node, node_size);
-    _mm_sfence();
-    preds[0][0]->next[0] = l1_node_paddr.dump();
-    for (int i = 1 ;i < height; i++) {
-      preds[region][i]->next[i] = l1_node_paddr.dump();
+    Node* old_node = ((PmemPtr*) &preds[0][0]->next[0])->get<Node>();
+    if (old_node && old_node->key.Compare(l0_node->key) == 0) {
+      if (old_node->value != l0_node->value) {
+        old_node->value = l0_node->value;
+        clwb(&old_node->value, 8);
+        sfence();
+      }
+      num_versions_merged_.fetch_add(1, MO_RELAXED);
+    } else {
+      auto l1_node_paddr = cow_arena_[region][task->shard]->Allocate(node_size);
+      auto l1_node = l1_node_paddr.get<Node>();
+      l1_node->key = l0_node->key;
+      l1_node->tag = l0_node->tag;
+      l1_node->value = l0_node->value;
+      l1_node->next[0] = preds[0][0]->next[0];
+      for (int i = 1; i < height; i++) {
+        l1_node->next[i] = preds[region][i]->next[i];
+      }
+      clwb(l1_node, node_size);
+      sfence();
+      preds[0][0]->next[0] = l1_node_paddr.dump();
+      clwb(&preds[0][0]->next[0], 8);
+      sfence();
+      for (int i = 1; i < height; i++) {
+        preds[region][i]->next[i] = l1_node_paddr.dump();
+      }
+      preds[0][0] = l1_node;
+      for (int i = 1; i < height; i++) {
+        preds[region][i] = l1_node;
+      }
+      merged_size[idx] += l0_node->key.size() + sizeof(Value);
+#ifdef LISTDB_SKIPLIST_CACHE
+      if (height >= kSkipListCacheMinPmemHeight) {
+        cache_[task->shard][region]->Insert(l1_node);
+      }
+#endif
     }
-
+    l0_arena_[region][task->shard]->RetireEntry(node_paddr, node_size);
     REPORT_COMPACTION_OPS(1);
-    
     node_paddr = l0_node->next[0];
   }
   REPORT_DONE;  // Up report all remainings
+  for (size_t i = 0; i < merged_size.size(); i++) {
+    SetL1PartitionSize(l1_parts->tables[i], l1_parts->tables[i]->size() + merged_size[i]);
+  }
+
+  // Update manifest
+  l0_manifest->status = Level0Status::kMergeDone;
+  clwb(&l0_manifest->status, sizeof(Level0Status));
+  sfence();
 
   // Remove empty L0 from MemTableList
-  //auto tl = ll_[task->shard]->GetTableList(0);
-  auto table = task->memtable_list->GetFront();
-  while (true) {
-    auto next_table = table->Next();
-    if (next_table) {
-      if (next_table == (Table*) task->l0) {
-        table->SetNext(nullptr);
+  task->memtable_list->RemoveTable(task->l0);
+
+#ifdef LISTDB_L1_PARTITION
+  // One split at a time, after the tail of the last one is cut
+  if (l1_cuts_done) {
+    for (size_t i = 0; i < l1_parts->tables.size(); i++) {
+      if (l1_parts->tables[i]->size() > l1_partition_split_size_) {
+        SplitL1Partition(task->shard, i);
         break;
       }
-      table = next_table;
-    } else {
-      break;
     }
   }
+#endif
+}
+
+void ListDB::SetCompactionMode(int shard, CompactionMode mode) {
+  if (mode == CompactionMode::kCopyOnWrite) {
+    BindCowArenas();
+  }
+  auto db_pool = Pmem::pool<pmem_db>(0);
+  auto shard_manifest = db_pool.root()->shard[shard];
+  shard_manifest->compaction_mode = mode;
+  clwb(&shard_manifest->compaction_mode, sizeof(CompactionMode));
+  sfence();
+  compaction_mode_[shard].store(mode);
 }
 
 void ListDB::PrintDebugLsmState(int shard) {
+  WaitForShardRecovery(shard);
+  EpochManager::Guard guard(&epoch_);
   auto tl = GetTableList(0, shard);
   auto table = tl->GetFront();
   int mem_cnt = 0;
@@ -2272,10 +4389,70 @@ int ListDB::GetStatString(const std::string& name, std::string* buf) {
   #else
     rv = 1;
   #endif
+  } else if (name == "gc_stats") {
+    size_t obsolete_bytes = 0;
+    for (int i = 0; i < kNumRegions; i++) {
+      for (int j = 0; j < kNumShards; j++) {
+        obsolete_bytes += l0_arena_[i][j]->obsolete_bytes();
+      }
+    }
+    ss << "versions merged: " << num_versions_merged_.load() << std::endl;
+    ss << "obsolete log bytes: " << obsolete_bytes << std::endl;
+    ss << "log blocks reclaimed: " << num_log_blocks_reclaimed_.load() << std::endl;
+    ss << "nodes relocated: " << num_nodes_relocated_.load() << std::endl;
+  } else if (name == "write_stall_stats") {
+    int num_delayed = 0;
+    int num_stopped = 0;
+    int64_t min_rate = kDelayedWriteRate;
+    uint64_t delayed_writes = 0;
+    uint64_t delay_usec = 0;
+    uint64_t stops = 0;
+    uint64_t stop_usec = 0;
+    for (int i = 0; i < kNumShards; i++) {
+      auto wc = GetTableList<MemTableList>(0, i)->write_controller();
+      auto state = wc->state();
+      if (state == WriteController::State::kDelayed) {
+        num_delayed++;
+        min_rate = std::min(min_rate, wc->delayed_write_rate());
+      } else if (state == WriteController::State::kStopped) {
+        num_stopped++;
+      }
+      delayed_writes += wc->num_delayed_writes();
+      delay_usec += wc->delay_usec();
+      stops += wc->num_stops();
+      stop_usec += wc->stop_usec();
+    }
+    ss << "delayed shards: " << num_delayed << " (min rate: " << min_rate << " B/s)" << std::endl;
+    ss << "stopped shards: " << num_stopped << std::endl;
+    ss << "delayed writes: " << delayed_writes << " (" << delay_usec << " usec)" << std::endl;
+    ss << "stops: " << stops << " (" << stop_usec << " usec)" << std::endl;
+  } else if (name == "bg_io_stats") {
+    ss << "budget: " << bg_io_limiter_->GetBytesPerSecond() << " B/s" << std::endl;
+    ss << "flush bytes: " << bg_io_limiter_->GetTotalBytesThrough(Env::IO_HIGH) << std::endl;
+    ss << "compaction bytes: " << bg_io_limiter_->GetTotalBytesThrough(Env::IO_MID) << std::endl;
+    ss << "log reclamation bytes: " << bg_io_limiter_->GetTotalBytesThrough(Env::IO_LOW) << std::endl;
+    ss << "write latency: " << write_latency_last_.load(MO_RELAXED) << " ns (baseline: "
+       << write_latency_baseline_.load(MO_RELAXED) << " ns)" << std::endl;
+  } else if (name == "memtable_capacity") {
+    size_t min = std::numeric_limits<size_t>::max();
+    size_t max = 0;
+    size_t sum = 0;
+    for (int i = 0; i < kNumShards; i++) {
+      size_t capacity = GetTableList<MemTableList>(0, i)->table_capacity();
+      min = std::min(min, capacity);
+      max = std::max(max, capacity);
+      sum += capacity;
+    }
+    ss << name << ": " << sum << " (per shard min: " << min << ", max: " << max << ")";
+  } else if (name == "epoch_retired") {
+    ss << name << ": " << epoch_.num_retired();
   } else if (name == "flush_stats") {
-    for (int i = 0; i < kNumWorkers; i++) {
+    for (size_t i = 0; i < worker_data_.size(); i++) {
       ss << "worker " << i << ": flush_cnt = " << worker_data_[i].flush_cnt << " flush_time_usec = " << worker_data_[i].flush_time_usec << std::endl;
     }
+    ss << "memtables flushed to L1: " << num_l1_flushes_.load() << std::endl;
+  } else if (name == "zipper_stats") {
+    ss << "zipper merges: " << num_zipper_merges_.load() << " (partitions: " << num_zipper_partitions_.load() << ")";
   } else {
     ss << "Unknown name: " << name;
     rv = 1;
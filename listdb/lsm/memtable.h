@@ -18,12 +18,17 @@ class MemTable : public Table {
 
   virtual bool Get(const Key& key, void** value_out) override;
 
-  bool IsFlushed() { return (l0_ != nullptr); }
+  bool IsFlushed() { return (l0_ != nullptr || flushed_to_l1_); }
 
   void SetPersistentTable(Table* pmemtable) { l0_ = pmemtable; }
 
   Table* PersistentTable() { return l0_; }
 
+  // Flushed into L1 without an L0 table
+  void SetFlushedToL1() { flushed_to_l1_ = true; }
+
+  bool IsFlushedToL1() { return flushed_to_l1_; }
+
   lockfree_skiplist* skiplist() { return skiplist_; }
 
   BraidedPmemSkipList* l0_skiplist() { return l0_skiplist_; }
@@ -36,12 +41,19 @@ class MemTable : public Table {
 
   uint64_t l0_id() const { return l0_manifest_->id; }
 
+  // Log blocks of each region allocated before this table became mutable
+  void SetLogBlockMark(int region, uint32_t block_cnt) { log_block_mark_[region] = block_cnt; }
+
+  uint32_t log_block_mark(int region) { return log_block_mark_[region]; }
+
  private:
   lockfree_skiplist* skiplist_;
   BraidedPmemSkipList* l0_skiplist_ = nullptr;
   // TODO(wkim): use PmemTable*
   Table* l0_ = nullptr;
+  bool flushed_to_l1_ = false;
   pmem::obj::persistent_ptr<pmem_l0_info> l0_manifest_ = nullptr;
+  uint32_t log_block_mark_[kNumRegions] = {};
 };
 
 MemTable::MemTable(const size_t table_capacity) : Table(table_capacity, TableType::kMemTable) {
@@ -1,11 +1,15 @@
 #ifndef LISTDB_LSM_MEMTABLE_LIST_H_
 #define LISTDB_LSM_MEMTABLE_LIST_H_
 
+#include <algorithm>
 #include <condition_variable>
 #include <functional>
 
 #include "listdb/lsm/table_list.h"
 #include "listdb/lsm/memtable.h"
+#include "listdb/lsm/pmemtable.h"
+#include "listdb/lsm/write_controller.h"
+#include "listdb/pmem/persist.h"
 
 class MemTableList : public TableList {
  public:
@@ -17,21 +21,37 @@ class MemTableList : public TableList {
 
   void CleanUpFlushedImmutables();
 
+  // Unlinks an L0 table combined into an older one
+  void RemoveTable(Table* table);
+
   void CreateNewFront();
 
+  int num_memtables();
+
+  // Bytes taken by the mutable memtables so far
+  size_t written_bytes();
+
+  WriteController* write_controller() { return &write_controller_; }
+
+  // Must be set before the first write
+  void SetMaxNumMemTables(int n);
+
  protected:
   virtual Table* NewMutable(size_t table_capacity, Table* next_table) override;
 
   virtual void EnqueueCompaction(Table* table) override;
 
   const int shard_id_;
-  const int max_num_memtables_ = kMaxNumMemTables;
+  int max_num_memtables_ = kMaxNumMemTables;
   int num_memtables_ = 0;
+  std::atomic<size_t> sealed_bytes_{0};
   std::function<void(MemTable*)> enqueue_fn_;
 
   PmemLog* arena_[kNumRegions];
+  WriteController write_controller_;
 
   std::mutex mu_;
+  std::mutex unlink_mu_;  // serializes relinking of the immutable tables
   std::condition_variable cv_;
 };
 
@@ -42,20 +62,24 @@ void MemTableList::BindEnqueueFunction(std::function<void(MemTable*)> enqueue_fn
   enqueue_fn_ = enqueue_fn;
 }
 
+void MemTableList::SetMaxNumMemTables(int n) {
+  max_num_memtables_ = n;
+  write_controller_.SetMaxNumMemTables(n);
+}
+
 void MemTableList::BindArena(int region, PmemLog* arena) {
   arena_[region] = arena;
 }
 
 inline Table* MemTableList::NewMutable(size_t table_capacity, Table* next_table) {
   std::unique_lock<std::mutex> lk(mu_);
-  cv_.wait(lk, [&]{
-    if (num_memtables_ < max_num_memtables_) {
-      return true;
-    } else {
-      fprintf(stdout, "Stall\n");
-      return false;
-    }
-  });
+  if (num_memtables_ >= max_num_memtables_) {
+    uint64_t begin_micros = Clock::NowMicros();
+    EpochManager::Suspend();
+    cv_.wait(lk, [&]{ return num_memtables_ < max_num_memtables_; });
+    EpochManager::Resume();
+    write_controller_.RecordStop(Clock::NowMicros() - begin_micros);
+  }
   num_memtables_++;
   lk.unlock();
   MemTable* new_table = new MemTable(table_capacity);  // TODO(wkim): a table must have an ID
@@ -65,7 +89,8 @@ inline Table* MemTableList::NewMutable(size_t table_capacity, Table* next_table)
     auto next_memtable = (MemTable*) next_table;
     auto next_l0_manifest = next_memtable->l0_manifest();
     next_l0_manifest->status = Level0Status::kFull;
-    // call clwb
+    clwb(&next_l0_manifest->status, sizeof(Level0Status));
+    sfence();
   }
 
   // Init the new manifest for a new table
@@ -75,6 +100,7 @@ inline Table* MemTableList::NewMutable(size_t table_capacity, Table* next_table)
   auto db_root = db_pool.root();
   auto shard_manifest = db_root->shard[shard_id_];
   l0_manifest->id = shard_manifest->l0_cnt++;
+  l0_manifest->id_end = l0_manifest->id;
   l0_manifest->status = Level0Status::kInitialized;
   BraidedPmemSkipList* l0_skiplist = new BraidedPmemSkipList(arena_[0]->pool_id());
   for (int i = 0; i < kNumRegions; i++) {
@@ -87,23 +113,54 @@ inline Table* MemTableList::NewMutable(size_t table_capacity, Table* next_table)
   }
   l0_manifest->next = shard_manifest->l0_list_head->next;
   shard_manifest->l0_list_head->next = l0_manifest;
+  for (int i = 0; i < kNumRegions; i++) {
+    new_table->SetLogBlockMark(i, arena_[i]->block_cnt());
+  }
   new_table->SetL0SkipList(l0_skiplist);
   new_table->SetL0Manifest(l0_manifest);
   new_table->SetNext(next_table);
   return new_table;
 }
 
+int MemTableList::num_memtables() {
+  std::lock_guard<std::mutex> lk(mu_);
+  return num_memtables_;
+}
+
+size_t MemTableList::written_bytes() {
+  size_t bytes = sealed_bytes_.load(MO_RELAXED);
+  auto front = front_.load(MO_RELAXED);
+  if (front) {
+    bytes += std::min(front->size(), front->capacity());
+  }
+  return bytes;
+}
+
 inline void MemTableList::EnqueueCompaction(Table* table) {
   //fprintf(stdout, "Enqueue\n");
-  enqueue_fn_((MemTable*) table);
+  sealed_bytes_.fetch_add(std::min(table->size(), table->capacity()), MO_RELAXED);
+  // The region whose log grew the most while the table was mutable
+  auto mem = (MemTable*) table;
+  int home_region = 0;
+  uint32_t max_blocks = 0;
+  for (int i = 0; i < kNumRegions; i++) {
+    uint32_t num_blocks = arena_[i]->block_cnt() - mem->log_block_mark(i);
+    if (num_blocks > max_blocks) {
+      max_blocks = num_blocks;
+      home_region = i;
+    }
+  }
+  mem->SetHomeRegion(home_region);
+  enqueue_fn_(mem);
 }
 
 void MemTableList::CleanUpFlushedImmutables() {
-#if LISTDB_FLUSH_MEMTABLE_TO_L1 == 1
+#if defined(LISTDB_WAL) && LISTDB_FLUSH_MEMTABLE_TO_L1 == 1
   std::unique_lock<std::mutex> lk(mu_);
   num_memtables_--;
   cv_.notify_one();
 #else
+  std::unique_lock<std::mutex> unlink_lk(unlink_mu_);
   auto curr = GetFront();
   std::vector<Table*> tables;
   while (curr) {
@@ -117,7 +174,15 @@ void MemTableList::CleanUpFlushedImmutables() {
   for (int i = tables.size() - 1; i >= 1; i--) {
     if (tables[i]->type() == TableType::kMemTable) {
       MemTable* imm = (MemTable*) tables[i];
-      if (imm->IsFlushed()) {
+      if (imm->IsFlushedToL1()) {
+        tables[i - 1]->SetNext(imm->Next());
+        flushed_cnt++;
+        auto l0_skiplist = imm->l0_skiplist();
+        epoch_->Retire([imm, l0_skiplist] {
+          delete l0_skiplist;
+          delete imm;
+        });
+      } else if (imm->IsFlushed()) {
         //pmemtables.push_back((Table*) imm->PersistentTable());
         auto pmem = (Table*) imm->PersistentTable();
         if (imm->Next()) {
@@ -129,7 +194,7 @@ void MemTableList::CleanUpFlushedImmutables() {
         pred->SetNext(pmem);
 
         flushed_cnt++;
-        // TODO(wkim): free imm
+        epoch_->Retire([imm] { delete imm; });
       } else {
         break;
       }
@@ -143,6 +208,7 @@ void MemTableList::CleanUpFlushedImmutables() {
   //  pred->SetNext(pmemtables.back());
   //}
 
+  unlink_lk.unlock();
   std::unique_lock<std::mutex> lk(mu_);
   num_memtables_ -= flushed_cnt;
   lk.unlock();
@@ -150,10 +216,27 @@ void MemTableList::CleanUpFlushedImmutables() {
 #endif
 }
 
+void MemTableList::RemoveTable(Table* table) {
+  std::lock_guard<std::mutex> lk(unlink_mu_);
+  auto curr = GetFront();
+  while (curr) {
+    if (curr->Next() == table) {
+      curr->SetNext(table->Next());
+      auto pmem = (PmemTable*) table;
+      epoch_->Retire([pmem] {
+        delete pmem->skiplist();
+        delete pmem;
+      });
+      break;
+    }
+    curr = curr->Next();
+  }
+}
+
 void MemTableList::CreateNewFront() {
   std::unique_lock<std::mutex> lk(init_mu_);
   auto table = front_.load(MO_RELAXED);
-  auto new_table = NewMutable(table_capacity_, table);
+  auto new_table = NewMutable(table_capacity_.load(MO_RELAXED), table);
   front_.store(new_table, MO_RELAXED);
   lk.unlock();
 }
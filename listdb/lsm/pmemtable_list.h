@@ -1,6 +1,9 @@
 #ifndef LISTDB_LSM_PMEMTABLE_LIST_H_
 #define LISTDB_LSM_PMEMTABLE_LIST_H_
 
+#include <algorithm>
+#include <vector>
+
 #include "listdb/lsm/table_list.h"
 #include "listdb/lsm/pmemtable.h"
 
@@ -8,13 +11,29 @@ class PmemTableList : public TableList {
  public:
   PmemTableList(const size_t table_capacity, const int primary_region_pool_id);
 
+  // Key-range partitions, ordered by begin key. Readers take a snapshot.
+  // Only the compaction of the shard publishes a new one.
+  struct Partitions {
+    std::vector<Key> begin_keys;
+    std::vector<PmemTable*> tables;
+  };
+
   void BindArena(int pool_id, PmemLog* arena);
 
+  Partitions* partitions() { return partitions_.load(std::memory_order_acquire); }
+
+  void SetPartitions(Partitions* partitions);
+
+  int FindPartitionIndex(Partitions* partitions, const Key& key);
+
+  PmemTable* FindPartition(const Key& key);
+
  protected:
   virtual Table* NewMutable(size_t table_capacity, Table* next_table) override;
 
   const int primary_region_pool_id_;
   std::map<int, PmemLog*> arena_;
+  std::atomic<Partitions*> partitions_{nullptr};
 };
 
 PmemTableList::PmemTableList(const size_t table_capacity, const int primary_region_pool_id)
@@ -24,6 +43,29 @@ void PmemTableList::BindArena(const int pool_id, PmemLog* arena) {
   arena_.emplace(pool_id, arena);
 }
 
+void PmemTableList::SetPartitions(Partitions* partitions) {
+  SetFront(partitions->tables[0]);
+  auto old_partitions = partitions_.exchange(partitions, std::memory_order_release);
+  if (old_partitions) {
+    epoch_->Retire([old_partitions] { delete old_partitions; });
+  }
+}
+
+inline int PmemTableList::FindPartitionIndex(Partitions* partitions, const Key& key) {
+  auto& begin_keys = partitions->begin_keys;
+  auto it = std::upper_bound(begin_keys.begin(), begin_keys.end(), key,
+      [](const Key& a, const Key& b) { return a.Compare(b) < 0; });
+  return (it == begin_keys.begin()) ? 0 : (it - begin_keys.begin() - 1);
+}
+
+inline PmemTable* PmemTableList::FindPartition(const Key& key) {
+  auto p = partitions();
+  if (p == nullptr) {
+    return nullptr;
+  }
+  return p->tables[FindPartitionIndex(p, key)];
+}
+
 inline Table* PmemTableList::NewMutable(size_t table_capacity, Table* next_table) {
   // Bind Arena
   auto skiplist = new BraidedPmemSkipList(primary_region_pool_id_);
@@ -10,6 +10,8 @@ class Table {
  public:
   Table(const size_t capacity, TableType type);
 
+  virtual ~Table() = default;
+
   virtual void* Put(const Key& key, const Value& value) = 0;
 
   virtual bool Get(const Key& key, void** value_out) = 0;
@@ -22,15 +24,18 @@ class Table {
 
   Table* Next(const std::memory_order mo = std::memory_order_seq_cst);
 
-  void w_Ref(const std::memory_order mo = std::memory_order_seq_cst);
+  bool HasRoom(const size_t size, const std::memory_order mo = std::memory_order_seq_cst);
 
-  void w_UnRef(const std::memory_order mo = std::memory_order_seq_cst);
+  void SetSize(const size_t size) { size_.store(size); }
 
-  bool HasRoom(const size_t size, const std::memory_order mo = std::memory_order_seq_cst);
+  size_t size() { return size_.load(MO_RELAXED); }
 
-  int64_t w_RefCount () { return writer_ref_cnt_ - writer_unref_cnt_; }
+  size_t capacity() { return capacity_; }
 
-  void SetSize(const size_t size) { size_.store(size); }
+  // Region holding most of the data; -1 if unknown
+  int home_region() { return home_region_; }
+
+  void SetHomeRegion(const int region) { home_region_ = region; }
 
   //void RetireSize(const size_t size) {
   //  size_retired_.fetch_add(size, std::memory_order_relaxed);
@@ -41,10 +46,9 @@ class Table {
  protected:
   const size_t capacity_;
   TableType type_;
-  std::atomic<int64_t> writer_ref_cnt_ = 0;
   std::atomic<size_t> size_;
-  std::atomic<int64_t> writer_unref_cnt_ = 0;
   std::atomic<Table*> next_;
+  int home_region_ = -1;
   //std::atomic<size_t> size_retired_;
 };
 
@@ -58,15 +62,6 @@ inline Table* Table::Next(const std::memory_order mo) {
   return next_.load(mo);
 }
 
-// XXX: fetch_add with relaxed memory order is effectively promoted to seq_cst for x86-64.
-inline void Table::w_Ref(const std::memory_order mo) {
-  writer_ref_cnt_.fetch_add(1, mo);
-}
-
-inline void Table::w_UnRef(const std::memory_order mo) {
-  writer_unref_cnt_.fetch_add(1, mo);
-}
-
 inline bool Table::HasRoom(const size_t size, const std::memory_order mo) {
   const size_t before = size_.fetch_add(size, mo);
   return (before + size <= capacity_);
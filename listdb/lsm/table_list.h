@@ -5,6 +5,7 @@
 #include <mutex>
 
 #include "listdb/common.h"
+#include "listdb/lib/epoch.h"
 #include "listdb/lsm/table.h"
 //#include "listdb/lsm/table_v2.h"
 
@@ -24,16 +25,26 @@ class TableList {
 
   Table* GetFront();
 
+  // The caller must hold an epoch guard until it is done with the table
   Table* GetMutable(const size_t size);
 
+  // Applies to the next mutable table
+  void SetTableCapacity(const size_t table_capacity) { table_capacity_.store(table_capacity, MO_RELAXED); }
+
+  size_t table_capacity() { return table_capacity_.load(MO_RELAXED); }
+
+  // Unlinked tables are freed through it
+  void BindEpochManager(EpochManager* epoch) { epoch_ = epoch; }
+
  protected:
   virtual Table* NewMutable(size_t table_capacity, Table* next_table) = 0;
 
   virtual void EnqueueCompaction(Table* table) { return; };
 
-  const size_t table_capacity_;
+  std::atomic<size_t> table_capacity_;
   std::mutex init_mu_;
   std::atomic<Table*> front_;
+  EpochManager* epoch_ = nullptr;
 };
 
 TableList::TableList(const size_t table_capacity) : table_capacity_(table_capacity), front_(nullptr) { }
@@ -42,7 +53,6 @@ void* TableList::Put(const Key& key, const Value& value) {
   const size_t kv_size = key.size() + 8;
   auto table = GetMutable(kv_size);
   auto ret = table->Put(key, value);
-  table->w_UnRef();
   return ret;
 }
 
@@ -80,7 +90,7 @@ Table* TableList::GetFront() {
     std::lock_guard<std::mutex> lk(init_mu_);
     ret = front_.load(MO_RELAXED);
     if (ret == nullptr) {
-      ret = NewMutable(table_capacity_, nullptr);
+      ret = NewMutable(table_capacity_.load(MO_RELAXED), nullptr);
       front_.store(ret, MO_RELAXED);
     }
   }
@@ -89,18 +99,16 @@ Table* TableList::GetFront() {
 
 Table* TableList::GetMutable(const size_t size) {
   auto table = GetFront();
-  table->w_Ref(MO_RELAXED);
   if (!table->HasRoom(size)) {
-    table->w_UnRef(MO_RELAXED);
+    // The holder of the lock may wait for a flush, which waits for the pinned
+    EpochManager::Suspend();
     // >>> IMPLICIT MFENCE
     std::unique_lock<std::mutex> lk(init_mu_);
+    EpochManager::Resume();
     table = front_.load(MO_RELAXED);
-    table->w_Ref(MO_RELAXED);
     if (!table->HasRoom(size)) {
-      table->w_UnRef(MO_RELAXED);
-      auto new_table = NewMutable(table_capacity_, table);
+      auto new_table = NewMutable(table_capacity_.load(MO_RELAXED), table);
       new_table->HasRoom(size);
-      new_table->w_Ref(MO_RELAXED);
       front_.store(new_table, MO_RELAXED);
       lk.unlock();
       EnqueueCompaction(table);
@@ -0,0 +1,111 @@
+#ifndef LISTDB_LSM_WRITE_CONTROLLER_H_
+#define LISTDB_LSM_WRITE_CONTROLLER_H_
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "listdb/common.h"
+#include "listdb/env.h"
+#include "listdb/util/clock.h"
+#include "listdb/util/rate_limiter.h"
+
+// Paces the writers of a shard before the MemTableList runs out of
+// memtables. The delayed write rate is halved for every immutable memtable
+// or L0 table beyond the slowdown triggers. The hard stop in
+// MemTableList::NewMutable() is left as the last resort.
+class WriteController {
+ public:
+  enum class State {
+    kNormal,
+    kDelayed,
+    kStopped,
+  };
+
+  WriteController();
+
+  // The slowdown trigger keeps its distance from the limit
+  void SetMaxNumMemTables(int n);
+
+  void Update(int num_immutables, int num_l0_tables);
+
+  // Blocks the caller as long as the shard is delayed
+  void Throttle(size_t bytes);
+
+  void RecordStop(uint64_t stop_usec);
+
+  State state() { return state_.load(MO_RELAXED); }
+
+  int64_t delayed_write_rate() { return limiter_->GetBytesPerSecond(); }
+
+  uint64_t num_delayed_writes() { return num_delayed_writes_.load(MO_RELAXED); }
+
+  uint64_t delay_usec() { return delay_usec_.load(MO_RELAXED); }
+
+  uint64_t num_stops() { return num_stops_.load(MO_RELAXED); }
+
+  uint64_t stop_usec() { return stop_usec_.load(MO_RELAXED); }
+
+ private:
+  int max_num_memtables_ = kMaxNumMemTables;
+  int slowdown_immutable_memtables_ = kSlowdownImmutableMemTables;
+  std::atomic<State> state_{State::kNormal};
+  std::unique_ptr<RateLimiter> limiter_;
+  std::mutex mu_;
+
+  std::atomic<uint64_t> num_delayed_writes_{0};
+  std::atomic<uint64_t> delay_usec_{0};
+  std::atomic<uint64_t> num_stops_{0};
+  std::atomic<uint64_t> stop_usec_{0};
+};
+
+WriteController::WriteController()
+    : limiter_(NewGenericRateLimiter(kDelayedWriteRate, kDelayedWriteRefillUsec)) { }
+
+void WriteController::SetMaxNumMemTables(int n) {
+  max_num_memtables_ = n;
+  slowdown_immutable_memtables_ = std::max(1, n - (kMaxNumMemTables - kSlowdownImmutableMemTables));
+}
+
+void WriteController::Update(int num_immutables, int num_l0_tables) {
+  int steps = 0;
+  if (num_immutables >= slowdown_immutable_memtables_) {
+    steps += num_immutables - slowdown_immutable_memtables_ + 1;
+  }
+  if (num_l0_tables >= kSlowdownL0Tables) {
+    steps += num_l0_tables - kSlowdownL0Tables + 1;
+  }
+
+  std::lock_guard<std::mutex> lk(mu_);
+  if (num_immutables >= max_num_memtables_ - 1) {
+    // The next memtable switch stalls in NewMutable()
+    state_.store(State::kStopped, MO_RELAXED);
+  } else if (steps > 0) {
+    state_.store(State::kDelayed, MO_RELAXED);
+  } else {
+    state_.store(State::kNormal, MO_RELAXED);
+    return;
+  }
+  int64_t rate = std::max<int64_t>(kMinDelayedWriteRate, kDelayedWriteRate >> std::min(std::max(steps - 1, 0), 62));
+  if (rate != limiter_->GetBytesPerSecond()) {
+    limiter_->SetBytesPerSecond(rate);
+  }
+}
+
+inline void WriteController::Throttle(size_t bytes) {
+  if (state_.load(MO_RELAXED) == State::kNormal) {
+    return;
+  }
+  uint64_t begin_micros = Clock::NowMicros();
+  limiter_->Request(bytes, Env::IO_USER);
+  num_delayed_writes_.fetch_add(1, MO_RELAXED);
+  delay_usec_.fetch_add(Clock::NowMicros() - begin_micros, MO_RELAXED);
+}
+
+void WriteController::RecordStop(uint64_t stop_usec) {
+  num_stops_.fetch_add(1, MO_RELAXED);
+  stop_usec_.fetch_add(stop_usec, MO_RELAXED);
+}
+
+#endif  // LISTDB_LSM_WRITE_CONTROLLER_H_
@@ -0,0 +1,180 @@
+#ifndef LISTDB_PMEM_PERSIST_H_
+#define LISTDB_PMEM_PERSIST_H_
+
+#include <x86intrin.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <libpmem.h>
+
+#ifdef LISTDB_PMEM_EMULATION
+#include "listdb/pmem/pmem_emulation.h"
+#endif
+
+// How stores reach the persistence domain.
+//   kAdr: clwb the lines, then sfence.
+//   kEadr: the caches are persistent. No flush, and a fence only has to
+//     keep the compiler from reordering the stores.
+//   kNtStore: like kAdr, but Store() bypasses the cache, so the lines it
+//     wrote need no flush.
+//   kCounting: like kAdr, and counts the flushed lines and the fences.
+class Persist {
+ public:
+  enum Mode { kAdr, kEadr, kNtStore, kCounting };
+
+  // LISTDB_PERSIST_MODE (adr, eadr, ntstore or counting) if set, kEadr if
+  // the platform flushes the caches on power failure, kAdr otherwise
+  static Mode DefaultMode();
+
+  // Not thread-safe, call it before the first write
+  static void SetMode(Mode mode) { mode_ = mode; }
+
+  static Mode mode() { return mode_; }
+
+  static void Flush(const void* addr, size_t size);
+
+  static void Fence();
+
+  // Writes a word-aligned object that is persisted by FlushStored()
+  template <typename T>
+  static void Store(T* dst, const T& value);
+
+  static void FlushStored(const void* addr, size_t size);
+
+  static uint64_t num_flushed_lines() { return Sum(flushed_lines_); }
+
+  static uint64_t num_fences() { return Sum(fences_); }
+
+  static void ResetCounters();
+
+ private:
+  static constexpr int kNumStripes = 64;
+
+  struct alignas(64) Counter {
+    std::atomic<uint64_t> cnt;
+  };
+
+  static size_t FlushLines(const void* addr, size_t size);
+
+  static void Count(Counter* counters, uint64_t n);
+
+  static uint64_t Sum(const Counter* counters);
+
+  inline static Mode mode_ = kAdr;
+  inline static Counter flushed_lines_[kNumStripes];
+  inline static Counter fences_[kNumStripes];
+  inline static std::atomic<int> next_stripe_{0};
+  inline static thread_local int stripe_ = -1;
+};
+
+Persist::Mode Persist::DefaultMode() {
+  const char* env = getenv("LISTDB_PERSIST_MODE");
+  if (env == nullptr) {
+    return (pmem_has_auto_flush() == 1) ? kEadr : kAdr;
+  }
+  if (strcmp(env, "adr") == 0) {
+    return kAdr;
+  } else if (strcmp(env, "eadr") == 0) {
+    return kEadr;
+  } else if (strcmp(env, "ntstore") == 0) {
+    return kNtStore;
+  } else if (strcmp(env, "counting") == 0) {
+    return kCounting;
+  }
+  fprintf(stderr, "unknown LISTDB_PERSIST_MODE: %s\n", env);
+  exit(1);
+}
+
+// Returns the number of lines, which the range may cross at any offset
+inline size_t Persist::FlushLines(const void* addr, size_t size) {
+  uintptr_t begin = (uintptr_t) addr & ~((uintptr_t) 63);
+  uintptr_t end = (uintptr_t) addr + size;
+  for (uintptr_t line = begin; line < end; line += 64) {
+    asm volatile(".byte 0x66; xsaveopt %0" : "+m" \
+      (*(volatile char *)(line)));
+  }
+  return (end - begin + 63) / 64;
+}
+
+inline void Persist::Flush(const void* addr, size_t size) {
+  if (mode_ == kEadr) {
+    return;
+  }
+  size_t num_lines = FlushLines(addr, size);
+#ifdef LISTDB_PMEM_EMULATION
+  PmemEmulation::OnFlush(num_lines);
+#endif
+  if (mode_ == kCounting) {
+    Count(flushed_lines_, num_lines);
+  }
+}
+
+inline void Persist::Fence() {
+  if (mode_ == kEadr) {
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    return;
+  }
+  _mm_sfence();
+#ifdef LISTDB_PMEM_EMULATION
+  PmemEmulation::OnFence();
+#endif
+  if (mode_ == kCounting) {
+    Count(fences_, 1);
+  }
+}
+
+template <typename T>
+inline void Persist::Store(T* dst, const T& value) {
+  static_assert(sizeof(T) % sizeof(long long) == 0, "Store() writes whole words");
+  if (mode_ != kNtStore) {
+    *dst = value;
+    return;
+  }
+  const long long* src = (const long long*) &value;
+  for (size_t i = 0; i < sizeof(T) / sizeof(long long); i++) {
+    _mm_stream_si64((long long*) dst + i, src[i]);
+  }
+}
+
+inline void Persist::FlushStored(const void* addr, size_t size) {
+  if (mode_ == kNtStore) {
+    return;
+  }
+  Flush(addr, size);
+}
+
+inline void Persist::Count(Counter* counters, uint64_t n) {
+  if (stripe_ < 0) {
+    stripe_ = next_stripe_.fetch_add(1, std::memory_order_relaxed) % kNumStripes;
+  }
+  counters[stripe_].cnt.fetch_add(n, std::memory_order_relaxed);
+}
+
+uint64_t Persist::Sum(const Counter* counters) {
+  uint64_t sum = 0;
+  for (int i = 0; i < kNumStripes; i++) {
+    sum += counters[i].cnt.load(std::memory_order_relaxed);
+  }
+  return sum;
+}
+
+void Persist::ResetCounters() {
+  for (int i = 0; i < kNumStripes; i++) {
+    flushed_lines_[i].cnt.store(0, std::memory_order_relaxed);
+    fences_[i].cnt.store(0, std::memory_order_relaxed);
+  }
+}
+
+inline void clwb(const void* addr, const size_t size) {
+  Persist::Flush(addr, size);
+}
+
+inline void sfence() {
+  Persist::Fence();
+}
+
+#endif  // LISTDB_PMEM_PERSIST_H_
@@ -0,0 +1,37 @@
+#include <cstdio>
+
+#include "listdb/pmem/persist.h"
+
+int main() {
+  alignas(64) static char buf[4096];
+  Persist::SetMode(Persist::kCounting);
+
+  struct Case {
+    size_t offset;
+    size_t size;
+    uint64_t num_lines;
+  };
+  // A range crossing a line boundary flushes both lines
+  Case cases[] = {{0, 8, 1}, {0, 64, 1}, {60, 8, 2}, {8, 64, 2}, {63, 66, 3}, {0, 0, 0}};
+  int rv = 0;
+  for (auto& c : cases) {
+    Persist::ResetCounters();
+    clwb(buf + c.offset, c.size);
+    sfence();
+    bool ok = (Persist::num_flushed_lines() == c.num_lines && Persist::num_fences() == 1);
+    fprintf(stdout, "clwb(+%zu, %zu): %s\n", c.offset, c.size, ok ? "PASSED" : "FAILED");
+    if (!ok) {
+      rv = 1;
+    }
+  }
+
+  Persist::SetMode(Persist::kEadr);
+  Persist::ResetCounters();
+  clwb(buf, sizeof(buf));
+  sfence();
+  if (Persist::num_flushed_lines() != 0 || Persist::num_fences() != 0) {
+    fprintf(stdout, "eadr: FAILED\n");
+    rv = 1;
+  }
+  return rv;
+}
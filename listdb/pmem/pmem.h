@@ -1,14 +1,44 @@
 #ifndef LISTDB_PMEM_PMEM_H_
 #define LISTDB_PMEM_PMEM_H_
 
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <experimental/filesystem>
 #include <iostream>
+#include <string>
 #include <vector>
 
+#include <libpmemobj.h>
 #include <libpmemobj++/p.hpp>
 #include <libpmemobj++/pool.hpp>
 
 class Pmem {
  public:
+  static constexpr int kMaxNumPools = 64;
+
+  // Where the pools live. kFile maps regular files: the data survives a
+  // process crash and reaches the disk on page cache writeback. kDram keeps
+  // the files in tmpfs and skips msync, as if it were PMEM. Both mirror the
+  // PMEM paths under dir().
+  enum Backend { kPmem, kFile, kDram };
+
+  // Must be called before the first pool is bound. Defaults to the
+  // LISTDB_PMEM_BACKEND environment variable (pmem, file or dram).
+  static void SetBackend(Backend backend, const std::string& dir = "");
+
+  static Backend backend();
+
+  static std::string dir() { return dir_; }
+
+  // Path of a pool file or directory on the current backend
+  static std::string Path(const std::string& pmem_path);
+
   template <typename T>
   static int BindPool(const std::string& path, const std::string& layout, const size_t size);
 
@@ -19,6 +49,9 @@ class Pmem {
 
   static void Clear();
 
+  // Exits unless the pool exists and was created with the layout
+  static void CheckLayout(const std::string& path, const std::string& layout);
+
   static pmem::obj::pool_base pool(const int pool_base_id) {
     return *pool_bases_[pool_base_id];
   }
@@ -28,20 +61,133 @@ class Pmem {
     return *((pmem::obj::pool<T>*) pool_bases_[pool_base_id]);
   }
 
+  // Poolsets bound afterwards grow their heap in multiples of it, so that
+  // the parts stay aligned to huge pages. 0 keeps the libpmemobj default.
+  static void SetPoolAlignment(const size_t alignment) { pool_alignment_ = alignment; }
+
+  // Faults in the pages of a mapped range
+  static void Prefault(const void* addr, const size_t size);
+
+  // Mapped address of a pool, without going through its pool_base
+  static uintptr_t base_addr(const int pool_base_id) {
+    return base_addrs_[pool_base_id];
+  }
+
  private:
+  static int Register(pmem::obj::pool_base* pool_base);
+
+  static void CreateParentDirectory(const std::string& path);
+
+  static void SetHeapGranularity(pmem::obj::pool_base* pool_base);
+
+  inline static int backend_ = -1;
+  inline static std::string dir_;
+  inline static size_t pool_alignment_ = 0;
+
   inline static std::vector<pmem::obj::pool_base*> pool_bases_;
+  alignas(64) inline static uintptr_t base_addrs_[kMaxNumPools] = {};
 };
 
+void Pmem::SetBackend(const Backend backend, const std::string& dir) {
+  backend_ = backend;
+  dir_ = dir;
+  if (dir_.empty()) {
+    const char* env_dir = getenv("LISTDB_PMEM_DIR");
+    if (env_dir) {
+      dir_ = env_dir;
+    } else if (backend == kFile) {
+      dir_ = "/tmp/listdb";
+    } else if (backend == kDram) {
+      dir_ = "/dev/shm/listdb";
+    }
+  }
+  if (backend == kDram) {
+    // tmpfs is DRAM, flushing the cache is enough
+    setenv("PMEM_IS_PMEM_FORCE", "1", 0);
+  }
+}
+
+Pmem::Backend Pmem::backend() {
+  if (backend_ < 0) {
+    const char* env = getenv("LISTDB_PMEM_BACKEND");
+    if (env == nullptr || strcmp(env, "pmem") == 0) {
+      SetBackend(kPmem);
+    } else if (strcmp(env, "file") == 0) {
+      SetBackend(kFile);
+    } else if (strcmp(env, "dram") == 0) {
+      SetBackend(kDram);
+    } else {
+      fprintf(stderr, "unknown LISTDB_PMEM_BACKEND: %s\n", env);
+      exit(1);
+    }
+  }
+  return (Backend) backend_;
+}
+
+std::string Pmem::Path(const std::string& pmem_path) {
+  if (backend() == kPmem) {
+    return pmem_path;
+  }
+  return dir_ + pmem_path;
+}
+
+void Pmem::CreateParentDirectory(const std::string& path) {
+  if (backend() != kPmem) {
+    auto parent = std::experimental::filesystem::path(path).parent_path();
+    if (!parent.empty()) {
+      std::experimental::filesystem::create_directories(parent);
+    }
+  }
+}
+
+void Pmem::Prefault(const void* addr, const size_t size) {
+  static const uintptr_t kPageSize = sysconf(_SC_PAGESIZE);
+  uintptr_t begin = (uintptr_t) addr & ~(kPageSize - 1);
+  uintptr_t end = (uintptr_t) addr + size;
+#ifdef MADV_POPULATE_WRITE
+  if (madvise((void*) begin, end - begin, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  // Kernels before 5.14. A read would map the zero page only; adding 0
+  // writes without racing the writers of a live page.
+  for (uintptr_t page = begin; page < end; page += kPageSize) {
+    __atomic_fetch_add((char*) page, 0, __ATOMIC_RELAXED);
+  }
+}
+
+void Pmem::SetHeapGranularity(pmem::obj::pool_base* pool_base) {
+  if (pool_alignment_ == 0) {
+    return;
+  }
+  constexpr size_t kDefaultGranularity = 128ull << 20;
+  size_t granularity = (kDefaultGranularity + pool_alignment_ - 1) / pool_alignment_ * pool_alignment_;
+  if (pmemobj_ctl_set(pool_base->handle(), "heap.size.granularity", &granularity) != 0) {
+    fprintf(stderr, "cannot set the heap granularity to %zu\n", granularity);
+  }
+}
+
+int Pmem::Register(pmem::obj::pool_base* pool_base) {
+  int pool_base_id = pool_bases_.size();
+  if (pool_base_id >= kMaxNumPools) {
+    fprintf(stderr, "too many pools (max %d)\n", kMaxNumPools);
+    exit(1);
+  }
+  pool_bases_.push_back(pool_base);
+  base_addrs_[pool_base_id] = (uintptr_t) pool_base->handle();
+  return pool_base_id;
+}
+
 template <typename T>
 int Pmem::BindPool(const std::string& path, const std::string& layout, const size_t size) {
+  CreateParentDirectory(path);
   pmem::obj::pool<T> pop;
   if (pmem::obj::pool_base::check(path, layout) == 1) {
     pop = pmem::obj::pool<T>::open(path, layout);
   } else {
     pop = pmem::obj::pool<T>::create(path, layout, size, 0666);
   }
-  auto it = pool_bases_.insert(pool_bases_.end(), new pmem::obj::pool<T>(pop));
-  return std::distance(pool_bases_.begin(), it);
+  return Register(new pmem::obj::pool<T>(pop));
 }
 
 int Pmem::BindPoolSet(const std::string& path, const std::string& layout) {
@@ -51,8 +197,9 @@ int Pmem::BindPoolSet(const std::string& path, const std::string& layout) {
   } else {
     pop = pmem::obj::pool_base::create(path, layout, 0, 0666);
   }
-  auto it = pool_bases_.insert(pool_bases_.end(), new pmem::obj::pool_base(pop));
-  return std::distance(pool_bases_.begin(), it);
+  auto pool_base = new pmem::obj::pool_base(pop);
+  SetHeapGranularity(pool_base);
+  return Register(pool_base);
 }
 
 template <typename T>
@@ -63,8 +210,16 @@ int Pmem::BindPoolSet(const std::string& path, const std::string& layout) {
   } else {
     pop = pmem::obj::pool<T>::create(path, layout, 0, 0666);
   }
-  auto it = pool_bases_.insert(pool_bases_.end(), new pmem::obj::pool<T>(pop));
-  return std::distance(pool_bases_.begin(), it);
+  auto pool_base = new pmem::obj::pool<T>(pop);
+  SetHeapGranularity(pool_base);
+  return Register(pool_base);
+}
+
+void Pmem::CheckLayout(const std::string& path, const std::string& layout) {
+  if (pmem::obj::pool_base::check(path, layout) != 1) {
+    fprintf(stderr, "%s: no consistent pool of layout %s\n", path.c_str(), layout.c_str());
+    exit(1);
+  }
 }
 
 void Pmem::Clear() {
@@ -72,6 +227,7 @@ void Pmem::Clear() {
     pool_base->close();
   }
   pool_bases_.clear();
+  std::fill(std::begin(base_addrs_), std::end(base_addrs_), 0);
 }
 
 #endif  // LISTDB_PMEM_PMEM_H_
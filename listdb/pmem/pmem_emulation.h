@@ -0,0 +1,89 @@
+#ifndef LISTDB_PMEM_PMEM_EMULATION_H_
+#define LISTDB_PMEM_PMEM_EMULATION_H_
+
+#include <x86intrin.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Injects PMEM latency when the pools live in DRAM or in regular files.
+// Every decoded PmemPtr is charged a load latency. Flushed lines are
+// accumulated per thread and charged at the next fence: the fence latency,
+// the flush latency of each line, and their transfer time at a write
+// bandwidth shared by all the threads.
+class PmemEmulation {
+ public:
+  struct Config {
+    uint64_t load_latency_ns = 0;  // on top of the DRAM latency
+    uint64_t flush_latency_ns = 0;  // per flushed line
+    uint64_t fence_latency_ns = 0;
+    uint64_t write_bandwidth_mbps = 0;  // 0: unlimited
+  };
+
+  static void Configure(const Config& config);
+
+  static void OnLoad() {
+    if (load_latency_ns_) {
+      Delay(load_latency_ns_);
+    }
+  }
+
+  static void OnFlush(const size_t num_lines) { pending_lines_ += num_lines; }
+
+  static void OnFence();
+
+ private:
+  static uint64_t NowNanos() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+
+  static void Delay(const uint64_t ns) {
+    SpinUntil(NowNanos() + ns);
+  }
+
+  static void SpinUntil(const uint64_t deadline) {
+    while (NowNanos() < deadline) {
+      _mm_pause();
+    }
+  }
+
+  inline static uint64_t load_latency_ns_ = 0;
+  inline static uint64_t flush_latency_ns_ = 0;
+  inline static uint64_t fence_latency_ns_ = 0;
+  inline static uint64_t write_bandwidth_mbps_ = 0;
+  inline static std::atomic<uint64_t> bandwidth_busy_until_{0};
+  inline static thread_local size_t pending_lines_ = 0;
+};
+
+void PmemEmulation::Configure(const Config& config) {
+  load_latency_ns_ = config.load_latency_ns;
+  flush_latency_ns_ = config.flush_latency_ns;
+  fence_latency_ns_ = config.fence_latency_ns;
+  write_bandwidth_mbps_ = config.write_bandwidth_mbps;
+}
+
+void PmemEmulation::OnFence() {
+  size_t num_lines = pending_lines_;
+  pending_lines_ = 0;
+  if (num_lines == 0 && fence_latency_ns_ == 0) {
+    return;
+  }
+  uint64_t now = NowNanos();
+  uint64_t deadline = now + fence_latency_ns_ + num_lines * flush_latency_ns_;
+  if (write_bandwidth_mbps_ && num_lines > 0) {
+    // Reserve a transfer slot behind the writes of the other threads
+    uint64_t transfer_ns = num_lines * 64 * 1000 / write_bandwidth_mbps_;
+    uint64_t busy_until = bandwidth_busy_until_.load(std::memory_order_relaxed);
+    uint64_t done;
+    do {
+      done = std::max(busy_until, now) + transfer_ns;
+    } while (!bandwidth_busy_until_.compare_exchange_weak(busy_until, done, std::memory_order_relaxed));
+    deadline = std::max(deadline, done);
+  }
+  SpinUntil(deadline);
+}
+
+#endif  // LISTDB_PMEM_PMEM_EMULATION_H_
@@ -2,6 +2,9 @@
 #define LISTDB_PMEM_PMEM_PTR_H_
 
 #include "listdb/pmem/pmem.h"
+#ifdef LISTDB_PMEM_EMULATION
+#include "listdb/pmem/pmem_emulation.h"
+#endif
 
 class PmemPtr {
  public:
@@ -34,11 +37,11 @@ class PmemPtr {
     if (offset == 0) {
       return nullptr;
     }
-    return (T*) ((uintptr_t) Pmem::pool(pool_id).handle() + offset);
+    return (T*) (Pmem::base_addr(pool_id) + offset);
   }
 
   static uint64_t OffsetOfVaddr(int16_t pool_id, void* vaddr) {
-    return (uintptr_t) vaddr - (uintptr_t) Pmem::pool(pool_id).handle();
+    return (uintptr_t) vaddr - Pmem::base_addr(pool_id);
   }
 
  private:
@@ -48,22 +51,14 @@ class PmemPtr {
 PmemPtr::PmemPtr(const int16_t pool_id, const uint64_t offset) : data_(Encode(pool_id, offset)) { }
 
 PmemPtr::PmemPtr(int16_t pool_id, char* vaddr) {
-  uint64_t offset = (uintptr_t) vaddr - (uintptr_t) Pmem::pool(pool_id).handle();
+  uint64_t offset = (uintptr_t) vaddr - Pmem::base_addr(pool_id);
   data_ = Encode(pool_id, offset);
 }
 
 PmemPtr::PmemPtr(const uint64_t dump) : data_(dump) { }
 
 inline void* PmemPtr::get() {
-  if (data_ == 0) {
-    return nullptr;
-  }
-  //int *p2 = (int *)(((uintptr_t)p1 & ((1ull << 48) - 1)) |
-  //  ~(((uintptr_t)p1 & (1ull << 47)) - 1));
-  static const uintptr_t kMask = 0x0000ffffffffffff;
-  const int16_t pool_id = (data_ >> 48);
-  const uint64_t offset = (data_ & kMask);
-  return (void*) ((uintptr_t) Pmem::pool(pool_id).handle() + offset);
+  return Decode<void>(data_);
 }
 
 template <typename T>
@@ -90,17 +85,15 @@ inline uint64_t PmemPtr::Encode(const int16_t pool_id, const uint64_t offset) {
   return ((uint64_t) pool_id << 48) | offset;
 }
 
+// Branch-free: a null dump masks the address of pool 0 back to nullptr
 template <typename T>
 inline T* PmemPtr::Decode(const uint64_t dump) {
-  if (dump == 0) {
-    return nullptr;
-  }
-  //int *p2 = (int *)(((uintptr_t)p1 & ((1ull << 48) - 1)) |
-  //  ~(((uintptr_t)p1 & (1ull << 47)) - 1));
+#ifdef LISTDB_PMEM_EMULATION
+  PmemEmulation::OnLoad();
+#endif
   static const uintptr_t kMask = 0x0000ffffffffffff;
-  const int16_t pool_id = (dump >> 48);
-  const uint64_t offset = (dump & kMask);
-  return (T*) ((uintptr_t) Pmem::pool(pool_id).handle() + offset);
+  const uintptr_t addr = Pmem::base_addr(dump >> 48) + (dump & kMask);
+  return (T*) (addr & -(uintptr_t) (dump != 0));
 }
 
 #endif  // LISTDB_PMEM_PMEM_PTR_H_
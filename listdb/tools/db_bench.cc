@@ -205,6 +205,65 @@ DEFINE_bool(use_existing_db, false, "If true, do not destroy the existing"
             " database.  If you set this flag and also specify a benchmark that"
             " wants a fresh database, that benchmark will fail.");
 
+DEFINE_bool(bg_numa_binding, false, "Bind background workers to the NUMA"
+            " node of the region they serve.");
+
+DEFINE_bool(lazy_recovery, false, "Return from Open() before the shards are"
+            " recovered. A shard is recovered on its first use.");
+
+DEFINE_string(bg_cpus, "", "Cpus reserved for background workers, e.g."
+              " \"0-3,40-43\". Client threads do not run on them.");
+
+DEFINE_string(pmem_backend, "", "Where the pools live: pmem, file (regular"
+              " files) or dram (tmpfs). LISTDB_PMEM_BACKEND if empty.");
+
+DEFINE_string(persist_mode, "", "How writes are persisted: adr (clwb and"
+              " sfence), eadr (no flush), ntstore (non-temporal log writes) or"
+              " counting (adr, and reports flushed lines and fences per op)."
+              " LISTDB_PERSIST_MODE or platform detection if empty.");
+
+DEFINE_string(pmem_dir, "", "Directory that mirrors the PMEM paths on the"
+              " file and dram backends.");
+
+#ifdef LISTDB_PMEM_EMULATION
+DEFINE_uint64(pmem_load_latency_ns, 0, "Emulated latency of a PMEM load.");
+
+DEFINE_uint64(pmem_flush_latency_ns, 0, "Emulated latency of a flushed line.");
+
+DEFINE_uint64(pmem_fence_latency_ns, 0, "Emulated latency of a fence.");
+
+DEFINE_uint64(pmem_write_bandwidth_mbps, 0, "Emulated PMEM write bandwidth"
+              " in MB/s. 0 for unlimited.");
+#endif
+
+DEFINE_string(db_path, "/pmem/wkim/listdb", "Root pool of the database.");
+
+DEFINE_string(region_dirs, "", "Comma-separated pool directory of every"
+              " region. /pmem<region>/wkim if empty.");
+
+DEFINE_string(poolset_part_size, "400G", "Part size of a region poolset.");
+
+DEFINE_string(pool_alignment, "", "Round poolset parts and heap extensions"
+              " up to it, e.g. 2M or 1G for huge page mappings.");
+
+DEFINE_bool(prefault, false, "Fault in the log blocks on Open(), one thread"
+            " per region.");
+
+DEFINE_uint64(memtable_capacity, kMemTableCapacity, "MemTable capacity in"
+              " bytes over all the shards.");
+
+DEFINE_int32(max_num_memtables, kMaxNumMemTables, "Max number of memtables"
+             " per shard before writes stall.");
+
+DEFINE_int32(num_workers, kNumWorkers, "Number of background workers.");
+
+DEFINE_uint64(ht_size, kHTSize, "Number of L0 cache buckets.");
+
+#ifdef LISTDB_SKIPLIST_CACHE
+DEFINE_uint64(skiplist_cache_capacity, kSkipListCacheCapacity, "L1 cache"
+              " capacity in bytes over all the shards.");
+#endif
+
 static std::string FLAGS_db = "/pmem/wkim/listdb";
 //DEFINE_string(db, "", "Use the db with the following name.");
 
@@ -519,6 +578,8 @@ class Stats {
  public:
   Stats() { Start(-1); }
 
+  uint64_t done() const { return done_; }
+
   void SetReporterAgent(ReporterAgent* reporter_agent) {
     reporter_agent_ = reporter_agent;
   }
@@ -885,8 +946,10 @@ class Benchmark {
         reads_(FLAGS_reads < 0 ? FLAGS_num : FLAGS_reads),
         read_random_exp_range_(0.0),
         writes_(FLAGS_writes < 0 ? FLAGS_num : FLAGS_writes) {
+    InitPmemBackend();
+    db_->SetBackgroundNumaBinding(FLAGS_bg_numa_binding);
     if (!FLAGS_use_existing_db) {
-      db_->Init();
+      db_->Init(DBOptions());
     } else {
       abort();
       //db_->Open();
@@ -901,6 +964,66 @@ class Benchmark {
   ~Benchmark() {
   }
 
+  static void InitPmemBackend() {
+    Pmem::Backend backend = Pmem::backend();
+    if (FLAGS_pmem_backend == "pmem") {
+      backend = Pmem::kPmem;
+    } else if (FLAGS_pmem_backend == "file") {
+      backend = Pmem::kFile;
+    } else if (FLAGS_pmem_backend == "dram") {
+      backend = Pmem::kDram;
+    } else if (!FLAGS_pmem_backend.empty()) {
+      fprintf(stderr, "unknown --pmem_backend: %s\n", FLAGS_pmem_backend.c_str());
+      exit(1);
+    }
+    Pmem::SetBackend(backend, FLAGS_pmem_dir);
+#ifdef LISTDB_PMEM_EMULATION
+    PmemEmulation::Config config;
+    config.load_latency_ns = FLAGS_pmem_load_latency_ns;
+    config.flush_latency_ns = FLAGS_pmem_flush_latency_ns;
+    config.fence_latency_ns = FLAGS_pmem_fence_latency_ns;
+    config.write_bandwidth_mbps = FLAGS_pmem_write_bandwidth_mbps;
+    PmemEmulation::Configure(config);
+#endif
+  }
+
+  static ListDB::Options DBOptions() {
+    ListDB::Options options;
+    options.db_path = FLAGS_db_path;
+    std::stringstream ss(FLAGS_region_dirs);
+    std::string dir;
+    while (std::getline(ss, dir, ',')) {
+      if (!dir.empty()) {
+        options.region_dirs.push_back(dir);
+      }
+    }
+    options.poolset_part_size = FLAGS_poolset_part_size;
+    if (!FLAGS_pool_alignment.empty()) {
+      options.pool_alignment = ListDB::ParseSize(FLAGS_pool_alignment);
+    }
+    options.prefault = FLAGS_prefault;
+    if (FLAGS_persist_mode == "adr") {
+      options.persist_mode = Persist::kAdr;
+    } else if (FLAGS_persist_mode == "eadr") {
+      options.persist_mode = Persist::kEadr;
+    } else if (FLAGS_persist_mode == "ntstore") {
+      options.persist_mode = Persist::kNtStore;
+    } else if (FLAGS_persist_mode == "counting") {
+      options.persist_mode = Persist::kCounting;
+    } else if (!FLAGS_persist_mode.empty()) {
+      fprintf(stderr, "unknown --persist_mode: %s\n", FLAGS_persist_mode.c_str());
+      exit(1);
+    }
+    options.memtable_capacity = FLAGS_memtable_capacity;
+    options.max_num_memtables = FLAGS_max_num_memtables;
+    options.num_workers = FLAGS_num_workers;
+    options.ht_size = FLAGS_ht_size;
+#ifdef LISTDB_SKIPLIST_CACHE
+    options.skiplist_cache_capacity = FLAGS_skiplist_cache_capacity;
+#endif
+    return options;
+  }
+
   std::string_view AllocateKey(std::unique_ptr<const char[]>* key_guard) {
     char* data = new char[key_size_];
     const char* const_data = data;
@@ -1335,6 +1458,7 @@ class Benchmark {
     }
 
     ThreadArg* arg = new ThreadArg[n];
+    Persist::ResetCounters();
 
     std::vector<std::thread> threads;
     for (int i = 0; i < n; i++) {
@@ -1375,6 +1499,12 @@ class Benchmark {
       merge_stats.Merge(arg[i].thread->stats);
     }
     merge_stats.Report(name);
+    if (Persist::mode() == Persist::kCounting && merge_stats.done() > 0) {
+      // Background flushes and compactions are included
+      fprintf(stdout, "%-12s : %.3f flushed lines/op %.3f fences/op\n", name.c_str(),
+              (double) Persist::num_flushed_lines() / merge_stats.done(),
+              (double) Persist::num_fences() / merge_stats.done());
+    }
 
     // Op Time Array
     if (arg[0].thread->op_time_arr) {
@@ -2145,9 +2275,10 @@ class Benchmark {
     delete db_;
     fprintf(stdout, "> db_ = new ListDB();\n");
     db_ = new ListDB();
+    db_->SetLazyRecovery(FLAGS_lazy_recovery);
     fprintf(stdout, "> db_->Open();\n");
     auto open_begin_tp = std::chrono::steady_clock::now();
-    db_->Open();
+    db_->Open(DBOptions());
     auto open_end_tp = std::chrono::steady_clock::now();
     std::chrono::duration<double> open_dur = open_end_tp - open_begin_tp;
     fprintf(stdout, "Open() time: %.3lf sec\n", open_dur.count());
@@ -2453,6 +2584,21 @@ int db_bench_tool(int argc, char** argv) {
     FLAGS_stats_interval = 1000;
   }
 
+  if (!FLAGS_bg_cpus.empty()) {
+    std::vector<int> bg_cpus;
+    std::stringstream ss(FLAGS_bg_cpus);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+      auto dash = range.find('-');
+      int first = std::stoi(range.substr(0, dash));
+      int last = (dash == std::string::npos) ? first : std::stoi(range.substr(dash + 1));
+      for (int cpu = first; cpu <= last; cpu++) {
+        bg_cpus.push_back(cpu);
+      }
+    }
+    Numa::Reserve(bg_cpus);
+  }
+
   Benchmark benchmark;
   benchmark.Run();
 
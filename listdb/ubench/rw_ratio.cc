@@ -151,7 +151,7 @@ void InitPoolSet() {
   for (int i = 0; i < kNumRegions; i++) {
     std::stringstream pss;
     pss << "/pmem" << i << "/wkim/pmem_log_test";
-    std::string path = pss.str();
+    std::string path = Pmem::Path(pss.str());
     fs::remove_all(path);
     fs::create_directories(path);
 
@@ -1,10 +1,18 @@
 #ifndef LISTDB_UTIL_RATE_LIMITER_H_
 #define LISTDB_UTIL_RATE_LIMITER_H_
 
+#include <algorithm>
+#include <atomic>
+#include <cassert>
 #include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
 #include <mutex>
+#include <vector>
 
 #include "listdb/util/clock.h"
+#include "listdb/util/random.h"
 #include "listdb/env.h"
 
 // Exceptions MUST NOT propagate out of overridden functions into RocksDB,
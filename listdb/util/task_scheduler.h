@@ -0,0 +1,180 @@
+#ifndef LISTDB_UTIL_TASK_SCHEDULER_H_
+#define LISTDB_UTIL_TASK_SCHEDULER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Per-region task queues with work stealing. A worker takes a task from the
+// queue of its own region first and steals from the others when that is
+// empty. Every higher-priority task, local or remote, goes before a
+// lower-priority one. Workers sleep only after finding all queues empty.
+template <typename T>
+class TaskScheduler {
+ public:
+  enum Priority {
+    kHigh,
+    kNormal,
+    kLow,
+    kNumPriorities
+  };
+
+  explicit TaskScheduler(const int num_queues);
+
+  ~TaskScheduler();
+
+  void Push(T* task, const int queue, const Priority pri);
+
+  // Blocks until a task is available. Returns nullptr after Stop().
+  T* Pop(const int queue);
+
+  T* TryPop(const int queue);
+
+  // Wakes up the workers and deletes the tasks left in the queues
+  void Stop();
+
+  size_t num_tasks() { return num_tasks_.load(std::memory_order_relaxed); }
+
+ private:
+  struct alignas(64) Queue {
+    std::atomic_flag lock = ATOMIC_FLAG_INIT;
+    std::deque<T*> dq[kNumPriorities];
+    std::atomic<size_t> size[kNumPriorities] = {};  // peeked without the lock
+  };
+
+  T* TryPopFrom(Queue* q, const Priority pri);
+
+  void DeleteQueuedTasks();
+
+  static constexpr int kSpinCount = 64;
+
+  const int num_queues_;
+  std::unique_ptr<Queue[]> queues_;
+  std::atomic<size_t> num_tasks_{0};
+  std::atomic<int> num_sleeping_{0};
+  std::atomic<bool> stop_{false};
+  std::mutex idle_mu_;
+  std::condition_variable idle_cv_;
+};
+
+template <typename T>
+TaskScheduler<T>::TaskScheduler(const int num_queues)
+    : num_queues_(num_queues), queues_(new Queue[num_queues]) { }
+
+// Tasks pushed by the workers after Stop()
+template <typename T>
+TaskScheduler<T>::~TaskScheduler() {
+  DeleteQueuedTasks();
+}
+
+template <typename T>
+void TaskScheduler<T>::Push(T* task, const int queue, const Priority pri) {
+  Queue* q = &queues_[queue % num_queues_];
+  // Counted before a worker can pop it, so the count never goes below zero
+  num_tasks_.fetch_add(1);
+  while (q->lock.test_and_set(std::memory_order_acquire)) {
+    continue;
+  }
+  q->dq[pri].push_back(task);
+  q->size[pri].fetch_add(1, std::memory_order_relaxed);
+  q->lock.clear(std::memory_order_release);
+  if (num_sleeping_.load() > 0) {
+    std::lock_guard<std::mutex> lk(idle_mu_);
+    idle_cv_.notify_one();
+  }
+}
+
+template <typename T>
+T* TaskScheduler<T>::TryPopFrom(Queue* q, const Priority pri) {
+  if (q->size[pri].load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+  T* task = nullptr;
+  while (q->lock.test_and_set(std::memory_order_acquire)) {
+    continue;
+  }
+  if (!q->dq[pri].empty()) {
+    task = q->dq[pri].front();
+    q->dq[pri].pop_front();
+    q->size[pri].fetch_sub(1, std::memory_order_relaxed);
+  }
+  q->lock.clear(std::memory_order_release);
+  if (task) {
+    num_tasks_.fetch_sub(1);
+  }
+  return task;
+}
+
+template <typename T>
+T* TaskScheduler<T>::TryPop(const int queue) {
+  if (num_tasks_.load(std::memory_order_relaxed) == 0) {
+    return nullptr;
+  }
+  for (int pri = 0; pri < kNumPriorities; pri++) {
+    for (int i = 0; i < num_queues_; i++) {
+      T* task = TryPopFrom(&queues_[(queue + i) % num_queues_], (Priority) pri);
+      if (task) {
+        return task;
+      }
+    }
+  }
+  return nullptr;
+}
+
+template <typename T>
+T* TaskScheduler<T>::Pop(const int queue) {
+  while (true) {
+    for (int i = 0; i < kSpinCount; i++) {
+      T* task = TryPop(queue);
+      if (task) {
+        return task;
+      }
+      if (stop_.load(std::memory_order_relaxed)) {
+        return nullptr;
+      }
+      std::this_thread::yield();
+    }
+    std::unique_lock<std::mutex> lk(idle_mu_);
+    num_sleeping_.fetch_add(1);
+    idle_cv_.wait(lk, [&]{ return num_tasks_.load() > 0 || stop_.load(); });
+    num_sleeping_.fetch_sub(1);
+  }
+}
+
+template <typename T>
+void TaskScheduler<T>::Stop() {
+  {
+    std::lock_guard<std::mutex> lk(idle_mu_);
+    stop_.store(true);
+    idle_cv_.notify_all();
+  }
+  DeleteQueuedTasks();
+}
+
+template <typename T>
+void TaskScheduler<T>::DeleteQueuedTasks() {
+  for (int i = 0; i < num_queues_; i++) {
+    Queue* q = &queues_[i];
+    while (q->lock.test_and_set(std::memory_order_acquire)) {
+      continue;
+    }
+    size_t num_deleted = 0;
+    for (int pri = 0; pri < kNumPriorities; pri++) {
+      for (auto& task : q->dq[pri]) {
+        delete task;
+      }
+      num_deleted += q->dq[pri].size();
+      q->dq[pri].clear();
+      q->size[pri].store(0, std::memory_order_relaxed);
+    }
+    q->lock.clear(std::memory_order_release);
+    num_tasks_.fetch_sub(num_deleted);
+  }
+}
+
+#endif  // LISTDB_UTIL_TASK_SCHEDULER_H_
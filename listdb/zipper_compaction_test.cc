@@ -0,0 +1,106 @@
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "listdb/listdb.h"
+#include "listdb/db_client.h"
+
+// Overwrites the keys of a single shard round by round, so its L0 tables
+// are merged into L1 in several zipper partitions, while a reader checks
+// every key (the first keys of the partitions among them) on each pass.
+int main() {
+  constexpr uint64_t kNumKeys = 200000;
+  constexpr uint64_t kNumRounds = 20;
+
+  ListDB::Options options;
+  options.backend = Pmem::kDram;
+  options.db_path = "/pmem/listdb_zipper_compaction_test";
+  options.poolset_part_size = "1G";
+  options.memtable_capacity = 16 * (1ull << 20);
+  options.num_workers = 8;
+  options.ht_size = 1ull << 20;
+
+  ListDB* db = new ListDB();
+  db->Init(options);
+  DBClient* writer = new DBClient(db, 0, 0);
+
+  // Multiples of kNumShards all go to shard 0
+  auto key = [](uint64_t k) { return k * kNumShards; };
+  for (uint64_t k = 1; k <= kNumKeys; k++) {
+    writer->Put(key(k), 1);
+  }
+
+  std::atomic<uint64_t> round{1};
+  std::atomic<bool> done{false};
+  std::atomic<bool> failed{false};
+  std::thread reader([&] {
+    DBClient* client = new DBClient(db, 1, 1);
+    std::vector<uint64_t> seen(kNumKeys + 1, 1);
+    while (!done.load() && !failed.load()) {
+      for (uint64_t k = 1; k <= kNumKeys; k++) {
+        uint64_t max_value = round.load();
+        Value v;
+        if (!client->Get(key(k), &v)) {
+          fprintf(stdout, "FAILED: key %lu not found\n", key(k));
+          failed.store(true);
+          break;
+        }
+        if (v < seen[k] || v > max_value) {
+          fprintf(stdout, "FAILED: key %lu read %lu after %lu (round %lu)\n", key(k), v, seen[k], max_value);
+          failed.store(true);
+          break;
+        }
+        seen[k] = v;
+      }
+    }
+    delete client;
+  });
+
+  uint64_t last_round = 1;
+  for (uint64_t r = 2; r <= kNumRounds && !failed.load(); r++) {
+    round.store(r);
+    for (uint64_t k = 1; k <= kNumKeys; k++) {
+      writer->Put(key(k), r);
+    }
+    last_round = r;
+  }
+  done.store(true);
+  reader.join();
+
+  delete writer;
+  std::string stats;
+  db->GetStatString("zipper_stats", &stats);
+  fprintf(stdout, "%s\n", stats.c_str());
+  db->Close();
+  if (failed.load()) {
+    return 1;
+  }
+#if !defined(LISTDB_L1_LRU) && !defined(LISTDB_SKIPLIST_CACHE)
+  // L1 caches keep a merge in one partition
+  size_t num_merges = 0;
+  size_t num_partitions = 0;
+  sscanf(stats.c_str(), "zipper merges: %zu (partitions: %zu)", &num_merges, &num_partitions);
+  if (num_partitions <= num_merges) {
+    fprintf(stdout, "FAILED: no merge ran in more than one partition\n");
+    return 1;
+  }
+#endif
+
+  // Recovery frees what is left of the merged L0 tables
+  db = new ListDB();
+  db->Open(options);
+  DBClient* client = new DBClient(db, 0, 0);
+  for (uint64_t k = 1; k <= kNumKeys; k++) {
+    Value v;
+    if (!client->Get(key(k), &v) || v != last_round) {
+      fprintf(stdout, "FAILED: key %lu after reopen\n", key(k));
+      return 1;
+    }
+  }
+  delete client;
+  db->Close();
+  fprintf(stdout, "PASSED\n");
+  return 0;
+}